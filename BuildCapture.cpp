@@ -0,0 +1,293 @@
+#include "stdafx.h"
+#include "BuildCapture.h"
+#include "Checkpoint.h"
+#include "Threading.h"
+
+#include <algorithm>
+#include <cstdio>
+#include <ctime>
+
+static const int kCaptureTag = 0x50414352; // "RCAP"
+static const int kCaptureVersion = 3;
+
+// Slow builds seen by this process, for the sampling.
+static volatile long s_slowBuilds = 0;
+
+// Everything but the segments, in file order.
+static void writeCaptureHeader(PayloadWriter& writer, size_t count, double snapSize,
+	const RoomGraph::Options& options, const RoomGraph::BuildStats& stats, int rooms)
+{
+	writer.putInt(kCaptureTag);
+	writer.putInt(kCaptureVersion);
+	writer.putInt(static_cast<int>(std::time(NULL)));
+
+	writer.putDouble(snapSize);
+	writer.putInt((options.mergeCollinear ? 1 : 0) | (options.snapRounding ? 2 : 0)
+		| (options.hardwareCounters ? 4 : 0) | (options.validate ? 8 : 0));
+	writer.putDouble(static_cast<double>(options.externalMemoryBudget));
+	writer.putInt(options.threads);
+	writer.putInt(options.strategy);
+
+	double totalMs = 0.0;
+	for (int s = 0; s < RoomGraph::StageCount; ++s)
+	{
+		writer.putDouble(stats.stageMs[s]);
+		totalMs += stats.stageMs[s];
+	}
+	writer.putDouble(totalMs);
+	writer.putDouble(static_cast<double>(stats.predicates.calls));
+	writer.putDouble(static_cast<double>(stats.predicates.fallbacks));
+	writer.putDouble(static_cast<double>(stats.peakMemory));
+	writer.putInt(rooms);
+
+	// The strategy the build took, which for StrategyAuto may differ
+	// from one run to the next.
+	writer.putInt(stats.plan.strategy);
+	writer.putInt(stats.plan.threads);
+	writer.putInt(stats.plan.tuned ? 1 : 0);
+
+	writer.putInt(static_cast<int>(count));
+}
+
+size_t captureFileSize(size_t count)
+{
+	std::vector<char> header;
+	PayloadWriter writer(header);
+	writeCaptureHeader(writer, count, 0.0, RoomGraph::Options(), RoomGraph::BuildStats(), 0);
+
+	return checkpointFileSize(header.size() + count * sizeof(Segment));
+}
+
+bool writeBuildCapture(const std::string& path, const Segment* segments, size_t count,
+	double snapSize, const RoomGraph::Options& options, const RoomGraph::BuildStats& stats,
+	int rooms, size_t maxBytes)
+{
+	// The payload size of a checkpoint is an unsigned int.
+	const size_t bytes = captureFileSize(count);
+	if ((maxBytes > 0 && bytes > maxBytes) || bytes > 0xffffff00u)
+		return false;
+
+	std::vector<char> payload;
+	payload.reserve(bytes);
+
+	PayloadWriter writer(payload);
+	writeCaptureHeader(writer, count, snapSize, options, stats, rooms);
+	if (count > 0)
+		writer.putBytes(segments, count * sizeof(Segment));
+
+	return writeCheckpoint(path, payload);
+}
+
+bool readBuildCapture(const std::string& path, BuildCapture& capture)
+{
+	std::vector<char> payload;
+	if (readCheckpoint(path, payload) != CheckpointOk)
+		return false;
+
+	PayloadReader reader(payload);
+
+	int tag = 0;
+	int version = 0;
+	if (!reader.getInt(tag) || tag != kCaptureTag || !reader.getInt(version)
+		|| version < 1 || version > kCaptureVersion)
+	{
+		return false;
+	}
+
+	int capturedAt = 0;
+	int flags = 0;
+	double budget = 0.0;
+	reader.getInt(capturedAt);
+	reader.getDouble(capture.snapSize);
+	reader.getInt(flags);
+	reader.getDouble(budget);
+
+	capture.capturedAt = capturedAt;
+	capture.options = RoomGraph::Options();
+	capture.options.mergeCollinear = (flags & 1) != 0;
+	capture.options.snapRounding = (flags & 2) != 0;
+	capture.options.hardwareCounters = (flags & 4) != 0;
+	capture.options.validate = (flags & 8) != 0;
+	capture.options.externalMemoryBudget = static_cast<size_t>(budget);
+	reader.getInt(capture.options.threads);
+	if (version >= 2)
+		reader.getInt(capture.options.strategy);
+
+	capture.stats = RoomGraph::BuildStats();
+	for (int s = 0; s < RoomGraph::StageCount; ++s)
+		reader.getDouble(capture.stats.stageMs[s]);
+
+	double calls = 0.0;
+	double fallbacks = 0.0;
+	double peak = 0.0;
+	reader.getDouble(capture.totalMs);
+	reader.getDouble(calls);
+	reader.getDouble(fallbacks);
+	reader.getDouble(peak);
+	reader.getInt(capture.rooms);
+
+	capture.stats.predicates.calls = static_cast<unsigned long>(calls);
+	capture.stats.predicates.fallbacks = static_cast<unsigned long>(fallbacks);
+	capture.stats.peakMemory = static_cast<size_t>(peak);
+
+	if (version >= 3)
+	{
+		int tuned = 0;
+		reader.getInt(capture.stats.plan.strategy);
+		reader.getInt(capture.stats.plan.threads);
+		reader.getInt(tuned);
+		capture.stats.plan.tuned = tuned != 0;
+	}
+
+	int count = 0;
+	if (!reader.getInt(count) || count < 0 || static_cast<size_t>(count) * sizeof(Segment) > payload.size())
+		return false;
+
+	capture.segments.resize(count);
+	if (count > 0)
+		reader.getBytes(&capture.segments[0], count * sizeof(Segment));
+
+	return reader.ok() && reader.atEnd();
+}
+
+bool captureSlowBuild(const Segment* segments, size_t count, double snapSize,
+	const RoomGraph::Options& options, const RoomGraph::BuildStats& stats, int rooms, double totalMs)
+{
+	if (options.captureDirectory.empty() || totalMs < options.captureThresholdMs)
+		return false;
+
+	// One slow build in captureSampling, starting with the first.
+	const long slowBuild = atomicIncrement(&s_slowBuilds);
+	if (options.captureSampling > 1 && (slowBuild - 1) % options.captureSampling != 0)
+		return false;
+
+	// Unique within the process; the process id keeps processes sharing
+	// the directory apart, and the time later runs of the same id.
+	char name[96];
+	std::sprintf(name, "/capture-%d-%ld-%ld.rgc", currentProcessId(),
+		static_cast<long>(std::time(NULL)), slowBuild);
+
+	return writeBuildCapture(options.captureDirectory + name, segments, count,
+		snapSize, options, stats, rooms, options.captureMaxBytes);
+}
+
+static double median(std::vector<double> values)
+{
+	if (values.empty())
+		return 0.0;
+
+	std::sort(values.begin(), values.end());
+
+	const size_t half = values.size() / 2;
+	if (values.size() % 2 == 1)
+		return values[half];
+
+	return 0.5 * (values[half - 1] + values[half]);
+}
+
+void replayCapture(const BuildCapture& capture, const RoomGraph::Options& options, int repetitions,
+	ReplayResult& result)
+{
+	result = ReplayResult();
+
+	RoomGraph::Options replayOptions = options;
+	replayOptions.captureDirectory.clear();
+
+	RoomGraph graph;
+	graph.setSnapSize(capture.snapSize);
+	graph.setOptions(replayOptions);
+
+	// Warm-up, so the runs measure warm rebuilds.
+	graph.build(capture.segments);
+
+	std::vector<double> times[RoomGraph::StageCount];
+	std::vector<double> totals;
+	int s;
+
+	for (int run = 0; run < repetitions; ++run)
+	{
+		graph.build(capture.segments);
+
+		const RoomGraph::BuildStats& stats = graph.getStats();
+		double total = 0.0;
+
+		for (s = 0; s < RoomGraph::StageCount; ++s)
+		{
+			times[s].push_back(stats.stageMs[s]);
+			total += stats.stageMs[s];
+		}
+		totals.push_back(total);
+	}
+
+	const RoomGraph::BuildStats& stats = graph.getStats();
+
+	result.runs = repetitions;
+	result.rooms = static_cast<int>(graph.getRooms().size());
+	for (s = 0; s < RoomGraph::StageCount; ++s)
+	{
+		result.stageMs[s] = median(times[s]);
+		result.hardware[s] = stats.hardware[s];
+	}
+	result.totalMs = median(totals);
+	result.peakMemory = stats.peakMemory;
+	result.validation = stats.validation;
+}
+
+void formatReplay(const BuildCapture& capture, const ReplayResult& result, std::string& report)
+{
+	char line[256];
+
+	std::sprintf(line, "%lu segments, snap %g, captured %.2f ms with %d rooms, replayed %.2f ms with %d rooms (median of %d)\n",
+		static_cast<unsigned long>(capture.segments.size()), capture.snapSize,
+		capture.totalMs, capture.rooms, result.totalMs, result.rooms, result.runs);
+	report += line;
+
+	if (result.rooms != capture.rooms)
+		report += "room count differs from the capture\n";
+
+	std::sprintf(line, "%-8s %11s %10s %7s %14s %6s %12s %13s\n",
+		"stage", "captured ms", "replay ms", "ratio", "cycles", "IPC", "LLC misses", "branch misses");
+	report += line;
+
+	for (int s = 0; s < RoomGraph::StageCount; ++s)
+	{
+		const HardwareCounters& events = result.hardware[s];
+		const double captured = capture.stats.stageMs[s];
+
+		std::sprintf(line, "%-8s %11.3f %10.3f %6.2fx",
+			RoomGraph::stageName(s), captured, result.stageMs[s],
+			captured > 0.0 ? result.stageMs[s] / captured : 0.0);
+		report += line;
+
+		if (events.available[EventCycles] && events.available[EventInstructions])
+		{
+			std::sprintf(line, " %14.0f %6.2f", static_cast<double>(events.counts[EventCycles]), events.ipc());
+			report += line;
+		}
+		else
+		{
+			report += "              -      -";
+		}
+
+		for (int e = EventCacheMisses; e <= EventBranchMisses; ++e)
+		{
+			if (events.available[e])
+				std::sprintf(line, " %*.0f", e == EventCacheMisses ? 12 : 13, static_cast<double>(events.counts[e]));
+			else
+				std::sprintf(line, " %*s", e == EventCacheMisses ? 12 : 13, "-");
+			report += line;
+		}
+
+		report += "\n";
+	}
+
+	if (result.peakMemory > 0)
+	{
+		std::sprintf(line, "peak heap %lu bytes, captured %lu\n",
+			static_cast<unsigned long>(result.peakMemory), static_cast<unsigned long>(capture.stats.peakMemory));
+		report += line;
+	}
+
+	if (result.validation.complete)
+		report += result.validation.ok() ? "topology check passed\n" : "topology check FAILED\n";
+}
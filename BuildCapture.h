@@ -0,0 +1,84 @@
+#ifndef BUILDCAPTURE_H
+#define BUILDCAPTURE_H
+
+#include <vector>
+#include <string>
+#include "Geometry.h"
+#include "RoomGraph.h"
+
+// Captures of slow builds, to reproduce them away from the drawing they
+// came from. RoomGraph::build() writes one when Options::captureDirectory
+// is set and the build was slow enough; see RoomGraph::Options.
+
+// One captured build: the input exactly as build() received it, the snap
+// size and options it ran with, and what the build measured.
+struct BuildCapture
+{
+	std::vector<Segment>   segments;
+	double                 snapSize;
+	RoomGraph::Options     options; // without tempDirectory and the capture settings
+	RoomGraph::BuildStats  stats;   // stage times, predicates, peak memory and
+	                                // the plan taken (left at its defaults
+	                                // in captures older than version 3)
+	int                    rooms;
+	double                 totalMs;
+	long                   capturedAt; // time() of the capture
+
+	BuildCapture() : segments(), snapSize(1e-3), options(), stats(), rooms(0), totalMs(0.0), capturedAt(0) {}
+};
+
+// Bytes a capture of count segments takes on disk, header included.
+size_t captureFileSize(size_t count);
+
+// Write a capture file: a checkpoint (see Checkpoint.h) holding the
+// settings, the stats and the segments as raw doubles, about 32 bytes a
+// segment. Nothing is written when the file would exceed maxBytes
+// (0 = no limit).
+bool writeBuildCapture(const std::string& path, const Segment* segments, size_t count,
+	double snapSize, const RoomGraph::Options& options, const RoomGraph::BuildStats& stats,
+	int rooms, size_t maxBytes);
+
+// Read a capture file; false when it is missing, damaged or of another
+// format.
+bool readBuildCapture(const std::string& path, BuildCapture& capture);
+
+// Called by RoomGraph::build() after a full build that took totalMs:
+// applies the threshold, the sampling and the size cap of the options,
+// and writes the capture into their directory under a new name. Returns
+// true when a file was written.
+bool captureSlowBuild(const Segment* segments, size_t count, double snapSize,
+	const RoomGraph::Options& options, const RoomGraph::BuildStats& stats, int rooms, double totalMs);
+
+// Replay: a capture rebuilt under some engine configuration, profiled
+// per stage.
+struct ReplayResult
+{
+	int    runs;
+	int    rooms;
+	double stageMs[RoomGraph::StageCount]; // medians over the runs
+	double totalMs;                        // median of the totals
+
+	// Hardware events per stage of the last run, where the options asked
+	// for them and the system counts them.
+	HardwareCounters hardware[RoomGraph::StageCount];
+	size_t           peakMemory;
+
+	RoomGraph::Validation validation;
+
+	ReplayResult() : runs(0), rooms(0), totalMs(0.0), peakMemory(0), validation()
+	{
+		for (int s = 0; s < RoomGraph::StageCount; ++s)
+			stageMs[s] = 0.0;
+	}
+};
+
+// Build the captured segments repetitions times with the captured snap
+// size and the given options (never capturing again), after one warm-up
+// build.
+void replayCapture(const BuildCapture& capture, const RoomGraph::Options& options, int repetitions,
+	ReplayResult& result);
+
+// The replay next to the captured build, a line per stage.
+void formatReplay(const BuildCapture& capture, const ReplayResult& result, std::string& report);
+
+#endif // BUILDCAPTURE_H
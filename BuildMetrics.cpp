@@ -0,0 +1,340 @@
+#include "stdafx.h"
+#include "BuildMetrics.h"
+#include "Threading.h"
+
+#include <cstdio>
+
+#ifdef _WIN32
+#include <windows.h>
+#endif
+
+// Threads that build get a shard each, up to kMaxShards running at
+// once; any further ones share a last shard under a lock.
+static const int kMaxShards = 64;
+
+// One thread's metrics. Only that thread writes them.
+struct MetricsShard
+{
+	volatile long          claimed; // by a running thread
+	volatile long          used;    // has recorded a build
+	LatencyHistogram       phases[MetricPhaseCount];
+	volatile unsigned long counters[MetricCounterCount];
+	volatile double        workspaceBytes;
+
+	MetricsShard() : claimed(0), used(0), workspaceBytes(0.0)
+	{
+		for (int c = 0; c < MetricCounterCount; ++c)
+			counters[c] = 0;
+	}
+};
+
+static MetricsShard s_shards[kMaxShards];
+static MetricsShard s_sharedShard;
+static Mutex        s_sharedLock;
+
+// Shard of this thread, NULL until its first build.
+static ROOMGRAPH_THREAD_LOCAL MetricsShard* t_shard = NULL;
+
+LatencyHistogram::LatencyHistogram()
+: m_count(0),
+m_sum(0.0)
+{
+	for (int b = 0; b < kBucketCount; ++b)
+		m_counts[b] = 0;
+}
+
+int LatencyHistogram::bucketOf(unsigned long micros)
+{
+	if (micros < kSubBuckets)
+		return static_cast<int>(micros);
+
+	// Position of the highest bit; values past 32 bits share the last
+	// bucket.
+	int top = kSubBits;
+	while (top < 31 && (micros >> (top + 1)) != 0)
+		++top;
+
+	const int shift = top - kSubBits;
+	const unsigned long sub = (micros >> shift) - kSubBuckets;
+	const int bucket = (shift + 1) * kSubBuckets + static_cast<int>(sub < kSubBuckets ? sub : kSubBuckets - 1);
+
+	return bucket < kBucketCount ? bucket : kBucketCount - 1;
+}
+
+unsigned long LatencyHistogram::bucketLow(int bucket)
+{
+	if (bucket < kSubBuckets)
+		return static_cast<unsigned long>(bucket);
+
+	const int shift = bucket / kSubBuckets - 1;
+	return static_cast<unsigned long>(kSubBuckets + bucket % kSubBuckets) << shift;
+}
+
+void LatencyHistogram::record(unsigned long micros)
+{
+	++m_counts[bucketOf(micros)];
+	++m_count;
+	m_sum += static_cast<double>(micros);
+}
+
+void LatencyHistogram::add(const LatencyHistogram& other)
+{
+	for (int b = 0; b < kBucketCount; ++b)
+		m_counts[b] += other.m_counts[b];
+
+	m_count += other.m_count;
+	m_sum += other.m_sum;
+}
+
+double LatencyHistogram::quantile(double q) const
+{
+	unsigned long total = 0;
+	int b;
+
+	for (b = 0; b < kBucketCount; ++b)
+		total += m_counts[b];
+
+	if (total == 0)
+		return 0.0;
+
+	// Rank of the value, counted from 1.
+	const double rank = q * static_cast<double>(total);
+	unsigned long seen = 0;
+
+	for (b = 0; b < kBucketCount - 1; ++b)
+	{
+		seen += m_counts[b];
+		if (static_cast<double>(seen) >= rank)
+			return static_cast<double>(bucketLow(b + 1));
+	}
+
+	return static_cast<double>(bucketLow(kBucketCount - 1)) * 2.0;
+}
+
+const char* metricCounterName(int counter)
+{
+	static const char* names[MetricCounterCount] =
+	{
+		"builds", "segments", "rooms", "clockwise_faces", "degenerate_faces", "snap_merges", "captures"
+	};
+
+	return counter >= 0 && counter < MetricCounterCount ? names[counter] : "";
+}
+
+// At thread exit. The counts stay for the totals; the graph the gauge
+// was about is gone with the thread.
+static void releaseShard(void* shard)
+{
+	MetricsShard* released = static_cast<MetricsShard*>(shard);
+	released->workspaceBytes = 0.0;
+
+	memoryFence();
+	released->claimed = 0;
+}
+
+static MetricsShard* claimShard()
+{
+	for (int s = 0; s < kMaxShards; ++s)
+	{
+		if (s_shards[s].claimed == 0 && atomicCompareExchange(&s_shards[s].claimed, 1, 0) == 0)
+		{
+			// Without the exit hook the shard stays with the thread.
+			atThreadExit(releaseShard, &s_shards[s]);
+			return &s_shards[s];
+		}
+	}
+
+	return NULL;
+}
+
+static unsigned long toMicros(double ms)
+{
+	const double micros = ms * 1000.0 + 0.5;
+	return micros < 4294967295.0 ? static_cast<unsigned long>(micros) : 4294967295ul;
+}
+
+static void recordInto(MetricsShard& shard, const RoomGraph::BuildStats& stats, size_t segments,
+	size_t rooms, size_t workspaceBytes)
+{
+	double totalMs = 0.0;
+
+	for (int s = 0; s < RoomGraph::StageCount; ++s)
+	{
+		shard.phases[s].record(toMicros(stats.stageMs[s]));
+		totalMs += stats.stageMs[s];
+	}
+	shard.phases[PhaseTotal].record(toMicros(totalMs));
+
+	shard.counters[MetricBuilds] += 1;
+	shard.counters[MetricSegments] += static_cast<unsigned long>(segments);
+	shard.counters[MetricRooms] += static_cast<unsigned long>(rooms);
+	shard.counters[MetricClockwiseFaces] += stats.clockwiseFaces;
+	shard.counters[MetricDegenerateFaces] += stats.degenerateFaces;
+	shard.counters[MetricSnapMerges] += stats.snapMerges;
+	shard.counters[MetricCaptures] += stats.captured ? 1 : 0;
+
+	shard.workspaceBytes = static_cast<double>(workspaceBytes);
+	shard.used = 1;
+}
+
+void recordBuildMetrics(const RoomGraph::BuildStats& stats, size_t segments, size_t rooms,
+	size_t workspaceBytes)
+{
+	if (t_shard == NULL)
+		t_shard = claimShard();
+
+	if (t_shard != NULL)
+	{
+		recordInto(*t_shard, stats, segments, rooms, workspaceBytes);
+		return;
+	}
+
+	// The workspace gauge of the shared shard is the last thread's.
+	ScopedLock lock(s_sharedLock);
+	recordInto(s_sharedShard, stats, segments, rooms, workspaceBytes);
+	s_sharedShard.claimed = 1;
+}
+
+MetricsSnapshot::MetricsSnapshot()
+: workspaceBytes(0.0),
+threads(0)
+{
+	for (int c = 0; c < MetricCounterCount; ++c)
+		counters[c] = 0;
+}
+
+static void addShard(const MetricsShard& shard, MetricsSnapshot& snapshot)
+{
+	if (shard.used == 0)
+		return;
+
+	int i;
+	for (i = 0; i < MetricPhaseCount; ++i)
+		snapshot.phases[i].add(shard.phases[i]);
+
+	for (i = 0; i < MetricCounterCount; ++i)
+		snapshot.counters[i] += shard.counters[i];
+
+	snapshot.workspaceBytes += shard.workspaceBytes;
+	if (shard.claimed != 0)
+		++snapshot.threads;
+}
+
+void takeMetricsSnapshot(MetricsSnapshot& snapshot)
+{
+	snapshot = MetricsSnapshot();
+
+	for (int s = 0; s < kMaxShards; ++s)
+		addShard(s_shards[s], snapshot);
+
+	ScopedLock lock(s_sharedLock);
+	addShard(s_sharedShard, snapshot);
+}
+
+static const char* phaseName(int phase)
+{
+	return phase == PhaseTotal ? "total" : RoomGraph::stageName(phase);
+}
+
+void formatPrometheus(const MetricsSnapshot& snapshot, std::string& text)
+{
+	static const double quantiles[] = { 0.5, 0.9, 0.99, 0.999 };
+	static const char* quantileNames[] = { "0.5", "0.9", "0.99", "0.999" };
+
+	char line[256];
+	int phase;
+
+	text += "# HELP roomgraph_phase_seconds Wall time of each phase of full builds.\n";
+	text += "# TYPE roomgraph_phase_seconds histogram\n";
+
+	for (phase = 0; phase < MetricPhaseCount; ++phase)
+	{
+		const LatencyHistogram& histogram = snapshot.phases[phase];
+		unsigned long cumulative = 0;
+
+		// A bucket per doubling: 8 us, 16 us, 32 us...
+		for (int b = 0; b + 1 < LatencyHistogram::kBucketCount; ++b)
+		{
+			cumulative += histogram.bucketCount(b);
+
+			const int following = b + 1;
+			if (following % LatencyHistogram::kSubBuckets != 0)
+				continue;
+
+			std::sprintf(line, "roomgraph_phase_seconds_bucket{phase=\"%s\",le=\"%g\"} %lu\n",
+				phaseName(phase), 1e-6 * static_cast<double>(LatencyHistogram::bucketLow(following)), cumulative);
+			text += line;
+		}
+
+		std::sprintf(line, "roomgraph_phase_seconds_bucket{phase=\"%s\",le=\"+Inf\"} %lu\n",
+			phaseName(phase), histogram.count());
+		text += line;
+		std::sprintf(line, "roomgraph_phase_seconds_sum{phase=\"%s\"} %.6f\n",
+			phaseName(phase), 1e-6 * histogram.sumMicros());
+		text += line;
+		std::sprintf(line, "roomgraph_phase_seconds_count{phase=\"%s\"} %lu\n",
+			phaseName(phase), histogram.count());
+		text += line;
+	}
+
+	text += "# HELP roomgraph_phase_quantile_seconds Latency quantiles of each phase, as the upper end of their histogram bucket: at most 12.5% high.\n";
+	text += "# TYPE roomgraph_phase_quantile_seconds gauge\n";
+
+	for (phase = 0; phase < MetricPhaseCount; ++phase)
+	{
+		for (int q = 0; q < 4; ++q)
+		{
+			std::sprintf(line, "roomgraph_phase_quantile_seconds{phase=\"%s\",quantile=\"%s\"} %g\n",
+				phaseName(phase), quantileNames[q], 1e-6 * snapshot.phases[phase].quantile(quantiles[q]));
+			text += line;
+		}
+	}
+
+	for (int c = 0; c < MetricCounterCount; ++c)
+	{
+		std::sprintf(line, "# TYPE roomgraph_%s_total counter\nroomgraph_%s_total %lu\n",
+			metricCounterName(c), metricCounterName(c), snapshot.counters[c]);
+		text += line;
+	}
+
+	std::sprintf(line, "# HELP roomgraph_workspace_bytes Memory kept by the graphs last built on each thread.\n"
+		"# TYPE roomgraph_workspace_bytes gauge\nroomgraph_workspace_bytes %.0f\n", snapshot.workspaceBytes);
+	text += line;
+
+	std::sprintf(line, "# TYPE roomgraph_metrics_threads gauge\nroomgraph_metrics_threads %d\n", snapshot.threads);
+	text += line;
+}
+
+bool writeMetricsFile(const std::string& path)
+{
+	MetricsSnapshot snapshot;
+	takeMetricsSnapshot(snapshot);
+
+	std::string text;
+	formatPrometheus(snapshot, text);
+
+	const std::string temporary = path + ".tmp";
+
+	std::FILE* file = std::fopen(temporary.c_str(), "wb");
+	if (file == NULL)
+		return false;
+
+	bool written = std::fwrite(text.data(), 1, text.size(), file) == text.size();
+	written = (std::fclose(file) == 0) && written;
+
+	// rename() replaces the file in one step on POSIX; on Windows it
+	// fails on an existing file, and MoveFileEx() replaces it instead.
+	if (written)
+	{
+#ifdef _WIN32
+		written = MoveFileExA(temporary.c_str(), path.c_str(), MOVEFILE_REPLACE_EXISTING) != 0;
+#else
+		written = std::rename(temporary.c_str(), path.c_str()) == 0;
+#endif
+	}
+
+	if (!written)
+		std::remove(temporary.c_str());
+
+	return written;
+}
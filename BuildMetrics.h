@@ -0,0 +1,112 @@
+#ifndef BUILDMETRICS_H
+#define BUILDMETRICS_H
+
+#include <string>
+#include <cstddef>
+#include "RoomGraph.h"
+
+// Process-wide metrics of RoomGraph builds, for services that scrape
+// them. Every thread that builds records into a shard of its own, so
+// recording takes no lock and no atomic operation; a snapshot adds up
+// the shards. A thread's shard is released when it exits, keeping its
+// counts, and a later thread may take it over. RoomGraph::build()
+// records each full build unless Options::metrics is off.
+
+// Latency histogram in the style of HdrHistogram: buckets double in
+// width, and each doubling is split into kSubBuckets linear buckets, so
+// every value is known to within 1 / kSubBuckets of itself from 1
+// microsecond to over an hour, in a fixed kBucketCount counters.
+class LatencyHistogram
+{
+public:
+	enum
+	{
+		kSubBits = 3,
+		kSubBuckets = 1 << kSubBits,
+		kBucketCount = (32 - kSubBits + 1) * kSubBuckets
+	};
+
+	LatencyHistogram();
+
+	// Values are in microseconds; larger ones count in the last bucket.
+	void record(unsigned long micros);
+
+	// Adds other's counts; for snapshots.
+	void add(const LatencyHistogram& other);
+
+	unsigned long count() const { return m_count; }
+	double sumMicros() const { return m_sum; }
+	unsigned long bucketCount(int bucket) const { return m_counts[bucket]; }
+
+	// Smallest value of a bucket and the bucket of a value.
+	static unsigned long bucketLow(int bucket);
+	static int bucketOf(unsigned long micros);
+
+	// Upper end of the bucket holding the given quantile (0 to 1) of the
+	// recorded values, in microseconds; 0 when empty.
+	double quantile(double q) const;
+
+private:
+	volatile unsigned long m_counts[kBucketCount];
+	volatile unsigned long m_count;
+	volatile double        m_sum;
+};
+
+// Phases timed per build: the stages of RoomGraph::BuildStage, then the
+// whole build.
+enum MetricPhase
+{
+	PhaseTotal = RoomGraph::StageCount,
+	MetricPhaseCount
+};
+
+enum MetricCounter
+{
+	MetricBuilds,
+	MetricSegments,
+	MetricRooms,
+	MetricClockwiseFaces,  // faces walked clockwise, outer boundaries and holes
+	MetricDegenerateFaces, // faces dropped as too small or collinear
+	MetricSnapMerges,      // endpoints that joined an existing node
+	MetricCaptures,        // builds written to Options::captureDirectory
+	MetricCounterCount
+};
+
+// Short name of a counter, e.g. "rooms".
+const char* metricCounterName(int counter);
+
+// Record a full build on the calling thread's shard. workspaceBytes is
+// the memory the graph keeps for its next build (see
+// RoomGraph::getWorkspaceBytes()); the gauge sums the last value of each
+// running thread.
+void recordBuildMetrics(const RoomGraph::BuildStats& stats, size_t segments, size_t rooms,
+	size_t workspaceBytes);
+
+// The shards added up. Taken while builds go on, it may catch a build
+// half recorded; each value on its own is sound.
+struct MetricsSnapshot
+{
+	LatencyHistogram phases[MetricPhaseCount];
+	unsigned long    counters[MetricCounterCount];
+	double           workspaceBytes;
+	int              threads; // running threads that recorded a build
+
+	MetricsSnapshot();
+};
+
+void takeMetricsSnapshot(MetricsSnapshot& snapshot);
+
+// The snapshot in the Prometheus text exposition format: a histogram of
+// seconds per phase with a bucket per doubling, the p50, p90, p99 and
+// p99.9 latencies per phase as gauges, the counters and the workspace
+// gauge. Names start with "roomgraph_". A quantile gauge is the upper end
+// of the fine bucket holding it (see LatencyHistogram::quantile()), so it
+// is at most 12.5% above the true value.
+void formatPrometheus(const MetricsSnapshot& snapshot, std::string& text);
+
+// Take a snapshot and write it as Prometheus text to path, through a
+// temporary file and a rename, so a scraper (e.g. the node exporter's
+// textfile collector) never reads half a file.
+bool writeMetricsFile(const std::string& path);
+
+#endif // BUILDMETRICS_H
@@ -0,0 +1,309 @@
+#include "stdafx.h"
+#include "BuildPlanner.h"
+#include "Checkpoint.h"
+
+#include <cmath>
+
+static const int kCostModelTag = 0x4c444f4d; // "MODL"
+
+// Weight of the ridge of fit(), relative to each feature's own scale.
+static const double kRidge = 0.05;
+
+void costFeatures(const RoomGraph::InputProfile& profile, double features[CostFeatureCount])
+{
+	const double n = static_cast<double>(profile.segments);
+	const double millions = 1e-6 * n;
+
+	features[FeatureConstant] = 1.0;
+	features[FeatureSegments] = millions;
+	features[FeatureSortWork] = n > 1.0 ? millions * std::log(n) / std::log(2.0) : 0.0;
+	features[FeatureSkewed] = millions * (1.0 - profile.axisAligned);
+	features[FeatureDegree] = millions * profile.meanDegree;
+}
+
+CostModel::CostModel()
+: m_samples()
+{
+	// Milliseconds; sorted and map fitted by trainCostModel() to the
+	// benchmark matrix (600 to 180k segments) on one core. The matrix is
+	// all axis-aligned, so skew costs nothing until trained otherwise.
+	// The parallel row assumes half the per-segment cost, about four
+	// threads with the walk serial, and 0.5 ms more to start them.
+	static const double defaults[RoomGraph::StrategyCount][CostFeatureCount] =
+	{
+		{ 2.30, 297.6, 15.85, 0.0, -12.79 }, // StrategySorted
+		{ 2.80, 148.8, 7.93, 0.0, -6.40 },   // StrategyParallel
+		{ 1.37, 407.4, 23.46, 0.0, -42.84 }  // StrategyMap
+	};
+
+	for (int s = 0; s < RoomGraph::StrategyCount; ++s)
+	{
+		for (int f = 0; f < CostFeatureCount; ++f)
+			m_coefficients[s][f] = defaults[s][f];
+
+		m_fitError[s] = 0.0;
+	}
+}
+
+double CostModel::predict(int strategy, const RoomGraph::InputProfile& profile) const
+{
+	if (strategy < 0 || strategy >= RoomGraph::StrategyCount)
+		return 0.0;
+
+	double features[CostFeatureCount];
+	costFeatures(profile, features);
+
+	double ms = 0.0;
+	for (int f = 0; f < CostFeatureCount; ++f)
+		ms += m_coefficients[strategy][f] * features[f];
+
+	return ms;
+}
+
+int CostModel::choose(const RoomGraph::InputProfile& profile, int threads,
+	double predictedMs[RoomGraph::StrategyCount]) const
+{
+	int best = RoomGraph::StrategySorted;
+
+	for (int s = 0; s < RoomGraph::StrategyCount; ++s)
+	{
+		predictedMs[s] = 0.0;
+
+		if (s == RoomGraph::StrategyParallel && threads <= 1)
+			continue;
+
+		predictedMs[s] = predict(s, profile);
+		if (predictedMs[s] < predictedMs[best])
+			best = s;
+	}
+
+	return best;
+}
+
+void CostModel::addSample(int strategy, const RoomGraph::InputProfile& profile, double ms)
+{
+	if (strategy < 0 || strategy >= RoomGraph::StrategyCount)
+		return;
+
+	Sample sample;
+	sample.strategy = strategy;
+	costFeatures(profile, sample.features);
+	sample.ms = ms;
+
+	m_samples.push_back(sample);
+}
+
+// Solve the normal equations a x = b of size CostFeatureCount by
+// Gaussian elimination with partial pivoting. False when singular.
+static bool solveNormalEquations(double a[CostFeatureCount][CostFeatureCount], double b[CostFeatureCount],
+	double x[CostFeatureCount])
+{
+	int i;
+	int j;
+	int k;
+
+	for (k = 0; k < CostFeatureCount; ++k)
+	{
+		int pivot = k;
+		for (i = k + 1; i < CostFeatureCount; ++i)
+		{
+			if (std::fabs(a[i][k]) > std::fabs(a[pivot][k]))
+				pivot = i;
+		}
+
+		if (std::fabs(a[pivot][k]) < 1e-300)
+			return false;
+
+		if (pivot != k)
+		{
+			for (j = 0; j < CostFeatureCount; ++j)
+			{
+				const double t = a[k][j];
+				a[k][j] = a[pivot][j];
+				a[pivot][j] = t;
+			}
+
+			const double t = b[k];
+			b[k] = b[pivot];
+			b[pivot] = t;
+		}
+
+		for (i = k + 1; i < CostFeatureCount; ++i)
+		{
+			const double factor = a[i][k] / a[k][k];
+			for (j = k; j < CostFeatureCount; ++j)
+				a[i][j] -= factor * a[k][j];
+			b[i] -= factor * b[k];
+		}
+	}
+
+	for (k = CostFeatureCount - 1; k >= 0; --k)
+	{
+		double sum = b[k];
+		for (j = k + 1; j < CostFeatureCount; ++j)
+			sum -= a[k][j] * x[j];
+		x[k] = sum / a[k][k];
+	}
+
+	return true;
+}
+
+bool CostModel::fit()
+{
+	bool fitted = false;
+
+	for (int s = 0; s < RoomGraph::StrategyCount; ++s)
+	{
+		if (getSampleCount(s) < CostFeatureCount)
+			continue;
+
+		double a[CostFeatureCount][CostFeatureCount];
+		double b[CostFeatureCount];
+		int i;
+		int j;
+
+		for (i = 0; i < CostFeatureCount; ++i)
+		{
+			b[i] = 0.0;
+			for (j = 0; j < CostFeatureCount; ++j)
+				a[i][j] = 0.0;
+		}
+
+		size_t k;
+		for (k = 0; k < m_samples.size(); ++k)
+		{
+			const Sample& sample = m_samples[k];
+			if (sample.strategy != s)
+				continue;
+
+			for (i = 0; i < CostFeatureCount; ++i)
+			{
+				b[i] += sample.features[i] * sample.ms;
+				for (j = 0; j < CostFeatureCount; ++j)
+					a[i][j] += sample.features[i] * sample.features[j];
+			}
+		}
+
+		// A ridge keeps the fit stable when the training inputs hardly
+		// vary in a feature, e.g. all axis-aligned, and keeps noise in
+		// the times from driving coefficients far apart.
+		for (i = FeatureSegments; i < CostFeatureCount; ++i)
+			a[i][i] += kRidge * (a[i][i] + 1e-12);
+
+		double x[CostFeatureCount];
+		if (!solveNormalEquations(a, b, x))
+			continue;
+
+		double squares = 0.0;
+		size_t count = 0;
+
+		for (k = 0; k < m_samples.size(); ++k)
+		{
+			const Sample& sample = m_samples[k];
+			if (sample.strategy != s)
+				continue;
+
+			double ms = 0.0;
+			for (i = 0; i < CostFeatureCount; ++i)
+				ms += x[i] * sample.features[i];
+
+			squares += (ms - sample.ms) * (ms - sample.ms);
+			++count;
+		}
+
+		for (i = 0; i < CostFeatureCount; ++i)
+			m_coefficients[s][i] = x[i];
+
+		m_fitError[s] = std::sqrt(squares / count);
+		fitted = true;
+	}
+
+	return fitted;
+}
+
+size_t CostModel::getSampleCount(int strategy) const
+{
+	size_t count = 0;
+	for (size_t k = 0; k < m_samples.size(); ++k)
+	{
+		if (m_samples[k].strategy == strategy)
+			++count;
+	}
+
+	return count;
+}
+
+double CostModel::getFitError(int strategy) const
+{
+	return strategy >= 0 && strategy < RoomGraph::StrategyCount ? m_fitError[strategy] : 0.0;
+}
+
+double CostModel::getCoefficient(int strategy, int feature) const
+{
+	if (strategy < 0 || strategy >= RoomGraph::StrategyCount || feature < 0 || feature >= CostFeatureCount)
+		return 0.0;
+
+	return m_coefficients[strategy][feature];
+}
+
+bool CostModel::save(const std::string& path) const
+{
+	std::vector<char> bytes;
+	PayloadWriter writer(bytes);
+
+	writer.putInt(kCostModelTag);
+	writer.putInt(RoomGraph::StrategyCount);
+	writer.putInt(CostFeatureCount);
+
+	for (int s = 0; s < RoomGraph::StrategyCount; ++s)
+	{
+		for (int f = 0; f < CostFeatureCount; ++f)
+			writer.putDouble(m_coefficients[s][f]);
+		writer.putDouble(m_fitError[s]);
+	}
+
+	return writeCheckpoint(path, bytes);
+}
+
+bool CostModel::load(const std::string& path)
+{
+	std::vector<char> bytes;
+	if (readCheckpoint(path, bytes) != CheckpointOk)
+		return false;
+
+	PayloadReader reader(bytes);
+
+	int tag = 0;
+	int strategies = 0;
+	int features = 0;
+
+	if (!reader.getInt(tag) || tag != kCostModelTag
+		|| !reader.getInt(strategies) || strategies != RoomGraph::StrategyCount
+		|| !reader.getInt(features) || features != CostFeatureCount)
+	{
+		return false;
+	}
+
+	double coefficients[RoomGraph::StrategyCount][CostFeatureCount];
+	double fitError[RoomGraph::StrategyCount];
+	int s;
+
+	for (s = 0; s < RoomGraph::StrategyCount; ++s)
+	{
+		for (int f = 0; f < CostFeatureCount; ++f)
+			reader.getDouble(coefficients[s][f]);
+		reader.getDouble(fitError[s]);
+	}
+
+	if (!reader.ok() || !reader.atEnd())
+		return false;
+
+	for (s = 0; s < RoomGraph::StrategyCount; ++s)
+	{
+		for (int f = 0; f < CostFeatureCount; ++f)
+			m_coefficients[s][f] = coefficients[s][f];
+		m_fitError[s] = fitError[s];
+	}
+
+	return true;
+}
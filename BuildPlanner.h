@@ -0,0 +1,70 @@
+#ifndef BUILDPLANNER_H
+#define BUILDPLANNER_H
+
+#include <vector>
+#include <string>
+#include "RoomGraph.h"
+
+// Cost model behind RoomGraph::StrategyAuto: the time of a full build
+// under each strategy, linear in a few features of the input profile
+// (see RoomGraph::InputProfile).
+enum CostFeature
+{
+	FeatureConstant,
+	FeatureSegments,     // millions of segments
+	FeatureSortWork,     // the same times log2 of the segment count
+	FeatureSkewed,       // ... times the share of walls not parallel to an axis
+	FeatureDegree,       // ... times the mean node degree in the sample
+	CostFeatureCount
+};
+
+void costFeatures(const RoomGraph::InputProfile& profile, double features[CostFeatureCount]);
+
+class CostModel
+{
+public:
+	// Built-in coefficients from the development machine: they tell
+	// small inputs from large ones, but are worth training on the target
+	// hardware (see trainCostModel() in RoomGraphBench.h).
+	CostModel();
+
+	// Predicted milliseconds of a full build with a strategy.
+	double predict(int strategy, const RoomGraph::InputProfile& profile) const;
+
+	// The cheapest strategy for the profile, with the predictions of all
+	// of them in predictedMs (0 for those not allowed). The parallel one
+	// is only allowed with more than one thread.
+	int choose(const RoomGraph::InputProfile& profile, int threads,
+		double predictedMs[RoomGraph::StrategyCount]) const;
+
+	// Training: measured build times, then a least-squares fit per
+	// strategy. Strategies with fewer samples than features keep their
+	// coefficients. Returns false when none could be fitted.
+	void addSample(int strategy, const RoomGraph::InputProfile& profile, double ms);
+	bool fit();
+	size_t getSampleCount(int strategy) const;
+
+	// Root mean square error of the fit over the samples of a strategy,
+	// in milliseconds.
+	double getFitError(int strategy) const;
+
+	double getCoefficient(int strategy, int feature) const;
+
+	// The coefficients as a checkpoint file (see Checkpoint.h).
+	bool save(const std::string& path) const;
+	bool load(const std::string& path);
+
+private:
+	struct Sample
+	{
+		int    strategy;
+		double features[CostFeatureCount];
+		double ms;
+	};
+
+	double              m_coefficients[RoomGraph::StrategyCount][CostFeatureCount];
+	double              m_fitError[RoomGraph::StrategyCount];
+	std::vector<Sample> m_samples;
+};
+
+#endif // BUILDPLANNER_H
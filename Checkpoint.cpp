@@ -0,0 +1,170 @@
+#include "stdafx.h"
+#include "Checkpoint.h"
+
+#include <cstdio>
+#include <cstring>
+
+static const unsigned int kCheckpointMagic = 0x4b434752; // "RGCK"
+static const unsigned int kCheckpointVersion = 1;
+
+// Header of every checkpoint file.
+struct CheckpointHeader
+{
+	unsigned int magic;
+	unsigned int version;
+	unsigned int size;
+	unsigned int crc;
+};
+
+unsigned int crc32(const void* data, size_t size, unsigned int crc)
+{
+	static unsigned int table[256];
+	static bool ready = false;
+
+	if (!ready)
+	{
+		for (unsigned int n = 0; n < 256; ++n)
+		{
+			unsigned int c = n;
+			for (int k = 0; k < 8; ++k)
+				c = (c & 1) ? 0xedb88320u ^ (c >> 1) : c >> 1;
+			table[n] = c;
+		}
+		ready = true;
+	}
+
+	const unsigned char* p = static_cast<const unsigned char*>(data);
+	crc = ~crc;
+
+	for (size_t i = 0; i < size; ++i)
+		crc = table[(crc ^ p[i]) & 0xff] ^ (crc >> 8);
+
+	return ~crc;
+}
+
+bool writeCheckpoint(const std::string& path, const std::vector<char>& payload)
+{
+	// The header holds the payload size in an unsigned int.
+	if (static_cast<unsigned int>(payload.size()) != payload.size())
+		return false;
+
+	CheckpointHeader header;
+	header.magic = kCheckpointMagic;
+	header.version = kCheckpointVersion;
+	header.size = static_cast<unsigned int>(payload.size());
+	header.crc = crc32(payload.empty() ? NULL : &payload[0], payload.size());
+
+	const std::string temporary = path + ".tmp";
+
+	std::FILE* file = std::fopen(temporary.c_str(), "wb");
+	if (file == NULL)
+		return false;
+
+	bool written = std::fwrite(&header, sizeof(header), 1, file) == 1;
+	if (written && !payload.empty())
+		written = std::fwrite(&payload[0], payload.size(), 1, file) == 1;
+
+	written = (std::fflush(file) == 0) && written;
+	written = (std::fclose(file) == 0) && written;
+
+	// rename() does not replace an existing file everywhere.
+	if (written)
+	{
+		std::remove(path.c_str());
+		written = std::rename(temporary.c_str(), path.c_str()) == 0;
+	}
+
+	if (!written)
+		std::remove(temporary.c_str());
+
+	return written;
+}
+
+size_t checkpointFileSize(size_t size)
+{
+	return sizeof(CheckpointHeader) + size;
+}
+
+CheckpointStatus readCheckpoint(const std::string& path, std::vector<char>& payload)
+{
+	payload.clear();
+
+	std::FILE* file = std::fopen(path.c_str(), "rb");
+	if (file == NULL)
+		return CheckpointMissing;
+
+	CheckpointHeader header;
+	bool valid = std::fread(&header, sizeof(header), 1, file) == 1
+		&& header.magic == kCheckpointMagic
+		&& header.version == kCheckpointVersion;
+
+	// The file must hold exactly the payload the header announces, which
+	// is checked before a damaged size gets to allocate anything.
+	if (valid)
+	{
+		valid = std::fseek(file, 0, SEEK_END) == 0;
+
+		const long length = valid ? std::ftell(file) : -1;
+		valid = length >= static_cast<long>(sizeof(header))
+			&& static_cast<unsigned long>(length) - sizeof(header) == header.size
+			&& std::fseek(file, sizeof(header), SEEK_SET) == 0;
+	}
+
+	if (valid)
+	{
+		payload.resize(header.size);
+		if (header.size > 0)
+			valid = std::fread(&payload[0], header.size, 1, file) == 1;
+	}
+
+	std::fclose(file);
+
+	if (!valid || crc32(payload.empty() ? NULL : &payload[0], payload.size()) != header.crc)
+	{
+		payload.clear();
+		return CheckpointCorrupt;
+	}
+
+	return CheckpointOk;
+}
+
+void PayloadWriter::putInt(int value)
+{
+	putBytes(&value, sizeof(value));
+}
+
+void PayloadWriter::putDouble(double value)
+{
+	putBytes(&value, sizeof(value));
+}
+
+void PayloadWriter::putBytes(const void* data, size_t size)
+{
+	const char* p = static_cast<const char*>(data);
+	m_bytes.insert(m_bytes.end(), p, p + size);
+}
+
+bool PayloadReader::getInt(int& value)
+{
+	return getBytes(&value, sizeof(value));
+}
+
+bool PayloadReader::getDouble(double& value)
+{
+	return getBytes(&value, sizeof(value));
+}
+
+bool PayloadReader::getBytes(void* data, size_t size)
+{
+	if (!m_ok || size > m_bytes.size() - m_pos)
+	{
+		m_ok = false;
+		return false;
+	}
+
+	if (size > 0)
+		std::memcpy(data, &m_bytes[m_pos], size);
+
+	m_pos += size;
+	return true;
+}
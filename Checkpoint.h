@@ -0,0 +1,67 @@
+#ifndef CHECKPOINT_H
+#define CHECKPOINT_H
+
+#include <vector>
+#include <string>
+#include <cstddef>
+
+// CRC-32 (IEEE), continued from a previous value.
+unsigned int crc32(const void* data, size_t size, unsigned int crc = 0);
+
+enum CheckpointStatus
+{
+	CheckpointMissing,
+	CheckpointCorrupt,
+	CheckpointOk
+};
+
+// A checkpoint file is a small header (magic, format version, payload
+// size and CRC-32) followed by the payload. It is written to a temporary
+// name first and renamed, so a crash never leaves half a file behind
+// under the real name. Payloads of 4 GiB or more are refused, and a file
+// whose length does not match its header reads as CheckpointCorrupt.
+bool writeCheckpoint(const std::string& path, const std::vector<char>& payload);
+CheckpointStatus readCheckpoint(const std::string& path, std::vector<char>& payload);
+
+// Size of the file writeCheckpoint() writes for a payload of size bytes.
+size_t checkpointFileSize(size_t size);
+
+// Appends values to a payload in native byte order.
+class PayloadWriter
+{
+public:
+	explicit PayloadWriter(std::vector<char>& bytes) : m_bytes(bytes) {}
+
+	void putInt(int value);
+	void putDouble(double value);
+	void putBytes(const void* data, size_t size);
+
+private:
+	PayloadWriter& operator=(const PayloadWriter&);
+
+	std::vector<char>& m_bytes;
+};
+
+// Reads values back; once a read runs past the end, every later read
+// fails as well.
+class PayloadReader
+{
+public:
+	explicit PayloadReader(const std::vector<char>& bytes) : m_bytes(bytes), m_pos(0), m_ok(true) {}
+
+	bool getInt(int& value);
+	bool getDouble(double& value);
+	bool getBytes(void* data, size_t size);
+
+	bool ok() const { return m_ok; }
+	bool atEnd() const { return m_pos == m_bytes.size(); }
+
+private:
+	PayloadReader& operator=(const PayloadReader&);
+
+	const std::vector<char>& m_bytes;
+	size_t                   m_pos;
+	bool                     m_ok;
+};
+
+#endif // CHECKPOINT_H
@@ -0,0 +1,202 @@
+#ifndef COWARRAY_H
+#define COWARRAY_H
+
+#include <vector>
+#include <algorithm>
+#include <cstddef>
+
+// Versions of a std::vector kept as copy-on-write chunks.
+//
+// commit() snapshots the live vector. Chunks that were not touched since
+// the previous commit or checkout are shared with that version instead
+// of copied. checkout() writes a version back into the live vector and
+// copies only the chunks that differ from what the vector holds. The
+// caller reports every in-place change with touch(); growth and
+// shrinking are detected from the size.
+template <class T>
+class CowArray
+{
+public:
+	enum { kChunkShift = 10 };
+
+	CowArray() : m_versions(), m_dirty(), m_base(-1) {}
+
+	CowArray(const CowArray& other)
+		: m_versions(other.m_versions), m_dirty(other.m_dirty), m_base(other.m_base)
+	{
+		for (size_t v = 0; v < m_versions.size(); ++v)
+		{
+			for (size_t c = 0; c < m_versions[v].chunks.size(); ++c)
+				++m_versions[v].chunks[c]->refs;
+		}
+	}
+
+	CowArray& operator=(const CowArray& other)
+	{
+		if (this != &other)
+		{
+			CowArray copy(other);
+			m_versions.swap(copy.m_versions);
+			m_dirty.swap(copy.m_dirty);
+			std::swap(m_base, copy.m_base);
+		}
+		return *this;
+	}
+
+	~CowArray()
+	{
+		releaseAll();
+	}
+
+	// Element i of the live vector changed in place.
+	void touch(size_t i)
+	{
+		const size_t c = i >> kChunkShift;
+		if (c < m_dirty.size())
+			m_dirty[c] = 1;
+	}
+
+	int commit(const std::vector<T>& live)
+	{
+		m_versions.push_back(Version());
+		Version& v = m_versions.back();
+		const Version* base = (m_base >= 0) ? &m_versions[m_base] : NULL;
+
+		v.size = live.size();
+		v.alive = true;
+		v.chunks.resize(chunkCount(live.size()), NULL);
+
+		for (size_t c = 0; c < v.chunks.size(); ++c)
+		{
+			if (base != NULL && isClean(*base, c, live.size()))
+			{
+				v.chunks[c] = base->chunks[c];
+				++v.chunks[c]->refs;
+				continue;
+			}
+
+			const size_t first = c << kChunkShift;
+			const size_t last = std::min(first + chunkSize(), live.size());
+
+			Chunk* chunk = new Chunk;
+			chunk->refs = 1;
+			chunk->items.assign(live.begin() + first, live.begin() + last);
+			v.chunks[c] = chunk;
+		}
+
+		m_base = static_cast<int>(m_versions.size()) - 1;
+		m_dirty.assign(v.chunks.size(), 0);
+
+		return m_base;
+	}
+
+	bool checkout(int version, std::vector<T>& live)
+	{
+		if (!isAlive(version))
+			return false;
+
+		const Version& v = m_versions[version];
+		const Version* base = (m_base >= 0) ? &m_versions[m_base] : NULL;
+
+		live.resize(v.size);
+
+		for (size_t c = 0; c < v.chunks.size(); ++c)
+		{
+			if (base != NULL && c < base->chunks.size() && base->chunks[c] == v.chunks[c]
+				&& isClean(*base, c, base->size))
+			{
+				continue;
+			}
+
+			const std::vector<T>& items = v.chunks[c]->items;
+			std::copy(items.begin(), items.end(), live.begin() + (c << kChunkShift));
+		}
+
+		m_base = version;
+		m_dirty.assign(v.chunks.size(), 0);
+
+		return true;
+	}
+
+	void release(int version)
+	{
+		if (!isAlive(version))
+			return;
+
+		Version& v = m_versions[version];
+		for (size_t c = 0; c < v.chunks.size(); ++c)
+		{
+			if (--v.chunks[c]->refs == 0)
+				delete v.chunks[c];
+		}
+
+		v.chunks.clear();
+		v.alive = false;
+
+		// Without a base the next commit or checkout copies every chunk.
+		if (m_base == version)
+			m_base = -1;
+	}
+
+	void releaseAll()
+	{
+		for (size_t v = 0; v < m_versions.size(); ++v)
+			release(static_cast<int>(v));
+
+		m_versions.clear();
+		m_dirty.clear();
+		m_base = -1;
+	}
+
+	bool isAlive(int version) const
+	{
+		return version >= 0 && version < static_cast<int>(m_versions.size()) && m_versions[version].alive;
+	}
+
+private:
+	// Shared by every version that did not change it.
+	struct Chunk
+	{
+		std::vector<T> items;
+		int refs;
+	};
+
+	struct Version
+	{
+		std::vector<Chunk*> chunks;
+		size_t size;
+		bool alive;
+
+		Version() : chunks(), size(0), alive(false) {}
+	};
+
+	static size_t chunkSize()
+	{
+		return static_cast<size_t>(1) << kChunkShift;
+	}
+
+	static size_t chunkCount(size_t size)
+	{
+		return (size + chunkSize() - 1) >> kChunkShift;
+	}
+
+	static size_t itemsIn(size_t c, size_t size)
+	{
+		const size_t first = c << kChunkShift;
+		return first >= size ? 0 : std::min(chunkSize(), size - first);
+	}
+
+	// Chunk c of the live vector still matches the base version.
+	bool isClean(const Version& base, size_t c, size_t liveSize) const
+	{
+		return c < base.chunks.size() && c < m_dirty.size() && !m_dirty[c]
+			&& itemsIn(c, base.size) == itemsIn(c, liveSize);
+	}
+
+private:
+	std::vector<Version> m_versions;
+	std::vector<char>    m_dirty;  // per chunk, changed since m_base
+	int                  m_base;   // version the live vector started from
+};
+
+#endif // COWARRAY_H
@@ -0,0 +1,286 @@
+#include "stdafx.h"
+#include "ExternalSort.h"
+
+#include <algorithm>
+#include <queue>
+#include <ctime>
+
+// Smallest read or write block per run, in records.
+static const size_t kMinBlockRecords = 1024;
+
+struct EndpointLess
+{
+	bool operator()(const EndpointRecord& r1, const EndpointRecord& r2) const
+	{
+		if (r1.ix != r2.ix) return r1.ix < r2.ix;
+		if (r1.iy != r2.iy) return r1.iy < r2.iy;
+		return r1.endpoint < r2.endpoint;
+	}
+};
+
+// Head record of one run in the merge heap.
+struct MergeEntry
+{
+	EndpointRecord record;
+	size_t         run;
+};
+
+// std::priority_queue keeps the largest on top, so the order is reversed.
+struct MergeEntryGreater
+{
+	bool operator()(const MergeEntry& e1, const MergeEntry& e2) const
+	{
+		return EndpointLess()(e2.record, e1.record);
+	}
+};
+
+// Buffered sequential reader over one run.
+struct RunReader
+{
+	std::FILE*                  file;
+	std::vector<EndpointRecord> block;
+	size_t                      pos;
+	size_t                      count;
+
+	bool next(EndpointRecord& record)
+	{
+		if (pos == count)
+		{
+			count = std::fread(&block[0], sizeof(EndpointRecord), block.size(), file);
+			pos = 0;
+			if (count == 0)
+				return false;
+		}
+
+		record = block[pos++];
+		return true;
+	}
+};
+
+// Writes merged records into a new run.
+class ExternalEndpointSort::RunWriter : public EndpointVisitor
+{
+public:
+	RunWriter(std::FILE* file, size_t blockRecords)
+		: m_file(file), m_block(), m_failed(false)
+	{
+		m_block.reserve(blockRecords);
+	}
+
+	virtual void visit(const EndpointRecord& record)
+	{
+		m_block.push_back(record);
+		if (m_block.size() == m_block.capacity())
+			flush();
+	}
+
+	bool flush()
+	{
+		if (!m_block.empty()
+			&& std::fwrite(&m_block[0], sizeof(EndpointRecord), m_block.size(), m_file) != m_block.size())
+		{
+			m_failed = true;
+		}
+
+		m_block.clear();
+		return !m_failed;
+	}
+
+private:
+	std::FILE*                  m_file;
+	std::vector<EndpointRecord> m_block;
+	bool                        m_failed;
+};
+
+ExternalEndpointSort::ExternalEndpointSort(size_t memoryBudget, const std::string& directory)
+: m_budgetRecords(std::max(memoryBudget / sizeof(EndpointRecord), 4 * kMinBlockRecords)),
+m_directory(directory),
+m_buffer(),
+m_runs(),
+m_nextRunId(0),
+m_failed(false)
+{
+	m_buffer.reserve(m_budgetRecords);
+}
+
+ExternalEndpointSort::~ExternalEndpointSort()
+{
+	for (size_t i = 0; i < m_runs.size(); ++i)
+		closeRun(m_runs[i]);
+}
+
+size_t ExternalEndpointSort::getRunCount() const
+{
+	return m_runs.size();
+}
+
+bool ExternalEndpointSort::add(const EndpointRecord& record)
+{
+	if (m_failed)
+		return false;
+
+	m_buffer.push_back(record);
+
+	if (m_buffer.size() >= m_budgetRecords)
+		return flush();
+
+	return true;
+}
+
+bool ExternalEndpointSort::openRun(Run& run)
+{
+	if (m_directory.empty())
+	{
+		run.file = std::tmpfile();
+		return run.file != NULL;
+	}
+
+	char name[64];
+	std::sprintf(name, "/roomgraph-%lx-%p-%u.run",
+		static_cast<unsigned long>(std::time(NULL)), static_cast<void*>(this), m_nextRunId++);
+
+	run.path = m_directory + name;
+	run.file = std::fopen(run.path.c_str(), "w+b");
+	return run.file != NULL;
+}
+
+void ExternalEndpointSort::closeRun(Run& run)
+{
+	if (run.file != NULL)
+		std::fclose(run.file);
+	if (!run.path.empty())
+		std::remove(run.path.c_str());
+
+	run.file = NULL;
+	run.path.clear();
+}
+
+// Sort the buffered records and write them out as one run.
+bool ExternalEndpointSort::flush()
+{
+	if (m_buffer.empty())
+		return true;
+
+	std::sort(m_buffer.begin(), m_buffer.end(), EndpointLess());
+
+	Run run;
+	run.file = NULL;
+
+	if (!openRun(run)
+		|| std::fwrite(&m_buffer[0], sizeof(EndpointRecord), m_buffer.size(), run.file) != m_buffer.size())
+	{
+		closeRun(run);
+		m_failed = true;
+		return false;
+	}
+
+	m_runs.push_back(run);
+	m_buffer.clear();
+
+	return true;
+}
+
+bool ExternalEndpointSort::merge(EndpointVisitor& visitor)
+{
+	if (m_failed)
+		return false;
+
+	// Everything fit into one buffer: no disk needed.
+	if (m_runs.empty())
+	{
+		std::sort(m_buffer.begin(), m_buffer.end(), EndpointLess());
+		for (size_t i = 0; i < m_buffer.size(); ++i)
+			visitor.visit(m_buffer[i]);
+
+		std::vector<EndpointRecord>().swap(m_buffer);
+		return true;
+	}
+
+	if (!flush())
+		return false;
+
+	// The merge blocks take the budget over from the buffer.
+	std::vector<EndpointRecord>().swap(m_buffer);
+
+	// One block per input run, plus one for the output of a pass.
+	const size_t maxFanIn = std::max(static_cast<size_t>(2), m_budgetRecords / kMinBlockRecords - 1);
+
+	while (m_runs.size() > maxFanIn)
+	{
+		Run merged;
+		merged.file = NULL;
+
+		if (!openRun(merged))
+		{
+			m_failed = true;
+			return false;
+		}
+
+		const size_t blockRecords = m_budgetRecords / (maxFanIn + 1);
+		RunWriter writer(merged.file, blockRecords);
+
+		if (!mergeRuns(0, maxFanIn, blockRecords, writer) || !writer.flush())
+		{
+			closeRun(merged);
+			m_failed = true;
+			return false;
+		}
+
+		for (size_t i = 0; i < maxFanIn; ++i)
+			closeRun(m_runs[i]);
+
+		m_runs.erase(m_runs.begin(), m_runs.begin() + maxFanIn);
+		m_runs.push_back(merged);
+	}
+
+	const size_t blockRecords = m_budgetRecords / m_runs.size();
+	if (!mergeRuns(0, m_runs.size(), blockRecords, visitor))
+	{
+		m_failed = true;
+		return false;
+	}
+
+	return true;
+}
+
+bool ExternalEndpointSort::mergeRuns(size_t first, size_t last, size_t blockRecords, EndpointVisitor& visitor)
+{
+	std::vector<RunReader> readers(last - first);
+	std::priority_queue<MergeEntry, std::vector<MergeEntry>, MergeEntryGreater> heap;
+
+	for (size_t i = 0; i < readers.size(); ++i)
+	{
+		RunReader& reader = readers[i];
+		reader.file = m_runs[first + i].file;
+		reader.block.resize(blockRecords);
+		reader.pos = 0;
+		reader.count = 0;
+
+		if (std::fseek(reader.file, 0, SEEK_SET) != 0)
+			return false;
+
+		MergeEntry entry;
+		entry.run = i;
+		if (reader.next(entry.record))
+			heap.push(entry);
+	}
+
+	while (!heap.empty())
+	{
+		MergeEntry entry = heap.top();
+		heap.pop();
+
+		visitor.visit(entry.record);
+
+		if (readers[entry.run].next(entry.record))
+			heap.push(entry);
+	}
+
+	for (size_t i = 0; i < readers.size(); ++i)
+	{
+		if (std::ferror(readers[i].file))
+			return false;
+	}
+
+	return true;
+}
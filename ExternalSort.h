@@ -0,0 +1,76 @@
+#ifndef EXTERNALSORT_H
+#define EXTERNALSORT_H
+
+#include <vector>
+#include <string>
+#include <cstdio>
+#include <cstddef>
+
+// One segment endpoint, keyed by its snap grid cell. "endpoint" is
+// 2 * segment index + 0 for a, 1 for b.
+struct EndpointRecord
+{
+	int    ix;
+	int    iy;
+	size_t endpoint;
+	double x;
+	double y;
+};
+
+// Receives the merged records.
+class EndpointVisitor
+{
+public:
+	virtual ~EndpointVisitor() {}
+	virtual void visit(const EndpointRecord& record) = 0;
+};
+
+// Sorts endpoint records by (ix, iy, endpoint) within a memory budget.
+// Records are collected until the budget is used up, then sorted and
+// written to a temporary file as one run. merge() reads all runs back
+// with a k-way merge; when there are more runs than the budget can hold
+// read buffers for, groups of runs are first merged into longer ones.
+class ExternalEndpointSort
+{
+public:
+	// Runs go to directory, or to tmpfile() when it is empty.
+	ExternalEndpointSort(size_t memoryBudget, const std::string& directory);
+
+	// Closes and removes the runs.
+	~ExternalEndpointSort();
+
+	// False once writing a run failed.
+	bool add(const EndpointRecord& record);
+
+	// Visit every record in order. False on an I/O error.
+	bool merge(EndpointVisitor& visitor);
+
+	size_t getRunCount() const;
+
+private:
+	ExternalEndpointSort(const ExternalEndpointSort&);
+	ExternalEndpointSort& operator=(const ExternalEndpointSort&);
+
+	struct Run
+	{
+		std::FILE*  file;
+		std::string path; // empty for tmpfile()
+	};
+
+	class RunWriter;
+
+	bool flush();
+	bool openRun(Run& run);
+	void closeRun(Run& run);
+	bool mergeRuns(size_t first, size_t last, size_t blockRecords, EndpointVisitor& visitor);
+
+private:
+	size_t                      m_budgetRecords;
+	std::string                 m_directory;
+	std::vector<EndpointRecord> m_buffer;
+	std::vector<Run>            m_runs;
+	unsigned int                m_nextRunId;
+	bool                        m_failed;
+};
+
+#endif // EXTERNALSORT_H
@@ -0,0 +1,197 @@
+#include "stdafx.h"
+#include "FloorStack.h"
+#include "Threading.h"
+
+#include <algorithm>
+
+// Builds one floor on a worker thread.
+class FloorTask : public Runnable
+{
+public:
+	FloorTask(RoomGraph* graph, const std::vector<Segment>* segments)
+		: m_graph(graph), m_segments(segments)
+	{
+	}
+
+	virtual void run()
+	{
+		m_graph->build(*m_segments);
+	}
+
+private:
+	RoomGraph*                  m_graph;
+	const std::vector<Segment>* m_segments;
+};
+
+FloorStack::FloorStack()
+: m_floors(),
+m_links(),
+m_snapSize(1e-3),
+m_options(),
+m_minOverlap(0.5)
+{
+}
+
+void FloorStack::setSnapSize(double snapSize)
+{
+	m_snapSize = snapSize;
+}
+
+void FloorStack::setOptions(const RoomGraph::Options& options)
+{
+	m_options = options;
+}
+
+void FloorStack::setMinOverlap(double minOverlap)
+{
+	m_minOverlap = minOverlap;
+}
+
+void FloorStack::build(const std::vector<std::vector<Segment> >& floors, int threadCount)
+{
+	m_floors.clear();
+	m_links.clear();
+
+	// Every floor gets its own graph, so the workers share nothing.
+	m_floors.resize(floors.size());
+
+	std::vector<FloorTask> tasks;
+	std::vector<Runnable*> runnables;
+	tasks.reserve(floors.size());
+	runnables.reserve(floors.size());
+
+	for (size_t i = 0; i < floors.size(); ++i)
+	{
+		m_floors[i].setSnapSize(m_snapSize);
+		m_floors[i].setOptions(m_options);
+
+		tasks.push_back(FloorTask(&m_floors[i], &floors[i]));
+		runnables.push_back(&tasks.back());
+	}
+
+	runParallel(runnables, threadCount);
+
+	for (int floor = 0; floor + 1 < getFloorCount(); ++floor)
+		linkFloors(floor);
+
+	std::sort(m_links.begin(), m_links.end(), LinkLess());
+}
+
+int FloorStack::getFloorCount() const
+{
+	return static_cast<int>(m_floors.size());
+}
+
+const RoomGraph& FloorStack::getFloor(int floor) const
+{
+	return m_floors[floor];
+}
+
+const std::vector<FloorStack::Link>& FloorStack::getLinks() const
+{
+	return m_links;
+}
+
+bool FloorStack::RoomBoxLess::operator()(const RoomBox& b1, const RoomBox& b2) const
+{
+	return b1.lo.x < b2.lo.x;
+}
+
+bool FloorStack::LinkLess::operator()(const Link& l1, const Link& l2) const
+{
+	if (l1.floor != l2.floor) return l1.floor < l2.floor;
+	if (l1.room != l2.room) return l1.room < l2.room;
+	return l1.upperRoom < l2.upperRoom;
+}
+
+void FloorStack::collectBoxes(int floor, std::vector<RoomBox>& boxes) const
+{
+	const std::vector<RoomGraph::Room>& rooms = m_floors[floor].getRooms();
+
+	for (size_t r = 0; r < rooms.size(); ++r)
+	{
+		const std::vector<Vec2>& poly = rooms[r].polygon;
+		if (poly.empty())
+			continue;
+
+		RoomBox box;
+		box.lo = poly[0];
+		box.hi = poly[0];
+		box.floor = floor;
+		box.room = static_cast<int>(r);
+
+		for (size_t k = 1; k < poly.size(); ++k)
+		{
+			box.lo.x = std::min(box.lo.x, poly[k].x);
+			box.lo.y = std::min(box.lo.y, poly[k].y);
+			box.hi.x = std::max(box.hi.x, poly[k].x);
+			box.hi.y = std::max(box.hi.y, poly[k].y);
+		}
+
+		boxes.push_back(box);
+	}
+}
+
+// Sort-and-sweep over x: both floors' boxes are visited by their left
+// edge, and each side keeps the boxes whose x interval still reaches the
+// sweep position. Only pairs overlapping in x are ever compared.
+void FloorStack::linkFloors(int lower)
+{
+	std::vector<RoomBox> boxes;
+	collectBoxes(lower, boxes);
+	collectBoxes(lower + 1, boxes);
+
+	std::sort(boxes.begin(), boxes.end(), RoomBoxLess());
+
+	std::vector<RoomBox> active[2];
+
+	for (size_t i = 0; i < boxes.size(); ++i)
+	{
+		const RoomBox& box = boxes[i];
+		const int side = box.floor - lower;
+		std::vector<RoomBox>& others = active[1 - side];
+
+		size_t kept = 0;
+		for (size_t k = 0; k < others.size(); ++k)
+		{
+			if (others[k].hi.x >= box.lo.x)
+				others[kept++] = others[k];
+		}
+		others.resize(kept);
+
+		for (size_t k = 0; k < others.size(); ++k)
+		{
+			if (side == 0)
+				tryLink(box, others[k]);
+			else
+				tryLink(others[k], box);
+		}
+
+		active[side].push_back(box);
+	}
+}
+
+void FloorStack::tryLink(const RoomBox& lower, const RoomBox& upper)
+{
+	const double ox = std::min(lower.hi.x, upper.hi.x) - std::max(lower.lo.x, upper.lo.x);
+	const double oy = std::min(lower.hi.y, upper.hi.y) - std::max(lower.lo.y, upper.lo.y);
+
+	if (ox <= 0.0 || oy <= 0.0)
+		return;
+
+	const double lowerArea = (lower.hi.x - lower.lo.x) * (lower.hi.y - lower.lo.y);
+	const double upperArea = (upper.hi.x - upper.lo.x) * (upper.hi.y - upper.lo.y);
+	const double smaller = std::min(lowerArea, upperArea);
+
+	const double overlap = smaller > 0.0 ? ox * oy / smaller : 0.0;
+	if (overlap < m_minOverlap)
+		return;
+
+	Link link;
+	link.floor = lower.floor;
+	link.room = lower.room;
+	link.upperRoom = upper.room;
+	link.overlap = overlap;
+
+	m_links.push_back(link);
+}
@@ -0,0 +1,81 @@
+#ifndef FLOORSTACK_H
+#define FLOORSTACK_H
+
+#include <vector>
+#include "Geometry.h"
+#include "RoomGraph.h"
+
+// Rooms of a multi-floor building. Every floor is built by its own
+// RoomGraph on a worker thread, so a batch takes about as long as the
+// slowest floor. Rooms on adjacent floors are then linked where their
+// bounding boxes overlap (shafts, stairs, atria).
+class FloorStack
+{
+public:
+	// Room "room" on floor "floor" overlaps room "upperRoom" on floor + 1.
+	struct Link
+	{
+		int floor;
+		int room;
+		int upperRoom;
+
+		// Overlap of the two bounding boxes, relative to the smaller box.
+		double overlap;
+
+		Link() : floor(-1), room(-1), upperRoom(-1), overlap(0.0) {}
+	};
+
+	FloorStack();
+
+	// Applied to every floor's graph.
+	void setSnapSize(double snapSize);
+	void setOptions(const RoomGraph::Options& options);
+
+	// Minimum relative overlap for two rooms to be linked, default 0.5.
+	void setMinOverlap(double minOverlap);
+
+	// Build all floors (bottom to top) on up to threadCount threads,
+	// then link the rooms of adjacent floors. threadCount <= 0 uses one
+	// thread per processor.
+	void build(const std::vector<std::vector<Segment> >& floors, int threadCount);
+
+	int getFloorCount() const;
+	const RoomGraph& getFloor(int floor) const;
+
+	// Links sorted by floor, then room.
+	const std::vector<Link>& getLinks() const;
+
+private:
+	// Bounding box of one room, tagged with its floor and index.
+	struct RoomBox
+	{
+		Vec2 lo;
+		Vec2 hi;
+		int floor;
+		int room;
+	};
+
+	struct RoomBoxLess
+	{
+		bool operator()(const RoomBox& b1, const RoomBox& b2) const;
+	};
+
+	struct LinkLess
+	{
+		bool operator()(const Link& l1, const Link& l2) const;
+	};
+
+	void collectBoxes(int floor, std::vector<RoomBox>& boxes) const;
+	void linkFloors(int lower);
+	void tryLink(const RoomBox& lower, const RoomBox& upper);
+
+private:
+	std::vector<RoomGraph> m_floors;
+	std::vector<Link>      m_links;
+
+	double             m_snapSize;
+	RoomGraph::Options m_options;
+	double             m_minOverlap;
+};
+
+#endif // FLOORSTACK_H
@@ -0,0 +1,269 @@
+#include "stdafx.h"
+#include "MemoryTracking.h"
+#include "Threading.h"
+
+#include <cstdlib>
+#include <new>
+
+// Innermost scope of this thread.
+static ROOMGRAPH_THREAD_LOCAL AllocationScope* t_scope = NULL;
+
+bool allocationTrackingEnabled()
+{
+#ifdef ROOMGRAPH_TRACK_ALLOCATIONS
+	return true;
+#else
+	return false;
+#endif
+}
+
+AllocationScope::AllocationScope()
+: m_outer(t_scope),
+m_counters(NULL),
+m_live(0),
+m_peak(0)
+{
+	t_scope = this;
+}
+
+AllocationScope::~AllocationScope()
+{
+	t_scope = m_outer;
+}
+
+void AllocationScope::setCounters(MemoryCounters* counters)
+{
+	m_counters = counters;
+	if (m_counters != NULL && m_live > 0 && static_cast<size_t>(m_live) > m_counters->peak)
+		m_counters->peak = static_cast<size_t>(m_live);
+}
+
+size_t AllocationScope::getPeak() const
+{
+	return m_peak;
+}
+
+void AllocationScope::recordAllocation(size_t size)
+{
+	for (AllocationScope* scope = t_scope; scope != NULL; scope = scope->m_outer)
+	{
+		scope->m_live += static_cast<ptrdiff_t>(size);
+
+		const size_t live = scope->m_live > 0 ? static_cast<size_t>(scope->m_live) : 0;
+		if (live > scope->m_peak)
+			scope->m_peak = live;
+
+		MemoryCounters* counters = scope->m_counters;
+		if (counters != NULL)
+		{
+			counters->bytes += size;
+			++counters->allocations;
+			if (live > counters->peak)
+				counters->peak = live;
+		}
+	}
+}
+
+void AllocationScope::recordFree(size_t size)
+{
+	for (AllocationScope* scope = t_scope; scope != NULL; scope = scope->m_outer)
+	{
+		scope->m_live -= static_cast<ptrdiff_t>(size);
+
+		if (scope->m_counters != NULL)
+			++scope->m_counters->frees;
+	}
+}
+
+MemoryModel::MemoryModel()
+: m_counts(),
+m_peaks(),
+m_fixed(0.0),
+m_perSegment(0.0)
+{
+}
+
+void MemoryModel::addSample(size_t segmentCount, size_t peakBytes)
+{
+	m_counts.push_back(static_cast<double>(segmentCount));
+	m_peaks.push_back(static_cast<double>(peakBytes));
+}
+
+bool MemoryModel::fit()
+{
+	const size_t n = m_counts.size();
+	if (n < 2)
+		return false;
+
+	double meanCount = 0.0;
+	double meanPeak = 0.0;
+	size_t i;
+
+	for (i = 0; i < n; ++i)
+	{
+		meanCount += m_counts[i];
+		meanPeak += m_peaks[i];
+	}
+	meanCount /= n;
+	meanPeak /= n;
+
+	// Centered sums keep the fit stable for large counts.
+	double sxx = 0.0;
+	double sxy = 0.0;
+
+	for (i = 0; i < n; ++i)
+	{
+		const double dx = m_counts[i] - meanCount;
+		sxx += dx * dx;
+		sxy += dx * (m_peaks[i] - meanPeak);
+	}
+
+	if (sxx <= 0.0)
+		return false;
+
+	m_perSegment = sxy / sxx;
+	m_fixed = meanPeak - m_perSegment * meanCount;
+	return true;
+}
+
+size_t MemoryModel::predict(size_t segmentCount) const
+{
+	const double bytes = m_fixed + m_perSegment * static_cast<double>(segmentCount);
+	return bytes > 0.0 ? static_cast<size_t>(bytes + 0.5) : 0;
+}
+
+double MemoryModel::getFixedBytes() const
+{
+	return m_fixed;
+}
+
+double MemoryModel::getBytesPerSegment() const
+{
+	return m_perSegment;
+}
+
+size_t MemoryModel::getSampleCount() const
+{
+	return m_counts.size();
+}
+
+#ifdef ROOMGRAPH_TRACK_ALLOCATIONS
+
+// Kept in front of every block; the union keeps the block aligned like
+// one from malloc.
+union AllocationHeader
+{
+	size_t      size;
+	double      alignDouble;
+	long double alignLongDouble;
+	void*       alignPointer;
+};
+
+static void* trackedAllocate(size_t size)
+{
+	AllocationHeader* header = static_cast<AllocationHeader*>(std::malloc(sizeof(AllocationHeader) + size));
+	if (header == NULL)
+		return NULL;
+
+	header->size = size;
+	if (t_scope != NULL)
+		AllocationScope::recordAllocation(size);
+
+	return header + 1;
+}
+
+static void trackedFree(void* p)
+{
+	if (p == NULL)
+		return;
+
+	AllocationHeader* header = static_cast<AllocationHeader*>(p) - 1;
+	if (t_scope != NULL)
+		AllocationScope::recordFree(header->size);
+
+	std::free(header);
+}
+
+// Exception specifications of the replaced operators: the dynamic ones
+// are ill-formed from C++17 on, and noexcept only exists from C++11.
+#if __cplusplus >= 201103L || (defined(_MSVC_LANG) && _MSVC_LANG >= 201103L)
+#define ROOMGRAPH_THROW_BAD_ALLOC
+#define ROOMGRAPH_NO_THROW noexcept
+#else
+#define ROOMGRAPH_THROW_BAD_ALLOC throw(std::bad_alloc)
+#define ROOMGRAPH_NO_THROW throw()
+#endif
+
+// Calls the new handler until the allocation succeeds, as the standard
+// operator new does.
+static void* trackedNew(size_t size)
+{
+	for (;;)
+	{
+		void* p = trackedAllocate(size);
+		if (p != NULL)
+			return p;
+
+		std::new_handler handler = std::set_new_handler(0);
+		std::set_new_handler(handler);
+
+		if (handler == 0)
+			throw std::bad_alloc();
+
+		handler();
+	}
+}
+
+void* operator new(size_t size) ROOMGRAPH_THROW_BAD_ALLOC
+{
+	return trackedNew(size);
+}
+
+void* operator new[](size_t size) ROOMGRAPH_THROW_BAD_ALLOC
+{
+	return trackedNew(size);
+}
+
+void* operator new(size_t size, const std::nothrow_t&) ROOMGRAPH_NO_THROW
+{
+	return trackedAllocate(size);
+}
+
+void* operator new[](size_t size, const std::nothrow_t&) ROOMGRAPH_NO_THROW
+{
+	return trackedAllocate(size);
+}
+
+void operator delete(void* p) ROOMGRAPH_NO_THROW
+{
+	trackedFree(p);
+}
+
+void operator delete[](void* p) ROOMGRAPH_NO_THROW
+{
+	trackedFree(p);
+}
+
+void operator delete(void* p, const std::nothrow_t&) ROOMGRAPH_NO_THROW
+{
+	trackedFree(p);
+}
+
+void operator delete[](void* p, const std::nothrow_t&) ROOMGRAPH_NO_THROW
+{
+	trackedFree(p);
+}
+
+// Sized forms, which C++14 compilers call when the size is known; the
+// header already holds it.
+void operator delete(void* p, size_t) ROOMGRAPH_NO_THROW
+{
+	trackedFree(p);
+}
+
+void operator delete[](void* p, size_t) ROOMGRAPH_NO_THROW
+{
+	trackedFree(p);
+}
+
+#endif // ROOMGRAPH_TRACK_ALLOCATIONS
@@ -0,0 +1,85 @@
+#ifndef MEMORYTRACKING_H
+#define MEMORYTRACKING_H
+
+#include <vector>
+#include <cstddef>
+
+// Heap use of one build stage.
+struct MemoryCounters
+{
+	// Bytes requested and the number of allocations and frees.
+	size_t        bytes;
+	unsigned long allocations;
+	unsigned long frees;
+
+	// Highest live heap bytes while the stage ran, counted from the
+	// start of the build, so it includes what earlier stages still hold.
+	size_t peak;
+
+	MemoryCounters() : bytes(0), allocations(0), frees(0), peak(0) {}
+};
+
+// True when compiled with ROOMGRAPH_TRACK_ALLOCATIONS. That define
+// replaces the global operator new and delete with versions that keep
+// the size in front of every block and report to the AllocationScope of
+// the calling thread; without it the scopes record nothing.
+bool allocationTrackingEnabled();
+
+// Records the heap use of the calling thread while it exists. Scopes
+// nest; an outer scope sees everything its inner scopes see. Memory
+// freed on another thread than the one that allocated it is booked to
+// the freeing thread.
+class AllocationScope
+{
+public:
+	AllocationScope();
+	~AllocationScope();
+
+	// Where allocations and frees are booked from now on (NULL: nowhere;
+	// live bytes and the peak are still followed).
+	void setCounters(MemoryCounters* counters);
+
+	// Highest live bytes since the scope started.
+	size_t getPeak() const;
+
+	// Called by the allocation hooks.
+	static void recordAllocation(size_t size);
+	static void recordFree(size_t size);
+
+private:
+	AllocationScope(const AllocationScope&);
+	AllocationScope& operator=(const AllocationScope&);
+
+	AllocationScope* m_outer;
+	MemoryCounters*  m_counters;
+	ptrdiff_t        m_live;
+	size_t           m_peak;
+};
+
+// Linear model of the peak memory of a build: fixed + perSegment * n,
+// fitted by least squares to measured (segment count, peak) samples.
+class MemoryModel
+{
+public:
+	MemoryModel();
+
+	void addSample(size_t segmentCount, size_t peakBytes);
+
+	// False with fewer than two distinct segment counts.
+	bool fit();
+
+	// Predicted peak bytes for a build of segmentCount segments.
+	size_t predict(size_t segmentCount) const;
+
+	double getFixedBytes() const;
+	double getBytesPerSegment() const;
+	size_t getSampleCount() const;
+
+private:
+	std::vector<double> m_counts;
+	std::vector<double> m_peaks;
+	double              m_fixed;
+	double              m_perSegment;
+};
+
+#endif // MEMORYTRACKING_H
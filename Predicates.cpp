@@ -0,0 +1,181 @@
+#include "stdafx.h"
+#include "Predicates.h"
+
+// Adaptive orientation test after J. R. Shewchuk, "Adaptive Precision
+// Floating-Point Arithmetic and Fast Robust Geometric Predicates".
+// The error-free transformations below assume IEEE double arithmetic
+// without extended intermediate precision (SSE2 / x64 code generation).
+
+static const double kEpsilon = 1.1102230246251565e-16;  // 2^-53
+static const double kSplitter = 134217729.0;             // 2^27 + 1
+static const double kCcwErrBound = (3.0 + 16.0 * kEpsilon) * kEpsilon;
+
+// x + y == a + b exactly.
+static void twoSum(double a, double b, double& x, double& y)
+{
+	x = a + b;
+	const double bvirt = x - a;
+	const double avirt = x - bvirt;
+	y = (a - avirt) + (b - bvirt);
+}
+
+// x + y == a - b exactly.
+static void twoDiff(double a, double b, double& x, double& y)
+{
+	x = a - b;
+	const double bvirt = a - x;
+	const double avirt = x + bvirt;
+	y = (a - avirt) + (bvirt - b);
+}
+
+static void split(double a, double& hi, double& lo)
+{
+	const double c = kSplitter * a;
+	const double abig = c - a;
+	hi = c - abig;
+	lo = a - hi;
+}
+
+// x + y == a * b exactly.
+static void twoProduct(double a, double b, double& x, double& y)
+{
+	x = a * b;
+
+	double ahi, alo, bhi, blo;
+	split(a, ahi, alo);
+	split(b, bhi, blo);
+
+	const double err1 = x - ahi * bhi;
+	const double err2 = err1 - alo * bhi;
+	const double err3 = err2 - ahi * blo;
+	y = alo * blo - err3;
+}
+
+// Add b to the expansion e (increasing magnitude, zero-free) in place.
+static int growExpansion(double* e, int elen, double b)
+{
+	double q = b;
+	int hindex = 0;
+
+	for (int i = 0; i < elen; ++i)
+	{
+		double sum, err;
+		twoSum(q, e[i], sum, err);
+		q = sum;
+		if (err != 0.0)
+			e[hindex++] = err;
+	}
+
+	if (q != 0.0 || hindex == 0)
+		e[hindex++] = q;
+
+	return hindex;
+}
+
+// Add sign * (ahi + alo) * (bhi + blo) to the expansion.
+static int addProduct(double* e, int elen, double ahi, double alo, double bhi, double blo, double sign)
+{
+	const double a[2] = { ahi, alo };
+	const double b[2] = { bhi, blo };
+
+	for (int i = 0; i < 2; ++i)
+	{
+		for (int j = 0; j < 2; ++j)
+		{
+			double x, y;
+			twoProduct(a[i], b[j], x, y);
+			elen = growExpansion(e, elen, sign * y);
+			elen = growExpansion(e, elen, sign * x);
+		}
+	}
+
+	return elen;
+}
+
+// Exact sign of (ax - cx) * (by - cy) - (ay - cy) * (bx - cx).
+static int exactOrient(const Vec2& a, const Vec2& b, const Vec2& c)
+{
+	double acx, acxtail, bcy, bcytail;
+	double acy, acytail, bcx, bcxtail;
+
+	twoDiff(a.x, c.x, acx, acxtail);
+	twoDiff(b.y, c.y, bcy, bcytail);
+	twoDiff(a.y, c.y, acy, acytail);
+	twoDiff(b.x, c.x, bcx, bcxtail);
+
+	double e[17];
+	int elen = 0;
+
+	elen = addProduct(e, elen, acx, acxtail, bcy, bcytail, 1.0);
+	elen = addProduct(e, elen, acy, acytail, bcx, bcxtail, -1.0);
+
+	// The largest component carries the sign.
+	const double top = e[elen - 1];
+	return (top > 0.0) - (top < 0.0);
+}
+
+int orient2d(const Vec2& a, const Vec2& b, const Vec2& c, PredicateCounters* counters)
+{
+	if (counters != NULL)
+		++counters->calls;
+
+	const double detleft = (a.x - c.x) * (b.y - c.y);
+	const double detright = (a.y - c.y) * (b.x - c.x);
+	const double det = detleft - detright;
+
+	double detsum;
+
+	if (detleft > 0.0)
+	{
+		if (detright <= 0.0)
+			return (det > 0.0) - (det < 0.0);
+		detsum = detleft + detright;
+	}
+	else if (detleft < 0.0)
+	{
+		if (detright >= 0.0)
+			return (det > 0.0) - (det < 0.0);
+		detsum = -detleft - detright;
+	}
+	else
+	{
+		return (det > 0.0) - (det < 0.0);
+	}
+
+	const double errbound = kCcwErrBound * detsum;
+	if (det >= errbound || -det >= errbound)
+		return (det > 0.0) - (det < 0.0);
+
+	if (counters != NULL)
+		++counters->fallbacks;
+
+	return exactOrient(a, b, c);
+}
+
+bool isCollinear(const Vec2& a, const Vec2& b, const Vec2& c, PredicateCounters* counters)
+{
+	return orient2d(a, b, c, counters) == 0;
+}
+
+// 0 for directions with angle in (-pi, 0], 1 for (0, pi].
+static int halfPlane(const Vec2& o, const Vec2& p)
+{
+	if (p.y < o.y)
+		return 0;
+	if (p.y == o.y && p.x > o.x)
+		return 0;
+	return 1;
+}
+
+int compareDirections(const Vec2& o, const Vec2& p, const Vec2& q, PredicateCounters* counters)
+{
+	const int hp = halfPlane(o, p);
+	const int hq = halfPlane(o, q);
+
+	if (hp != hq)
+		return hp < hq ? -1 : 1;
+
+	// Within one half-plane the angles differ by less than pi, so q lying
+	// counter-clockwise of p means p has the smaller angle.
+	return -orient2d(o, p, q, counters);
+}
@@ -0,0 +1,33 @@
+#ifndef PREDICATES_H
+#define PREDICATES_H
+
+#include <cstddef>
+#include "Geometry.h"
+
+// Counts predicate calls and how many of them needed the exact fallback.
+struct PredicateCounters
+{
+	unsigned long calls;
+	unsigned long fallbacks;
+
+	PredicateCounters() : calls(0), fallbacks(0) {}
+};
+
+// Orientation of the triangle (a, b, c): +1 counter-clockwise,
+// -1 clockwise, 0 collinear. A floating-point filter decides almost all
+// cases; the rest are evaluated exactly with expansion arithmetic, so the
+// sign is always correct for the given double coordinates.
+int orient2d(const Vec2& a, const Vec2& b, const Vec2& c,
+	PredicateCounters* counters = NULL);
+
+// Exact collinearity test.
+bool isCollinear(const Vec2& a, const Vec2& b, const Vec2& c,
+	PredicateCounters* counters = NULL);
+
+// Compare the directions o->p and o->q by angle, in the same order as
+// atan2 (from just above -pi up to pi). Returns -1, 0 or +1; 0 means the
+// directions are identical.
+int compareDirections(const Vec2& o, const Vec2& p, const Vec2& q,
+	PredicateCounters* counters = NULL);
+
+#endif // PREDICATES_H
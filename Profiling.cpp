@@ -0,0 +1,152 @@
+#include "stdafx.h"
+#include "Profiling.h"
+
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <time.h>
+#include <unistd.h>
+#endif
+
+#ifdef __linux__
+#include <cstring>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <linux/perf_event.h>
+#endif
+
+double monotonicMs()
+{
+#ifdef _WIN32
+	LARGE_INTEGER frequency;
+	LARGE_INTEGER now;
+	QueryPerformanceFrequency(&frequency);
+	QueryPerformanceCounter(&now);
+	return 1000.0 * static_cast<double>(now.QuadPart) / static_cast<double>(frequency.QuadPart);
+#else
+	struct timespec now;
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	return 1000.0 * now.tv_sec + now.tv_nsec / 1e6;
+#endif
+}
+
+const char* hardwareEventName(int event)
+{
+	switch (event)
+	{
+	case EventCycles:       return "cycles";
+	case EventInstructions: return "instructions";
+	case EventCacheMisses:  return "llc-misses";
+	case EventBranchMisses: return "branch-misses";
+	default:                return "?";
+	}
+}
+
+double HardwareCounters::ipc() const
+{
+	if (!available[EventCycles] || !available[EventInstructions] || counts[EventCycles] == 0)
+		return 0.0;
+
+	return static_cast<double>(counts[EventInstructions]) / static_cast<double>(counts[EventCycles]);
+}
+
+HardwareCounterSet::HardwareCounterSet()
+{
+	for (int e = 0; e < HardwareEventCount; ++e)
+		m_fds[e] = -1;
+}
+
+HardwareCounterSet::~HardwareCounterSet()
+{
+	close();
+}
+
+bool HardwareCounterSet::open()
+{
+	close();
+
+	bool opened = false;
+
+#ifdef __linux__
+	static const unsigned long long configs[HardwareEventCount] =
+	{
+		PERF_COUNT_HW_CPU_CYCLES,
+		PERF_COUNT_HW_INSTRUCTIONS,
+		PERF_COUNT_HW_CACHE_MISSES,
+		PERF_COUNT_HW_BRANCH_MISSES
+	};
+
+	for (int e = 0; e < HardwareEventCount; ++e)
+	{
+		struct perf_event_attr attr;
+		std::memset(&attr, 0, sizeof(attr));
+		attr.size = sizeof(attr);
+		attr.type = PERF_TYPE_HARDWARE;
+		attr.config = configs[e];
+		attr.read_format = PERF_FORMAT_TOTAL_TIME_ENABLED | PERF_FORMAT_TOTAL_TIME_RUNNING;
+		attr.exclude_kernel = 1;
+		attr.exclude_hv = 1;
+
+		// This thread on any CPU; fails with EACCES, ENOENT or ENOSYS where
+		// the container or the hardware does not allow it.
+		const long fd = syscall(__NR_perf_event_open, &attr, 0, -1, -1, 0);
+		if (fd >= 0)
+		{
+			m_fds[e] = static_cast<int>(fd);
+			opened = true;
+		}
+	}
+#endif
+
+	return opened;
+}
+
+void HardwareCounterSet::close()
+{
+	for (int e = 0; e < HardwareEventCount; ++e)
+	{
+#ifndef _WIN32
+		if (m_fds[e] >= 0)
+			::close(m_fds[e]);
+#endif
+		m_fds[e] = -1;
+	}
+}
+
+void HardwareCounterSet::sample(HardwareCounters& totals) const
+{
+	totals = HardwareCounters();
+
+#ifdef __linux__
+	for (int e = 0; e < HardwareEventCount; ++e)
+	{
+		if (m_fds[e] < 0)
+			continue;
+
+		// value, time enabled, time running
+		unsigned long long values[3];
+		if (::read(m_fds[e], values, sizeof(values)) != static_cast<ssize_t>(sizeof(values)))
+			continue;
+
+		totals.counts[e] = values[0];
+		if (values[2] > 0 && values[2] < values[1])
+			totals.counts[e] = static_cast<EventCount>(values[0] * (static_cast<double>(values[1]) / values[2]));
+
+		totals.available[e] = true;
+	}
+#endif
+}
+
+HardwareCounters HardwareCounterSet::difference(const HardwareCounters& after, const HardwareCounters& before)
+{
+	HardwareCounters result;
+
+	for (int e = 0; e < HardwareEventCount; ++e)
+	{
+		result.available[e] = after.available[e] && before.available[e];
+		if (result.available[e])
+			result.counts[e] = after.counts[e] >= before.counts[e] ? after.counts[e] - before.counts[e] : 0;
+	}
+
+	return result;
+}
@@ -0,0 +1,74 @@
+#ifndef PROFILING_H
+#define PROFILING_H
+
+// Milliseconds from a fixed, monotonic starting point; for differences.
+double monotonicMs();
+
+#ifdef _MSC_VER
+typedef unsigned __int64 EventCount;
+#else
+typedef unsigned long long EventCount;
+#endif
+
+// Hardware events counted per build stage.
+enum HardwareEvent
+{
+	EventCycles,
+	EventInstructions,
+	EventCacheMisses, // last level cache
+	EventBranchMisses,
+	HardwareEventCount
+};
+
+// Short name of an event for reports, e.g. "cycles".
+const char* hardwareEventName(int event);
+
+// Event counts; available[e] is false where the event could not be
+// counted, e.g. in containers or on systems without perf events.
+struct HardwareCounters
+{
+	EventCount counts[HardwareEventCount];
+	bool       available[HardwareEventCount];
+
+	HardwareCounters()
+	{
+		for (int e = 0; e < HardwareEventCount; ++e)
+		{
+			counts[e] = 0;
+			available[e] = false;
+		}
+	}
+
+	// Instructions per cycle, 0 if either is unavailable.
+	double ipc() const;
+};
+
+// Hardware event counters of the calling thread, user mode only, using
+// perf_event_open on Linux. Each event is opened on its own, so the ones
+// the system allows are counted even if others are refused. Elsewhere
+// nothing is available.
+class HardwareCounterSet
+{
+public:
+	HardwareCounterSet();
+	~HardwareCounterSet();
+
+	// Start counting; false when no event could be opened.
+	bool open();
+	void close();
+
+	// Totals since open(), scaled up where the kernel had to share the
+	// counters with other users.
+	void sample(HardwareCounters& totals) const;
+
+	// after - before, for the events available in both.
+	static HardwareCounters difference(const HardwareCounters& after, const HardwareCounters& before);
+
+private:
+	HardwareCounterSet(const HardwareCounterSet&);
+	HardwareCounterSet& operator=(const HardwareCounterSet&);
+
+	int m_fds[HardwareEventCount];
+};
+
+#endif // PROFILING_H
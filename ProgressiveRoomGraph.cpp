@@ -0,0 +1,105 @@
+#include "stdafx.h"
+#include "ProgressiveRoomGraph.h"
+
+#include <algorithm>
+#include <cmath>
+
+ProgressiveRoomGraph::ProgressiveRoomGraph()
+: m_coarse(),
+m_fine(),
+m_listener(NULL),
+m_started(false),
+m_refined(false)
+{
+}
+
+void ProgressiveRoomGraph::setListener(RoomGraphListener* listener)
+{
+	m_listener = listener;
+}
+
+void ProgressiveRoomGraph::start(const std::vector<Segment>& segments, const Vec2& focus,
+	double coarseSnap, double keepFraction)
+{
+	std::vector<Segment> longest;
+	decimate(segments, keepFraction, longest);
+
+	m_coarse.setSnapSize(coarseSnap);
+	m_coarse.build(longest);
+
+	m_started = true;
+	m_refined = false;
+
+	if (m_listener != NULL)
+		m_listener->onRooms(m_coarse.getRooms(), false);
+
+	// Only take the first step here so the preview is not delayed.
+	// The refinement keeps its own copy of the segments.
+	m_refined = m_fine.build(segments, focus, 0.0);
+
+	if (m_refined && m_listener != NULL)
+		m_listener->onRooms(m_fine.getRooms(), true);
+}
+
+bool ProgressiveRoomGraph::refine(double budgetMs)
+{
+	if (!m_started || m_refined)
+		return m_refined;
+
+	if (!m_fine.resume(budgetMs))
+		return false;
+
+	m_refined = true;
+
+	// The preview is no longer needed once it has been replaced.
+	m_coarse.build(std::vector<Segment>());
+
+	if (m_listener != NULL)
+		m_listener->onRooms(m_fine.getRooms(), true);
+
+	return true;
+}
+
+bool ProgressiveRoomGraph::isRefined() const
+{
+	return m_refined;
+}
+
+const std::vector<RoomGraph::Room>& ProgressiveRoomGraph::getRooms() const
+{
+	return m_refined ? m_fine.getRooms() : m_coarse.getRooms();
+}
+
+// Keep the longest keepFraction of the segments. The length threshold is
+// found with nth_element, so this stays linear in the segment count.
+void ProgressiveRoomGraph::decimate(const std::vector<Segment>& segments, double keepFraction,
+	std::vector<Segment>& longest) const
+{
+	const size_t n = segments.size();
+
+	if (n == 0 || keepFraction >= 1.0)
+	{
+		longest = segments;
+		return;
+	}
+
+	// Fractions of 0 or less (or NaN) keep the single longest segment.
+	size_t keep = 1;
+	if (keepFraction > 0.0)
+		keep = std::max(static_cast<size_t>(std::ceil(n * keepFraction)), keep);
+
+	std::vector<double> lengths(n);
+	for (size_t i = 0; i < n; ++i)
+		lengths[i] = distance(segments[i].a, segments[i].b);
+
+	std::vector<double> sorted(lengths);
+	std::nth_element(sorted.begin(), sorted.begin() + (n - keep), sorted.end());
+	const double threshold = sorted[n - keep];
+
+	longest.reserve(keep);
+	for (size_t i = 0; i < n; ++i)
+	{
+		if (lengths[i] >= threshold)
+			longest.push_back(segments[i]);
+	}
+}
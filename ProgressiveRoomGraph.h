@@ -0,0 +1,57 @@
+#ifndef PROGRESSIVEROOMGRAPH_H
+#define PROGRESSIVEROOMGRAPH_H
+
+#include <vector>
+#include "Geometry.h"
+#include "RoomGraph.h"
+
+// Receives the rooms of a progressive build.
+class RoomGraphListener
+{
+public:
+	virtual ~RoomGraphListener() {}
+
+	// Called once with the coarse preview and once more with the
+	// full-resolution rooms, which replace the preview.
+	virtual void onRooms(const std::vector<RoomGraph::Room>& rooms, bool refined) = 0;
+};
+
+// Coarse-to-fine room detection for a fast first paint.
+// start() builds a preview from the longest segments on a large snap grid.
+// refine() then runs the full-resolution build in small time slices, so it
+// can be driven from an idle handler without blocking the editor.
+class ProgressiveRoomGraph
+{
+public:
+	ProgressiveRoomGraph();
+
+	void setListener(RoomGraphListener* listener);
+
+	// Build the preview from the longest keepFraction (0..1] of the
+	// segments on a coarseSnap grid, and prepare the refinement. Values
+	// outside the range keep the longest segment or all of them.
+	void start(const std::vector<Segment>& segments, const Vec2& focus,
+		double coarseSnap, double keepFraction);
+
+	// Spend up to budgetMs on the refinement. Returns true once the
+	// refined rooms are available (and the listener was notified).
+	bool refine(double budgetMs);
+
+	bool isRefined() const;
+
+	// Preview rooms until refinement is done, refined rooms afterwards.
+	const std::vector<RoomGraph::Room>& getRooms() const;
+
+private:
+	void decimate(const std::vector<Segment>& segments, double keepFraction,
+		std::vector<Segment>& longest) const;
+
+private:
+	RoomGraph          m_coarse;
+	RoomGraph          m_fine;
+	RoomGraphListener* m_listener;
+	bool               m_started;
+	bool               m_refined;
+};
+
+#endif // PROGRESSIVEROOMGRAPH_H
@@ -0,0 +1,220 @@
+#include "stdafx.h"
+#include "ReferenceRooms.h"
+
+#include <cmath>
+
+struct ReferenceNode
+{
+	int  ix;
+	int  iy;
+	Vec2 pos;
+};
+
+struct ReferenceEdge
+{
+	int    from;
+	int    to;
+	double dx;    // direction from -> to
+	double dy;
+	double angle; // of that direction
+};
+
+static int referenceNode(std::vector<ReferenceNode>& nodes, const Vec2& p, double snapSize)
+{
+	const int ix = static_cast<int>(std::floor(p.x / snapSize + 0.5));
+	const int iy = static_cast<int>(std::floor(p.y / snapSize + 0.5));
+
+	for (size_t n = 0; n < nodes.size(); ++n)
+	{
+		if (nodes[n].ix == ix && nodes[n].iy == iy)
+			return static_cast<int>(n);
+	}
+
+	ReferenceNode node;
+	node.ix = ix;
+	node.iy = iy;
+	node.pos = p;
+	nodes.push_back(node);
+
+	return static_cast<int>(nodes.size()) - 1;
+}
+
+// Sum of doubles with the rounding error of each addition kept apart
+// (Neumaier's variant of Kahan summation).
+struct CompensatedSum
+{
+	double sum;
+	double error;
+
+	CompensatedSum() : sum(0.0), error(0.0) {}
+
+	void add(double x)
+	{
+		const double t = sum + x;
+		if (std::fabs(sum) >= std::fabs(x))
+			error += (sum - t) + x;
+		else
+			error += (x - t) + sum;
+		sum = t;
+	}
+
+	double value() const { return sum + error; }
+};
+
+// Adds a * b exactly as two doubles, splitting the factors in halves
+// (Dekker's product).
+static void addProduct(CompensatedSum& total, double a, double b)
+{
+	const double split = 134217729.0; // 2^27 + 1
+
+	const double ca = split * a;
+	const double aHigh = ca - (ca - a);
+	const double aLow = a - aHigh;
+
+	const double cb = split * b;
+	const double bHigh = cb - (cb - b);
+	const double bLow = b - bHigh;
+
+	const double product = a * b;
+	const double error = ((aHigh * bHigh - product) + aHigh * bLow + aLow * bHigh) + aLow * bLow;
+
+	total.add(product);
+	total.add(error);
+}
+
+// Around a node edges go by angle. Edges in the same direction
+// (duplicated or overlapping walls) go by wall, ascending when they
+// point right or straight up and descending otherwise, so the two ends
+// of a duplicated wall list its copies in opposite orders.
+static bool comesBefore(const std::vector<ReferenceEdge>& edges, int e1, int e2)
+{
+	const ReferenceEdge& a = edges[e1];
+	const ReferenceEdge& b = edges[e2];
+
+	const bool sameDirection = a.dx * b.dy - a.dy * b.dx == 0.0 && a.dx * b.dx + a.dy * b.dy > 0.0;
+	if (!sameDirection)
+		return a.angle < b.angle;
+
+	const int wall1 = e1 / 2;
+	const int wall2 = e2 / 2;
+
+	if (wall1 == wall2)
+		return e1 < e2;
+
+	const bool ascending = a.dx > 0.0 || (a.dx == 0.0 && a.dy > 0.0);
+	return ascending ? wall1 < wall2 : wall1 > wall2;
+}
+
+void findRoomsReference(const std::vector<Segment>& segments, double snapSize,
+	std::vector<RoomGraph::Room>& rooms)
+{
+	rooms.clear();
+
+	std::vector<ReferenceNode> nodes;
+	std::vector<ReferenceEdge> edges;
+	size_t i;
+
+	// Half-edges 2k and 2k + 1 are twins.
+	for (i = 0; i < segments.size(); ++i)
+	{
+		const int a = referenceNode(nodes, segments[i].a, snapSize);
+		const int b = referenceNode(nodes, segments[i].b, snapSize);
+		if (a == b)
+			continue;
+
+		ReferenceEdge e;
+		e.from = a;
+		e.to = b;
+		e.dx = nodes[b].pos.x - nodes[a].pos.x;
+		e.dy = nodes[b].pos.y - nodes[a].pos.y;
+		e.angle = std::atan2(e.dy, e.dx);
+		edges.push_back(e);
+
+		e.from = b;
+		e.to = a;
+		e.dx = -e.dx;
+		e.dy = -e.dy;
+		e.angle = std::atan2(e.dy, e.dx);
+		edges.push_back(e);
+	}
+
+	const int edgeCount = static_cast<int>(edges.size());
+
+	// next of e: at the end of e, the outgoing edge just before e's twin in
+	// angular order, or the last one if the twin comes first.
+	std::vector<int> next(edgeCount, -1);
+	int e;
+
+	for (e = 0; e < edgeCount; ++e)
+	{
+		const int twin = e ^ 1;
+		int before = -1;
+		int last = -1;
+
+		for (int o = 0; o < edgeCount; ++o)
+		{
+			if (edges[o].from != edges[e].to)
+				continue;
+
+			if (last < 0 || comesBefore(edges, last, o))
+				last = o;
+
+			if (comesBefore(edges, o, twin) && (before < 0 || comesBefore(edges, before, o)))
+				before = o;
+		}
+
+		next[e] = before >= 0 ? before : last;
+	}
+
+	std::vector<bool> used(edgeCount, false);
+
+	for (e = 0; e < edgeCount; ++e)
+	{
+		if (used[e])
+			continue;
+
+		std::vector<Vec2> polygon;
+		int current = e;
+
+		while (!used[current])
+		{
+			used[current] = true;
+			polygon.push_back(nodes[edges[current].from].pos);
+			current = next[current];
+		}
+
+		if (polygon.size() < 3)
+			continue;
+
+		// The shoelace sum from exact products: far from the origin the
+		// rounded products are larger than a small room.
+		CompensatedSum twiceArea;
+		CompensatedSum cx;
+		CompensatedSum cy;
+
+		for (i = 0; i < polygon.size(); ++i)
+		{
+			const Vec2& p = polygon[i];
+			const Vec2& q = polygon[(i + 1) % polygon.size()];
+
+			CompensatedSum cross;
+			addProduct(cross, p.x, q.y);
+			addProduct(cross, -q.x, p.y);
+
+			twiceArea.add(cross.sum);
+			twiceArea.add(cross.error);
+			addProduct(cx, p.x + q.x, cross.value());
+			addProduct(cy, p.y + q.y, cross.value());
+		}
+
+		const double area = 0.5 * twiceArea.value();
+		if (area < 1e-6)
+			continue;
+
+		RoomGraph::Room room;
+		room.polygon = polygon;
+		room.area = area;
+		room.center = Vec2(cx.value() / (6.0 * area), cy.value() / (6.0 * area));
+		rooms.push_back(room);
+	}
+}
@@ -0,0 +1,21 @@
+#ifndef REFERENCEROOMS_H
+#define REFERENCEROOMS_H
+
+#include <vector>
+#include "Geometry.h"
+#include "RoomGraph.h"
+
+// Slow, plain room finder to check RoomGraph against. It follows the
+// same rules (snap cells as in RoomGraph::findOrCreateNode, first point
+// of a cell as the node, walls only meet at their endpoints, the face of
+// a half-edge continues with the next outgoing edge clockwise, CCW faces
+// of area 1e-6 or more become rooms) with none of the speed-ups: nodes
+// by linear search, edges ordered with atan2 (walls in the same direction
+// found from the cross product), faces walked with plain
+// loops. Areas come from exact products instead of the builder's shift to
+// the first vertex. Only meant for small inputs, as it takes quadratic
+// time.
+void findRoomsReference(const std::vector<Segment>& segments, double snapSize,
+	std::vector<RoomGraph::Room>& rooms);
+
+#endif // REFERENCEROOMS_H
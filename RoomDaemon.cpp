@@ -0,0 +1,401 @@
+#include "stdafx.h"
+#include "RoomDaemon.h"
+
+#include <algorithm>
+#include <climits>
+#include <deque>
+#include <cstring>
+
+#ifndef _WIN32
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <poll.h>
+#include <unistd.h>
+#include <errno.h>
+#endif
+
+typedef unsigned int uint32;
+
+#ifndef _WIN32
+
+#ifdef MSG_NOSIGNAL
+static const int kSendFlags = MSG_NOSIGNAL;
+#else
+static const int kSendFlags = 0;
+#endif
+
+static bool readFully(int fd, void* data, size_t size)
+{
+	char* p = static_cast<char*>(data);
+
+	while (size > 0)
+	{
+		const ssize_t n = ::recv(fd, p, size, 0);
+		if (n < 0 && errno == EINTR)
+			continue;
+		if (n <= 0)
+			return false;
+
+		p += n;
+		size -= static_cast<size_t>(n);
+	}
+	return true;
+}
+
+static bool writeFully(int fd, const void* data, size_t size)
+{
+	const char* p = static_cast<const char*>(data);
+
+	while (size > 0)
+	{
+		const ssize_t n = ::send(fd, p, size, kSendFlags);
+		if (n < 0 && errno == EINTR)
+			continue;
+		if (n <= 0)
+			return false;
+
+		p += n;
+		size -= static_cast<size_t>(n);
+	}
+	return true;
+}
+
+static void appendBytes(std::vector<char>& out, const void* data, size_t size)
+{
+	const char* p = static_cast<const char*>(data);
+	out.insert(out.end(), p, p + size);
+}
+
+static void appendRooms(std::vector<char>& out, const std::vector<RoomGraph::Room>& rooms)
+{
+	const uint32 header[2] = { RoomDaemon::kResponseMagic, static_cast<uint32>(rooms.size()) };
+	appendBytes(out, header, sizeof(header));
+
+	for (size_t r = 0; r < rooms.size(); ++r)
+	{
+		const RoomGraph::Room& room = rooms[r];
+
+		const uint32 count = static_cast<uint32>(room.polygon.size());
+		const double values[3] = { room.area, room.center.x, room.center.y };
+		appendBytes(out, &count, sizeof(count));
+		appendBytes(out, values, sizeof(values));
+
+		for (size_t k = 0; k < room.polygon.size(); ++k)
+		{
+			const double xy[2] = { room.polygon[k].x, room.polygon[k].y };
+			appendBytes(out, xy, sizeof(xy));
+		}
+	}
+}
+
+#endif
+
+// One client. The reader thread parses requests and submits them; the
+// writer thread waits for them in the same order and sends the rooms.
+// m_slots bounds the jobs between the two.
+class RoomDaemon::Connection
+{
+public:
+	Connection(RoomService& service, size_t maxSegments, int fd)
+		: m_service(service),
+		m_maxSegments(maxSegments),
+		m_fd(fd),
+		m_pending(),
+		m_pendingLock(),
+		m_ready(0),
+		m_slots(kMaxInFlight),
+		m_finished(0),
+		m_reader(this),
+		m_writer(this),
+		m_readerThread(),
+		m_writerThread()
+	{
+	}
+
+	~Connection();
+
+	bool start();
+	void shutdown();
+	bool isFinished() const { return m_finished != 0; }
+
+private:
+	struct Reader : public Runnable
+	{
+		Connection* connection;
+		explicit Reader(Connection* c) : connection(c) {}
+		virtual void run() { connection->readRequests(); }
+	};
+
+	struct Writer : public Runnable
+	{
+		Connection* connection;
+		explicit Writer(Connection* c) : connection(c) {}
+		virtual void run() { connection->writeResponses(); }
+	};
+
+	void readRequests();
+	void writeResponses();
+	void pushPending(RoomJob* job);
+	RoomJob* popPending();
+
+private:
+	RoomService&          m_service;
+	size_t                m_maxSegments;
+	int                   m_fd;
+	std::deque<RoomJob*>  m_pending;
+	Mutex                 m_pendingLock;
+	Semaphore             m_ready;
+	Semaphore             m_slots;
+	volatile long         m_finished;
+	Reader                m_reader;
+	Writer                m_writer;
+	Thread                m_readerThread;
+	Thread                m_writerThread;
+};
+
+#ifndef _WIN32
+
+RoomDaemon::Connection::~Connection()
+{
+	m_readerThread.join();
+	m_writerThread.join();
+	::close(m_fd);
+}
+
+bool RoomDaemon::Connection::start()
+{
+	if (!m_writerThread.start(&m_writer))
+		return false;
+
+	if (!m_readerThread.start(&m_reader))
+	{
+		pushPending(NULL);
+		return false;
+	}
+	return true;
+}
+
+void RoomDaemon::Connection::shutdown()
+{
+	::shutdown(m_fd, SHUT_RDWR);
+}
+
+void RoomDaemon::Connection::pushPending(RoomJob* job)
+{
+	{
+		ScopedLock lock(m_pendingLock);
+		m_pending.push_back(job);
+	}
+	m_ready.post();
+}
+
+RoomJob* RoomDaemon::Connection::popPending()
+{
+	m_ready.wait();
+
+	ScopedLock lock(m_pendingLock);
+	RoomJob* job = m_pending.front();
+	m_pending.pop_front();
+	return job;
+}
+
+void RoomDaemon::Connection::readRequests()
+{
+	std::vector<double> values;
+
+	for (;;)
+	{
+		uint32 header[2];
+		if (!readFully(m_fd, header, sizeof(header)) || header[0] != kRequestMagic)
+			break;
+
+		// The count comes from the client; refuse to allocate for more
+		// than the daemon allows.
+		if (header[1] > m_maxSegments)
+			break;
+
+		values.resize(4 * static_cast<size_t>(header[1]));
+		if (!values.empty() && !readFully(m_fd, &values[0], values.size() * sizeof(double)))
+			break;
+
+		RoomJob* job = new RoomJob;
+		job->segments.resize(header[1]);
+		for (size_t i = 0; i < job->segments.size(); ++i)
+		{
+			const double* v = &values[4 * i];
+			job->segments[i] = Segment(Vec2(v[0], v[1]), Vec2(v[2], v[3]));
+		}
+
+		// Backpressure: wait for an answer to go out, then for room in
+		// the service queue. Meanwhile nothing is read from the socket.
+		m_slots.wait();
+
+		if (!m_service.submit(job))
+		{
+			delete job;
+			break;
+		}
+
+		pushPending(job);
+	}
+
+	pushPending(NULL);
+}
+
+void RoomDaemon::Connection::writeResponses()
+{
+	std::vector<char> buffer;
+	bool connected = true;
+
+	for (RoomJob* job = popPending(); job != NULL; job = popPending())
+	{
+		job->wait();
+
+		// Keep draining after the client went away; the jobs still have
+		// to be waited for and freed.
+		if (connected)
+		{
+			buffer.clear();
+			appendRooms(buffer, job->rooms);
+			connected = writeFully(m_fd, &buffer[0], buffer.size());
+
+			if (!connected)
+				shutdown();
+		}
+
+		delete job;
+		m_slots.post();
+	}
+
+	m_finished = 1;
+}
+
+#else
+
+RoomDaemon::Connection::~Connection() {}
+bool RoomDaemon::Connection::start() { return false; }
+void RoomDaemon::Connection::shutdown() {}
+void RoomDaemon::Connection::readRequests() {}
+void RoomDaemon::Connection::writeResponses() {}
+
+#endif
+
+RoomDaemon::RoomDaemon(RoomService& service)
+: m_service(service),
+m_maxSegments(kDefaultMaxSegments),
+m_stopping(0),
+m_connections()
+{
+}
+
+RoomDaemon::~RoomDaemon()
+{
+	reapConnections(true);
+}
+
+void RoomDaemon::setMaxSegments(size_t maxSegments)
+{
+	m_maxSegments = std::min(maxSegments, static_cast<size_t>(INT_MAX / 2));
+}
+
+void RoomDaemon::stop()
+{
+	m_stopping = 1;
+}
+
+// Close finished connections, or all of them once the daemon stops.
+void RoomDaemon::reapConnections(bool all)
+{
+	size_t kept = 0;
+
+	for (size_t i = 0; i < m_connections.size(); ++i)
+	{
+		Connection* connection = m_connections[i];
+
+		if (all)
+			connection->shutdown();
+
+		if (all || connection->isFinished())
+			delete connection;
+		else
+			m_connections[kept++] = connection;
+	}
+
+	m_connections.resize(kept);
+}
+
+#ifndef _WIN32
+
+bool RoomDaemon::serve(const char* path)
+{
+	sockaddr_un address;
+	std::memset(&address, 0, sizeof(address));
+	address.sun_family = AF_UNIX;
+
+	if (std::strlen(path) >= sizeof(address.sun_path))
+		return false;
+	std::strcpy(address.sun_path, path);
+
+	const int listener = ::socket(AF_UNIX, SOCK_STREAM, 0);
+	if (listener < 0)
+		return false;
+
+	::unlink(path);
+
+	if (::bind(listener, reinterpret_cast<sockaddr*>(&address), sizeof(address)) != 0
+		|| ::listen(listener, 64) != 0)
+	{
+		::close(listener);
+		return false;
+	}
+
+	m_stopping = 0;
+
+	// Wake up now and then to notice stop() and to reap connections.
+	while (!m_stopping)
+	{
+		pollfd waiting;
+		waiting.fd = listener;
+		waiting.events = POLLIN;
+		waiting.revents = 0;
+
+		const int ready = ::poll(&waiting, 1, 100);
+
+		reapConnections(false);
+
+		if (ready <= 0)
+			continue;
+
+		const int fd = ::accept(listener, NULL, NULL);
+		if (fd < 0)
+			continue;
+
+		Connection* connection = new Connection(m_service, m_maxSegments, fd);
+		if (connection->start())
+		{
+			m_connections.push_back(connection);
+		}
+		else
+		{
+			connection->shutdown();
+			delete connection;
+		}
+	}
+
+	reapConnections(true);
+
+	::close(listener);
+	::unlink(path);
+
+	return true;
+}
+
+#else
+
+bool RoomDaemon::serve(const char*)
+{
+	return false;
+}
+
+#endif
@@ -0,0 +1,69 @@
+#ifndef ROOMDAEMON_H
+#define ROOMDAEMON_H
+
+#include <vector>
+#include "RoomService.h"
+#include "Threading.h"
+
+// Serves a RoomService over a Unix domain socket, so a batch converter
+// can keep one warm process instead of starting one per drawing.
+//
+// A client sends any number of requests on one connection without
+// waiting for the answers; responses come back in request order. All
+// values are in native byte order (the socket is local):
+//
+//   request:  uint32 'RGRQ', uint32 segmentCount,
+//             segmentCount x double[4] (a.x, a.y, b.x, b.y)
+//   response: uint32 'RGRS', uint32 roomCount, then per room
+//             uint32 vertexCount, double area, double center[2],
+//             vertexCount x double[2]
+//
+// At most kMaxInFlight requests of a connection are queued or being
+// built; beyond that the daemon stops reading, and the client blocks in
+// its writes until answers have been sent. A request with more segments
+// than setMaxSegments() allows is not read: the connection closes once
+// the answers to the earlier requests have been sent.
+class RoomDaemon
+{
+public:
+	enum { kMaxInFlight = 64 };
+
+	// Default segments per request: 4M, 128 MB of coordinates.
+	enum { kDefaultMaxSegments = 1 << 22 };
+
+	enum
+	{
+		kRequestMagic = 0x51524752,  // "RGRQ"
+		kResponseMagic = 0x53524752  // "RGRS"
+	};
+
+	explicit RoomDaemon(RoomService& service);
+	~RoomDaemon();
+
+	// Largest request accepted from now on, at most what a RoomGraph
+	// can index (INT_MAX / 2 segments).
+	void setMaxSegments(size_t maxSegments);
+
+	// Listen on the socket at path (replacing a stale one) and serve
+	// connections until stop() is called from another thread. Returns
+	// false if the socket cannot be opened; always on Windows.
+	bool serve(const char* path);
+
+	void stop();
+
+private:
+	RoomDaemon(const RoomDaemon&);
+	RoomDaemon& operator=(const RoomDaemon&);
+
+	class Connection;
+
+	void reapConnections(bool all);
+
+private:
+	RoomService&             m_service;
+	size_t                   m_maxSegments;
+	volatile long            m_stopping;
+	std::vector<Connection*> m_connections;
+};
+
+#endif // ROOMDAEMON_H
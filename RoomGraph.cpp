@@ -1,312 +1,2305 @@
 #include "stdafx.h"
 #include "stdarx.h"
 #include "RoomGraph.h"
+#include "SegmentMerge.h"
+#include "SnapRounding.h"
+#include "ExternalSort.h"
+#include "BuildCapture.h"
+#include "BuildMetrics.h"
+#include "BuildPlanner.h"
+#include "Threading.h"
 
 #include <algorithm>
+#include <cfloat>
 #include <cmath>
+#include <cstdio>
+#include <cstdlib>
+
+// Segments added per step of an anytime build between deadline checks.
+static const size_t kSegmentChunk = 4096;
+
+// Books wall time, heap use and hardware events of build() to the stage
+// entered last.
+class StageRecorder
+{
+public:
+	StageRecorder(RoomGraph::BuildStats& stats, bool hardware)
+		: m_stats(stats),
+		m_allocations(),
+		m_counters(),
+		m_hardware(hardware && m_counters.open()),
+		m_stage(-1),
+		m_start(0.0),
+		m_startEvents()
+	{
+	}
+
+	void enter(int stage)
+	{
+		finish();
+
+		m_stage = stage;
+		m_allocations.setCounters(&m_stats.memory[stage]);
+		if (m_hardware)
+			m_counters.sample(m_startEvents);
+		m_start = monotonicMs();
+	}
+
+	void finish()
+	{
+		if (m_stage < 0)
+			return;
+
+		m_stats.stageMs[m_stage] += monotonicMs() - m_start;
+
+		if (m_hardware)
+		{
+			HardwareCounters events;
+			m_counters.sample(events);
+			m_stats.hardware[m_stage] = HardwareCounterSet::difference(events, m_startEvents);
+		}
+
+		m_allocations.setCounters(NULL);
+		m_stats.peakMemory = m_allocations.getPeak();
+		m_stage = -1;
+	}
+
+private:
+	StageRecorder(const StageRecorder&);
+	StageRecorder& operator=(const StageRecorder&);
+
+	RoomGraph::BuildStats& m_stats;
+	AllocationScope        m_allocations;
+	HardwareCounterSet     m_counters;
+	bool                   m_hardware;
+	int                    m_stage;
+	double                 m_start;
+	HardwareCounters       m_startEvents;
+};
 
 RoomGraph::RoomGraph()
 : m_nodes(),
 m_edges(),
 m_rooms(),
+m_faceCount(0),
+m_faceRoom(),
+m_roomFace(),
+m_edgeLayers(),
+m_overlayTags(),
 m_nodeIndex(),
-m_snapSize(1e-3) // grid size for snapping points
+m_endpointKeys(),
+m_endpointNode(),
+m_mergedKeys(),
+m_sampleKeys(),
+m_spareEdgeLists(),
+m_sparePolygons(),
+m_walkPolygon(),
+m_snapSize(1e-3), // grid size for snapping points
+m_options(),
+m_stats(),
+m_phase(PhaseIdle),
+m_pendingSegments(),
+m_segmentCursor(0),
+m_focus(),
+m_componentStart(),
+m_componentNodes(),
+m_componentOrder(),
+m_componentCursor(0),
+m_nodeVersions(),
+m_edgeVersions(),
+m_roomVersions(),
+m_faceRoomVersions(),
+m_roomFaceVersions(),
+m_versionFaceCount()
+{
+}
+
+void RoomGraph::clear()
+{
+	// Keep the edge lists and polygons for the next build.
+	if (m_spareEdgeLists.size() < m_nodes.size())
+		m_spareEdgeLists.resize(m_nodes.size());
+	if (m_sparePolygons.size() < m_rooms.size())
+		m_sparePolygons.resize(m_rooms.size());
+
+	size_t i;
+	for (i = 0; i < m_nodes.size(); ++i)
+	{
+		m_spareEdgeLists[i].swap(m_nodes[i].outgoingEdges);
+		m_spareEdgeLists[i].clear();
+	}
+	for (i = 0; i < m_rooms.size(); ++i)
+	{
+		m_sparePolygons[i].swap(m_rooms[i].polygon);
+		m_sparePolygons[i].clear();
+	}
+
+	m_nodes.clear();
+	m_edges.clear();
+	m_rooms.clear();
+	m_nodeIndex.clear();
+	m_endpointKeys.clear();
+	m_endpointNode.clear();
+	m_stats = BuildStats();
+
+	m_faceCount = 0;
+	m_faceRoom.clear();
+	m_roomFace.clear();
+
+	m_edgeLayers.clear();
+	m_overlayTags.clear();
+	m_layerRooms[0].clear();
+	m_layerRooms[1].clear();
+
+	m_phase = PhaseIdle;
+	std::vector<Segment>().swap(m_pendingSegments);
+	m_segmentCursor = 0;
+	m_componentStart.clear();
+	m_componentNodes.clear();
+	m_componentOrder.clear();
+	m_componentCursor = 0;
+
+	m_nodeVersions.releaseAll();
+	m_edgeVersions.releaseAll();
+	m_roomVersions.releaseAll();
+	m_faceRoomVersions.releaseAll();
+	m_roomFaceVersions.releaseAll();
+	m_versionFaceCount.clear();
+}
+
+const std::vector<RoomGraph::Room>& RoomGraph::getRooms() const
+{
+	return m_rooms;
+}
+
+void RoomGraph::getWalls(std::vector<Wall>& walls) const
+{
+	walls.clear();
+
+	// Twin half-edges are stored next to each other.
+	for (size_t i = 0; i + 1 < m_edges.size(); i += 2)
+	{
+		const HalfEdge& e = m_edges[i];
+		const HalfEdge& t = m_edges[i + 1];
+
+		if (e.from < 0)
+			continue;
+
+		Wall wall;
+		wall.segment = Segment(m_nodes[e.from].pos, m_nodes[e.to].pos);
+		wall.leftRoom = e.face >= 0 ? m_faceRoom[e.face] : -1;
+		wall.rightRoom = t.face >= 0 ? m_faceRoom[t.face] : -1;
+
+		walls.push_back(wall);
+	}
+}
+
+size_t RoomGraph::writeRooms(void* buffer, size_t capacity) const
+{
+	size_t vertexCount = 0;
+	for (size_t r = 0; r < m_rooms.size(); ++r)
+		vertexCount += m_rooms[r].polygon.size();
+
+	const size_t required = m_rooms.size() * sizeof(FlatRoom) + vertexCount * 2 * sizeof(double);
+	if (required > capacity || buffer == NULL)
+		return required;
+
+	FlatRoom* flat = static_cast<FlatRoom*>(buffer);
+	double* vertex = reinterpret_cast<double*>(flat + m_rooms.size());
+	unsigned int first = 0;
+
+	for (size_t r = 0; r < m_rooms.size(); ++r)
+	{
+		const Room& room = m_rooms[r];
+
+		flat[r].area = room.area;
+		flat[r].centerX = room.center.x;
+		flat[r].centerY = room.center.y;
+		flat[r].firstVertex = first;
+		flat[r].vertexCount = static_cast<unsigned int>(room.polygon.size());
+
+		for (size_t k = 0; k < room.polygon.size(); ++k)
+		{
+			*vertex++ = room.polygon[k].x;
+			*vertex++ = room.polygon[k].y;
+		}
+
+		first += flat[r].vertexCount;
+	}
+
+	return required;
+}
+
+void RoomGraph::setSnapSize(double snapSize)
+{
+	if (snapSize > 0.0)
+		m_snapSize = snapSize;
+}
+
+double RoomGraph::getSnapSize() const
+{
+	return m_snapSize;
+}
+
+void RoomGraph::setOptions(const Options& options)
+{
+	m_options = options;
+}
+
+const RoomGraph::Options& RoomGraph::getOptions() const
+{
+	return m_options;
+}
+
+const char* RoomGraph::stageName(int stage)
+{
+	switch (stage)
+	{
+	case StagePrepare: return "prepare";
+	case StageNodes:   return "nodes";
+	case StageSort:    return "sort";
+	case StageLink:    return "link";
+	case StageWalk:    return "walk";
+	default:           return "?";
+	}
+}
+
+const RoomGraph::BuildStats& RoomGraph::getStats() const
+{
+	return m_stats;
+}
+
+bool RoomGraph::calibrateMemory(const std::vector<Segment>& segments, int steps, MemoryModel& model) const
+{
+	if (!allocationTrackingEnabled() || segments.empty() || steps < 2)
+		return false;
+
+	for (int step = 1; step <= steps; ++step)
+	{
+		const size_t count = segments.size() * step / steps;
+		if (count == 0)
+			continue;
+
+		RoomGraph graph;
+		graph.setSnapSize(m_snapSize);
+		graph.setOptions(m_options);
+		graph.build(&segments[0], count);
+
+		model.addSample(count, graph.getStats().peakMemory);
+	}
+
+	return model.fit();
+}
+
+bool RoomGraph::checkAllocationFree(const std::vector<Segment>& segments, std::string& report)
+{
+	report.clear();
+
+	if (!allocationTrackingEnabled())
+	{
+		report = "allocation tracking is not compiled in (ROOMGRAPH_TRACK_ALLOCATIONS)";
+		return false;
+	}
+
+	build(segments);
+	build(segments);
+
+	bool allocationFree = true;
+
+	for (int stage = 0; stage < StageCount; ++stage)
+	{
+		const MemoryCounters& memory = m_stats.memory[stage];
+		if (memory.allocations == 0)
+			continue;
+
+		char line[128];
+		std::sprintf(line, "%s: %lu allocations, %lu bytes\n",
+			stageName(stage), memory.allocations, static_cast<unsigned long>(memory.bytes));
+
+		report += line;
+		allocationFree = false;
+	}
+
+	return allocationFree;
+}
+
+template <class T>
+static size_t vectorBytes(const std::vector<T>& v)
+{
+	return v.capacity() * sizeof(T);
+}
+
+size_t RoomGraph::getWorkspaceBytes() const
+{
+	size_t bytes = vectorBytes(m_nodes) + vectorBytes(m_edges) + vectorBytes(m_rooms)
+		+ vectorBytes(m_faceRoom) + vectorBytes(m_roomFace)
+		+ vectorBytes(m_endpointKeys) + vectorBytes(m_endpointNode) + vectorBytes(m_mergedKeys)
+		+ vectorBytes(m_sampleKeys)
+		+ vectorBytes(m_spareEdgeLists) + vectorBytes(m_sparePolygons) + vectorBytes(m_walkPolygon)
+		+ vectorBytes(m_edgeLayers) + vectorBytes(m_overlayTags) + vectorBytes(m_pendingSegments)
+		+ vectorBytes(m_componentStart) + vectorBytes(m_componentNodes) + vectorBytes(m_componentOrder);
+
+	size_t i;
+	for (i = 0; i < m_nodes.size(); ++i)
+		bytes += vectorBytes(m_nodes[i].outgoingEdges);
+	for (i = 0; i < m_rooms.size(); ++i)
+		bytes += vectorBytes(m_rooms[i].polygon);
+
+	for (i = 0; i < m_spareEdgeLists.size(); ++i)
+		bytes += vectorBytes(m_spareEdgeLists[i]);
+	for (i = 0; i < m_sparePolygons.size(); ++i)
+		bytes += vectorBytes(m_sparePolygons[i]);
+
+	return bytes;
+}
+
+// The built-in cost model of StrategyAuto.
+static const CostModel s_defaultCostModel;
+
+// Strategy of a full build: fixed by the options, or for StrategyAuto
+// the one the cost model predicts to be fastest for a sample of the
+// segments.
+void RoomGraph::choosePlan(const Segment* segments, size_t count)
+{
+	BuildPlan& plan = m_stats.plan;
+	const int threads = m_options.threads > 0 ? m_options.threads : hardwareThreadCount();
+
+	if (m_options.strategy == StrategyAuto)
+	{
+		const double start = monotonicMs();
+		profileInput(segments, count, plan.profile);
+
+		const CostModel& model = m_options.costModel != NULL ? *m_options.costModel : s_defaultCostModel;
+		plan.strategy = model.choose(plan.profile, threads, plan.predictedMs);
+		plan.tuned = true;
+		plan.sampleMs = monotonicMs() - start;
+	}
+	else if (m_options.strategy >= 0 && m_options.strategy < StrategyCount)
+	{
+		plan.strategy = m_options.strategy;
+	}
+	else
+	{
+		plan.strategy = threads > 1 ? StrategyParallel : StrategySorted;
+	}
+
+	plan.threads = plan.strategy == StrategyParallel ? threads : 1;
+}
+
+// Sampling pass of StrategyAuto: kSampleRuns runs of kSampleRun
+// consecutive segments spread over the input, or all of a small input.
+static const size_t kSampleRun = 256;
+static const size_t kSampleRuns = 16;
+
+void RoomGraph::profileInput(const Segment* segments, size_t count, InputProfile& profile)
+{
+	profile = InputProfile();
+	profile.segments = count;
+
+	if (count == 0)
+		return;
+
+	const size_t runs = count <= kSampleRun * kSampleRuns ? 1 : kSampleRuns;
+	const size_t runLength = runs == 1 ? count : kSampleRun;
+
+	m_sampleKeys.clear();
+	m_sampleKeys.reserve(2 * runs * runLength);
+
+	double minX = DBL_MAX;
+	double minY = DBL_MAX;
+	double maxX = -DBL_MAX;
+	double maxY = -DBL_MAX;
+	size_t aligned = 0;
+	size_t zeroLength = 0;
+
+	for (size_t r = 0; r < runs; ++r)
+	{
+		const size_t first = runs == 1 ? 0
+			: static_cast<size_t>(static_cast<double>(count - runLength) * r / (runs - 1));
+
+		for (size_t i = first; i < first + runLength; ++i)
+		{
+			const Segment& s = segments[i];
+			const GridKey a(static_cast<int>(std::floor(s.a.x / m_snapSize + 0.5)),
+				static_cast<int>(std::floor(s.a.y / m_snapSize + 0.5)));
+			const GridKey b(static_cast<int>(std::floor(s.b.x / m_snapSize + 0.5)),
+				static_cast<int>(std::floor(s.b.y / m_snapSize + 0.5)));
+
+			if (a.ix == b.ix && a.iy == b.iy)
+				++zeroLength;
+			else if (a.ix == b.ix || a.iy == b.iy)
+				++aligned;
+
+			m_sampleKeys.push_back(a);
+			m_sampleKeys.push_back(b);
+
+			minX = std::min(minX, std::min(s.a.x, s.b.x));
+			minY = std::min(minY, std::min(s.a.y, s.b.y));
+			maxX = std::max(maxX, std::max(s.a.x, s.b.x));
+			maxY = std::max(maxY, std::max(s.a.y, s.b.y));
+		}
+	}
+
+	const size_t sampled = runs * runLength;
+	profile.sampled = static_cast<int>(sampled);
+	profile.zeroLength = static_cast<double>(zeroLength) / sampled;
+	profile.axisAligned = zeroLength < sampled ? static_cast<double>(aligned) / (sampled - zeroLength) : 0.0;
+	profile.width = maxX - minX;
+	profile.height = maxY - minY;
+
+	// Equal keys are one node of the sample; their number its degree.
+	std::sort(m_sampleKeys.begin(), m_sampleKeys.end());
+
+	size_t nodes = 0;
+	size_t k = 0;
+
+	while (k < m_sampleKeys.size())
+	{
+		size_t end = k + 1;
+		while (end < m_sampleKeys.size() && !(m_sampleKeys[k] < m_sampleKeys[end]))
+			++end;
+
+		const int degree = static_cast<int>(end - k);
+		profile.degreeShare[std::min(degree, 4) - 1] += 1.0;
+		profile.maxDegree = std::max(profile.maxDegree, degree);
+		++nodes;
+
+		k = end;
+	}
+
+	profile.meanDegree = static_cast<double>(m_sampleKeys.size()) / nodes;
+	for (int d = 0; d < 4; ++d)
+		profile.degreeShare[d] /= nodes;
+}
+
+// Run the optional clean-up stages. Returns true if they ran and left
+// the cleaned copy in scratch; otherwise the input is used as it is.
+// "unnoded" counts the pieces snap rounding could not resolve.
+bool RoomGraph::prepareSegments(const Segment* segments, size_t count,
+	std::vector<Segment>& scratch, size_t& unnoded) const
+{
+	unnoded = 0;
+
+	if (!m_options.mergeCollinear && !m_options.snapRounding)
+		return false;
+
+	const std::vector<Segment> input(segments, segments + count);
+
+	if (m_options.mergeCollinear && m_options.snapRounding)
+	{
+		std::vector<Segment> merged;
+		mergeCollinearSegments(input, m_snapSize, merged);
+		unnoded = snapRoundSegments(merged, m_snapSize, scratch);
+	}
+	else if (m_options.mergeCollinear)
+	{
+		mergeCollinearSegments(input, m_snapSize, scratch);
+	}
+	else
+	{
+		unnoded = snapRoundSegments(input, m_snapSize, scratch);
+	}
+
+	return true;
+}
+
+void RoomGraph::build(const std::vector<Segment>& segments)
+{
+	build(segments.empty() ? NULL : &segments[0], segments.size());
+}
+
+void RoomGraph::build(const Segment* segments, size_t count)
+{
+	clear();
+
+	if (count == 0)
+		return;
+
+	// Stages are measured from here, after the old graph is cleared.
+	StageRecorder recorder(m_stats, m_options.hardwareCounters);
+
+	// The input as given, for a capture.
+	const Segment* input = segments;
+	const size_t inputCount = count;
+
+	// 0) Optional clean-up: merge overlapping segments, node crossings.
+	recorder.enter(StagePrepare);
+	std::vector<Segment> scratch;
+	if (prepareSegments(segments, count, scratch, m_stats.unnodedPieces))
+	{
+		segments = scratch.empty() ? NULL : &scratch[0];
+		count = scratch.size();
+	}
+
+	choosePlan(segments, count);
+
+	// 1) Build nodes and half-edges from raw segments.
+	recorder.enter(StageNodes);
+	buildNodesAndEdges(segments, count);
+	m_stats.snapMerges = static_cast<unsigned long>(2 * count - m_nodes.size());
+
+	// 2) Sort outgoing edges at each node by angle.
+	recorder.enter(StageSort);
+	sortOutgoingByAngle();
+
+	// 3) For each half-edge, determine the "next" edge when walking a face.
+	recorder.enter(StageLink);
+	buildNextRelations();
+
+	// 4) Walk all closed cycles and turn them into rooms.
+	recorder.enter(StageWalk);
+	walkCycles();
+
+	recorder.finish();
+
+	m_phase = PhaseDone;
+
+	if (m_options.validate)
+	{
+		const double start = monotonicMs();
+		validate(m_stats.validation, 0);
+		m_stats.validateMs = monotonicMs() - start;
+	}
+
+	if (!m_options.captureDirectory.empty())
+	{
+		double totalMs = 0.0;
+		for (int stage = 0; stage < StageCount; ++stage)
+			totalMs += m_stats.stageMs[stage];
+
+		m_stats.captured = captureSlowBuild(input, inputCount, m_snapSize, m_options, m_stats,
+			static_cast<int>(m_rooms.size()), totalMs);
+	}
+
+	if (m_options.metrics)
+		recordBuildMetrics(m_stats, inputCount, m_rooms.size(), getWorkspaceBytes());
+}
+
+bool RoomGraph::build(const std::vector<Segment>& segments, const Vec2& focus, double budgetMs)
+{
+	clear();
+
+	// Keep a copy, the caller's segments may be gone before resume().
+	std::vector<Segment> scratch;
+	if (prepareSegments(segments.empty() ? NULL : &segments[0], segments.size(), scratch,
+		m_stats.unnodedPieces))
+		m_pendingSegments.swap(scratch);
+	else
+		m_pendingSegments = segments;
+
+	m_focus = focus;
+	m_phase = PhaseNodes;
+
+	m_nodes.reserve(m_pendingSegments.size() * 2);
+	m_edges.reserve(m_pendingSegments.size() * 2);
+
+	return resume(budgetMs);
+}
+
+// Run the anytime build in small steps and stop at the first step
+// boundary past the budget. A single component is never split, so the
+// largest component bounds how far a call can overshoot.
+bool RoomGraph::resume(double budgetMs)
+{
+	const double start = monotonicMs();
+
+	while (m_phase != PhaseDone && m_phase != PhaseIdle)
+	{
+		if (m_phase == PhaseNodes)
+		{
+			const size_t count = m_pendingSegments.size();
+			const size_t end = std::min(m_segmentCursor + kSegmentChunk, count);
+
+			for (; m_segmentCursor < end; ++m_segmentCursor)
+				addSegment(m_pendingSegments[m_segmentCursor]);
+
+			if (m_segmentCursor == count)
+			{
+				std::vector<Segment>().swap(m_pendingSegments);
+				m_phase = PhaseComponents;
+			}
+		}
+		else if (m_phase == PhaseComponents)
+		{
+			collectComponents();
+			m_phase = PhaseWalk;
+		}
+		else
+		{
+			if (m_componentCursor < m_componentOrder.size())
+				processComponent(m_componentOrder[m_componentCursor++]);
+
+			if (m_componentCursor == m_componentOrder.size())
+				m_phase = PhaseDone;
+		}
+
+		if (m_phase != PhaseDone && monotonicMs() - start >= budgetMs)
+			return false;
+	}
+
+	return true;
+}
+
+bool RoomGraph::isComplete() const
+{
+	return m_phase == PhaseDone || m_phase == PhaseIdle;
+}
+
+// Checks that only need one node and the edges around it: the outgoing
+// edges, their twins, and the next of each edge arriving at the node.
+// The edges whose predecessors a task counts all leave its own nodes, so
+// tasks on disjoint node ranges never write the same mark.
+struct RoomGraph::ValidateNodesTask : public Runnable
+{
+	const RoomGraph*            graph;
+	std::vector<unsigned char>* marks;
+	int                         begin;
+	int                         end;
+	Validation                  result;
+	int                         listed;
+
+	void run()
+	{
+		const std::vector<HalfEdge>& edges = graph->m_edges;
+		const int edgeCount = static_cast<int>(edges.size());
+		std::vector<unsigned char>& mark = *marks;
+		int n;
+
+		for (n = begin; n < end; ++n)
+		{
+			const std::vector<int>& out = graph->m_nodes[n].outgoingEdges;
+			listed += static_cast<int>(out.size());
+
+			for (size_t k = 0; k < out.size(); ++k)
+			{
+				const HalfEdge& e = edges[out[k]];
+
+				if (e.from != n)
+					++result.badIncidence;
+
+				if (e.twin < 0 || e.twin >= edgeCount || edges[e.twin].twin != out[k]
+					|| edges[e.twin].from != e.to || edges[e.twin].to != e.from)
+				{
+					++result.badTwin;
+					continue;
+				}
+
+				// The twin arrives here; its next must leave from here.
+				const int next = edges[e.twin].next;
+				if (next < 0 || next >= edgeCount || edges[next].from != n)
+					++result.badNext;
+				else if (mark[next] < 2)
+					++mark[next];
+			}
+		}
+
+		for (n = begin; n < end; ++n)
+		{
+			const std::vector<int>& out = graph->m_nodes[n].outgoingEdges;
+
+			for (size_t k = 0; k < out.size(); ++k)
+			{
+				if (mark[out[k]] != 1)
+					++result.badPermutation;
+			}
+		}
+	}
+};
+
+// Nodes per task of validate(); smaller graphs are checked on the
+// calling thread.
+static const int kValidateChunk = 16384;
+
+bool RoomGraph::validate(Validation& result, int threadCount) const
 {
+	result = Validation();
+
+	if (!isComplete())
+		return false;
+
+	result.complete = true;
+
+	const int nodeCount = static_cast<int>(m_nodes.size());
+	const int edgeCount = static_cast<int>(m_edges.size());
+	int i;
+
+	// 1) Local checks, node by node.
+	std::vector<unsigned char> marks(edgeCount, 0);
+	std::vector<ValidateNodesTask> tasks((nodeCount + kValidateChunk - 1) / kValidateChunk);
+	std::vector<Runnable*> runnables(tasks.size());
+
+	for (size_t t = 0; t < tasks.size(); ++t)
+	{
+		tasks[t].graph = this;
+		tasks[t].marks = &marks;
+		tasks[t].begin = static_cast<int>(t) * kValidateChunk;
+		tasks[t].end = std::min(nodeCount, tasks[t].begin + kValidateChunk);
+		tasks[t].listed = 0;
+		runnables[t] = &tasks[t];
+	}
+
+	runParallel(runnables, threadCount);
+
+	int listed = 0;
+	for (size_t t = 0; t < tasks.size(); ++t)
+	{
+		const Validation& part = tasks[t].result;
+		result.badIncidence += part.badIncidence;
+		result.badTwin += part.badTwin;
+		result.badNext += part.badNext;
+		result.badPermutation += part.badPermutation;
+		listed += tasks[t].listed;
+	}
+
+	// Removed walls leave detached edges behind; every other edge must be
+	// listed at its node.
+	for (i = 0; i < edgeCount; ++i)
+	{
+		if (m_edges[i].from >= 0)
+			++result.edges;
+	}
+
+	if (listed != result.edges)
+		result.badIncidence += std::abs(listed - result.edges);
+
+	// The cycles of next are only faces if next is a permutation.
+	if (result.badIncidence != 0 || result.badTwin != 0 || result.badNext != 0
+		|| result.badPermutation != 0)
+	{
+		return false;
+	}
+
+	// 2) Components, with the node list as the search queue.
+	std::vector<int> component(nodeCount, -1);
+	std::vector<int> queue;
+	std::vector<int> vertices;
+	std::vector<int> halfEdges;
+
+	queue.reserve(nodeCount);
+
+	for (int seed = 0; seed < nodeCount; ++seed)
+	{
+		if (component[seed] >= 0 || m_nodes[seed].outgoingEdges.empty())
+			continue;
+
+		const int c = static_cast<int>(vertices.size());
+		vertices.push_back(0);
+		halfEdges.push_back(0);
+
+		queue.clear();
+		queue.push_back(seed);
+		component[seed] = c;
+
+		for (size_t k = 0; k < queue.size(); ++k)
+		{
+			const std::vector<int>& out = m_nodes[queue[k]].outgoingEdges;
+
+			++vertices[c];
+			halfEdges[c] += static_cast<int>(out.size());
+
+			for (size_t j = 0; j < out.size(); ++j)
+			{
+				const int to = m_edges[out[j]].to;
+				if (component[to] < 0)
+				{
+					component[to] = c;
+					queue.push_back(to);
+				}
+			}
+		}
+	}
+
+	result.components = static_cast<int>(vertices.size());
+
+	// 3) Faces: walk each cycle of next once.
+	std::vector<int> faces(result.components, 0);
+	std::vector<double> ccwArea(result.components, 0.0);
+	std::vector<double> cwArea(result.components, 0.0);
+	std::vector<double> rounding(result.components, 0.0);
+
+	std::vector<double> faceArea(m_faceCount, 0.0);
+	std::vector<double> faceRounding(m_faceCount, 0.0);
+	std::vector<char> faceSeen(m_faceCount, 0);
+	std::vector<char> seen(edgeCount, 0);
+
+	for (i = 0; i < edgeCount; ++i)
+	{
+		if (seen[i] || m_edges[i].from < 0)
+			continue;
+
+		const int face = m_edges[i].face;
+		bool sameFace = face >= 0 && face < m_faceCount;
+		double twiceArea = 0.0;
+		double magnitude = 0.0;
+		int current = i;
+
+		// Relative to the cycle's first vertex, as the rooms' areas.
+		const Vec2& o = m_nodes[m_edges[i].from].pos;
+
+		do
+		{
+			const HalfEdge& e = m_edges[current];
+			const Vec2 p(m_nodes[e.from].pos.x - o.x, m_nodes[e.from].pos.y - o.y);
+			const Vec2 q(m_nodes[e.to].pos.x - o.x, m_nodes[e.to].pos.y - o.y);
+
+			seen[current] = 1;
+			if (e.face != face)
+				sameFace = false;
+
+			twiceArea += p.x * q.y - q.x * p.y;
+			magnitude += std::fabs(p.x * q.y) + std::fabs(q.x * p.y);
+
+			current = e.next;
+		}
+		while (current != i);
+
+		++result.faces;
+
+		const int c = component[m_edges[i].from];
+		++faces[c];
+		rounding[c] += magnitude;
+
+		if (twiceArea > 0.0)
+			ccwArea[c] += 0.5 * twiceArea;
+		else
+			cwArea[c] -= 0.5 * twiceArea;
+
+		if (!sameFace || faceSeen[face])
+		{
+			++result.badFaces;
+			continue;
+		}
+
+		faceSeen[face] = 1;
+		faceArea[face] = 0.5 * twiceArea;
+		faceRounding[face] = magnitude;
+	}
+
+	// Sums of products of coordinates lose up to about their magnitude
+	// times a few epsilons each.
+	for (int c = 0; c < result.components; ++c)
+	{
+		if (vertices[c] - halfEdges[c] / 2 + faces[c] != 2)
+			++result.badEuler;
+
+		if (std::fabs(ccwArea[c] - cwArea[c]) > 1e-12 + 16.0 * DBL_EPSILON * rounding[c])
+			++result.badArea;
+	}
+
+	// 4) Rooms against the faces they were walked from.
+	for (size_t r = 0; r < m_rooms.size(); ++r)
+	{
+		const int face = r < m_roomFace.size() ? m_roomFace[r] : -1;
+
+		if (face < 0 || face >= m_faceCount || m_faceRoom[face] != static_cast<int>(r)
+			|| !faceSeen[face] || faceArea[face] <= 0.0
+			|| std::fabs(m_rooms[r].area - faceArea[face]) > 1e-12 + 16.0 * DBL_EPSILON * faceRounding[face])
+		{
+			++result.badRooms;
+		}
+	}
+
+	return result.ok();
+}
+
+// Snap the point to a discrete grid, and reuse existing node if possible.
+// This is enough for typical CAD coordinates that are already consistent.
+int RoomGraph::findOrCreateNode(const Vec2& p)
+{
+	const int ix = static_cast<int>(std::floor(p.x / m_snapSize + 0.5));
+	const int iy = static_cast<int>(std::floor(p.y / m_snapSize + 0.5));
+	GridKey key(ix, iy);
+
+	std::map<GridKey, int>::iterator it = m_nodeIndex.find(key);
+	if (it != m_nodeIndex.end())
+	{
+		return it->second;
+	}
+
+	Node node;
+	node.id = static_cast<int>(m_nodes.size());
+	node.pos = p;
+
+	m_nodes.push_back(node);
+	m_nodeIndex.insert(std::make_pair(key, node.id));
+	reuseEdgeList(m_nodes.back());
+
+	return node.id;
+}
+
+// Fewer items than this per build step are not worth starting threads.
+static const size_t kParallelMinimum = 16384;
+
+struct RoomGraph::BuildSlice : public Runnable
+{
+	RoomGraph*        graph;
+	int               step;
+	const Segment*    segments;
+	int               begin;
+	int               middle;
+	int               end;
+	PredicateCounters predicates;
+
+	void run()
+	{
+		int i;
+
+		switch (step)
+		{
+		case SliceKeys:
+			graph->makeEndpointKeys(segments, begin, end);
+			break;
+
+		case SliceSortKeys:
+			std::sort(graph->m_endpointKeys.begin() + begin, graph->m_endpointKeys.begin() + end);
+			break;
+
+		case SliceMergeKeys:
+			std::merge(graph->m_endpointKeys.begin() + begin, graph->m_endpointKeys.begin() + middle,
+				graph->m_endpointKeys.begin() + middle, graph->m_endpointKeys.begin() + end,
+				graph->m_mergedKeys.begin() + begin);
+			break;
+
+		case SliceOrder:
+			for (i = begin; i < end; ++i)
+				graph->sortOutgoingAt(i, &predicates);
+			break;
+
+		case SliceLink:
+			for (i = begin; i < end; ++i)
+				graph->linkNextAt(i);
+			break;
+		}
+	}
+};
+
+// Threads for a step over items elements: 1 when the step is too small.
+int RoomGraph::buildThreads(size_t items) const
+{
+	if (items < kParallelMinimum)
+		return 1;
+
+	if (m_stats.plan.threads > 0)
+		return m_stats.plan.threads;
+
+	return m_options.threads > 0 ? m_options.threads : hardwareThreadCount();
+}
+
+// Run a step on threads equal slices of [0, count). Node steps get more
+// slices than threads, as the edges are spread unevenly over the nodes.
+void RoomGraph::runSlices(int step, const Segment* segments, int count, int threads)
+{
+	const int sliceCount = step == SliceKeys ? threads : 4 * threads;
+
+	std::vector<BuildSlice> slices(sliceCount);
+	std::vector<Runnable*> tasks(sliceCount);
+	int k;
+
+	for (k = 0; k < sliceCount; ++k)
+	{
+		slices[k].graph = this;
+		slices[k].step = step;
+		slices[k].segments = segments;
+		slices[k].begin = static_cast<int>(static_cast<double>(count) * k / sliceCount);
+		slices[k].end = static_cast<int>(static_cast<double>(count) * (k + 1) / sliceCount);
+		slices[k].middle = slices[k].end;
+		tasks[k] = &slices[k];
+	}
+
+	runParallel(tasks, threads);
+
+	for (k = 0; k < sliceCount; ++k)
+	{
+		m_stats.predicates.calls += slices[k].predicates.calls;
+		m_stats.predicates.fallbacks += slices[k].predicates.fallbacks;
+	}
+}
+
+void RoomGraph::buildNodesAndEdges(const Segment* segments, size_t count)
+{
+	if (m_options.externalMemoryBudget > 0 && buildNodesExternal(segments, count))
+		return;
+
+	if (m_stats.plan.strategy == StrategyMap)
+		buildNodesMapped(segments, count);
+	else
+		buildNodesSorted(segments, count);
+}
+
+// Node dedup through the map of findOrCreateNode(), one segment at a
+// time like an anytime build. No keys to fill and sort, which pays on
+// small inputs.
+void RoomGraph::buildNodesMapped(const Segment* segments, size_t count)
+{
+	m_nodes.reserve(2 * count);
+	m_edges.reserve(2 * count);
+
+	for (size_t i = 0; i < count; ++i)
+		addSegment(segments[i]);
+}
+
+// Node dedup by sorting the endpoint keys instead of a map: endpoints
+// with equal keys are adjacent, led by the one seen first, and nodes are
+// numbered in first-seen order, so the graph is the same as when adding
+// the segments one at a time.
+void RoomGraph::buildNodesSorted(const Segment* segments, size_t count)
+{
+	const int endpointCount = static_cast<int>(2 * count);
+	const int threads = buildThreads(endpointCount);
+	int e;
+
+	m_endpointKeys.resize(endpointCount);
+	m_endpointNode.resize(endpointCount);
+
+	if (threads > 1)
+	{
+		runSlices(SliceKeys, segments, endpointCount, threads);
+		sortEndpointKeys(threads);
+	}
+	else
+	{
+		makeEndpointKeys(segments, 0, endpointCount);
+		std::sort(m_endpointKeys.begin(), m_endpointKeys.end());
+	}
+
+	// Each endpoint points at the leader of its key first ...
+	int leader = -1;
+	for (size_t k = 0; k < m_endpointKeys.size(); ++k)
+	{
+		if (k == 0 || m_endpointKeys[k - 1].key < m_endpointKeys[k].key)
+			leader = m_endpointKeys[k].endpoint;
+
+		m_endpointNode[m_endpointKeys[k].endpoint] = leader;
+	}
+
+	// ... then at its node. Leaders come before the rest of their key,
+	// so their entry already holds the node when the others read it.
+	m_nodes.reserve(endpointCount);
+	m_edges.reserve(endpointCount);
+
+	for (e = 0; e < endpointCount; ++e)
+	{
+		if (m_endpointNode[e] == e)
+		{
+			Node node;
+			node.id = static_cast<int>(m_nodes.size());
+			node.pos = (e & 1) ? segments[e / 2].b : segments[e / 2].a;
+
+			m_nodes.push_back(node);
+			reuseEdgeList(m_nodes.back());
+			m_endpointNode[e] = node.id;
+		}
+		else
+		{
+			m_endpointNode[e] = m_endpointNode[m_endpointNode[e]];
+		}
+	}
+
+	for (size_t i = 0; i < count; ++i)
+		addEdgePair(m_endpointNode[2 * i], m_endpointNode[2 * i + 1]);
+}
+
+void RoomGraph::makeEndpointKeys(const Segment* segments, int begin, int end)
+{
+	for (int e = begin; e < end; ++e)
+	{
+		const Vec2& p = (e & 1) ? segments[e / 2].b : segments[e / 2].a;
+
+		EndpointKey& k = m_endpointKeys[e];
+		k.key.ix = static_cast<int>(std::floor(p.x / m_snapSize + 0.5));
+		k.key.iy = static_cast<int>(std::floor(p.y / m_snapSize + 0.5));
+		k.endpoint = e;
+	}
+}
+
+// Sort one run per thread, then merge neighbouring runs in rounds. Keys
+// are unique (the endpoint breaks ties), so the order is the same as
+// that of one std::sort.
+void RoomGraph::sortEndpointKeys(int threads)
+{
+	const int count = static_cast<int>(m_endpointKeys.size());
+
+	std::vector<int> bounds(threads + 1);
+	for (int t = 0; t <= threads; ++t)
+		bounds[t] = static_cast<int>(static_cast<double>(count) * t / threads);
+
+	std::vector<BuildSlice> slices(threads);
+	std::vector<Runnable*> tasks(threads);
+	size_t k;
+
+	for (k = 0; k < slices.size(); ++k)
+	{
+		slices[k].graph = this;
+		slices[k].step = SliceSortKeys;
+		slices[k].segments = NULL;
+		slices[k].begin = bounds[k];
+		slices[k].middle = bounds[k + 1];
+		slices[k].end = bounds[k + 1];
+		tasks[k] = &slices[k];
+	}
+
+	runParallel(tasks, threads);
+
+	m_mergedKeys.resize(count);
+
+	while (bounds.size() > 2)
+	{
+		// Pairs of runs; an odd last run is merged with nothing, a copy.
+		std::vector<int> merged;
+		slices.clear();
+
+		for (k = 0; k + 1 < bounds.size(); k += 2)
+		{
+			BuildSlice slice;
+			slice.graph = this;
+			slice.step = SliceMergeKeys;
+			slice.segments = NULL;
+			slice.begin = bounds[k];
+			slice.middle = bounds[k + 1];
+			slice.end = k + 2 < bounds.size() ? bounds[k + 2] : bounds[k + 1];
+			slices.push_back(slice);
+
+			merged.push_back(slice.begin);
+		}
+		merged.push_back(count);
+
+		tasks.resize(slices.size());
+		for (k = 0; k < slices.size(); ++k)
+			tasks[k] = &slices[k];
+
+		runParallel(tasks, threads);
+
+		m_endpointKeys.swap(m_mergedKeys);
+		bounds.swap(merged);
+	}
+}
+
+void RoomGraph::reuseEdgeList(Node& node)
+{
+	if (node.id < static_cast<int>(m_spareEdgeLists.size()))
+		node.outgoingEdges.swap(m_spareEdgeLists[node.id]);
+}
+
+// Rekeys endpoint records merged in cell order by the node they join:
+// the first endpoint of their cell, which holds the smallest endpoint
+// index. Sorting the rekeyed records again lists the nodes in the order
+// the in-memory build creates them.
+class NodeKeyWriter : public EndpointVisitor
+{
+public:
+	explicit NodeKeyWriter(ExternalEndpointSort& output)
+		: m_output(output),
+		m_first(),
+		m_failed(false)
+	{
+		m_first.endpoint = static_cast<size_t>(-1);
+	}
+
+	virtual void visit(const EndpointRecord& record)
+	{
+		if (m_first.endpoint == static_cast<size_t>(-1) ||
+			record.ix != m_first.ix || record.iy != m_first.iy)
+			m_first = record;
+
+		EndpointRecord keyed;
+		keyed.ix = static_cast<int>(m_first.endpoint);
+		keyed.iy = 0;
+		keyed.endpoint = record.endpoint;
+		keyed.x = m_first.x;
+		keyed.y = m_first.y;
+
+		if (!m_output.add(keyed))
+			m_failed = true;
+	}
+
+	bool failed() const { return m_failed; }
+
+private:
+	ExternalEndpointSort& m_output;
+	EndpointRecord        m_first;
+	bool                  m_failed;
+};
+
+// Numbers the nodes from the rekeyed records and parks the node of each
+// endpoint in the edge slot of its segment: from for a, to for b.
+class RoomGraph::NodeNumbering : public EndpointVisitor
+{
+public:
+	explicit NodeNumbering(RoomGraph& graph)
+		: m_graph(graph),
+		m_key(-1)
+	{
+	}
+
+	virtual void visit(const EndpointRecord& record)
+	{
+		std::vector<Node>& nodes = m_graph.m_nodes;
+
+		if (record.ix != m_key)
+		{
+			m_key = record.ix;
+
+			Node node;
+			node.id = static_cast<int>(nodes.size());
+			node.pos = Vec2(record.x, record.y);
+			nodes.push_back(node);
+		}
+
+		HalfEdge& slot = m_graph.m_edges[record.endpoint - record.endpoint % 2];
+		const int id = static_cast<int>(nodes.size()) - 1;
+
+		if (record.endpoint % 2 == 0)
+			slot.from = id;
+		else
+			slot.to = id;
+	}
+
+private:
+	RoomGraph& m_graph;
+	int        m_key;
+};
+
+// Step 1) without the node index. Endpoint keys are sorted on disk by
+// cell, rekeyed by the first endpoint of their cell and sorted again,
+// which gives the node ids and positions of the in-memory build without
+// any per-endpoint array: the nodes of segment i are parked in edge slot
+// 2 * i, and the edges are then added in segment order over the slots.
+// Returns false on an I/O error, leaving the graph empty.
+bool RoomGraph::buildNodesExternal(const Segment* segments, size_t count)
+{
+	const size_t budget = m_options.externalMemoryBudget / 2;
+
+	m_edges.resize(2 * count);
+
+	{
+		ExternalEndpointSort byNode(budget, m_options.tempDirectory);
+
+		{
+			ExternalEndpointSort byCell(budget, m_options.tempDirectory);
+
+			for (size_t i = 0; i < count; ++i)
+			{
+				for (int side = 0; side < 2; ++side)
+				{
+					const Vec2& p = side == 0 ? segments[i].a : segments[i].b;
+
+					EndpointRecord record;
+					record.ix = static_cast<int>(std::floor(p.x / m_snapSize + 0.5));
+					record.iy = static_cast<int>(std::floor(p.y / m_snapSize + 0.5));
+					record.endpoint = 2 * i + side;
+					record.x = p.x;
+					record.y = p.y;
+
+					if (!byCell.add(record))
+					{
+						m_edges.clear();
+						return false;
+					}
+				}
+			}
+
+			NodeKeyWriter writer(byNode);
+			if (!byCell.merge(writer) || writer.failed())
+			{
+				m_edges.clear();
+				return false;
+			}
+		}
+
+		NodeNumbering numbering(*this);
+		if (!byNode.merge(numbering))
+		{
+			m_nodes.clear();
+			m_edges.clear();
+			return false;
+		}
+	}
+
+	// Pair i never lands behind slot 2 * i, so each slot is read before
+	// it is overwritten.
+	size_t kept = 0;
+
+	for (size_t i = 0; i < count; ++i)
+	{
+		const int a = m_edges[2 * i].from;
+		const int b = m_edges[2 * i].to;
+
+		if (a == b)
+			continue;
+
+		makeEdgePair(static_cast<int>(kept), a, b, m_edges[kept], m_edges[kept + 1]);
+		kept += 2;
+	}
+
+	m_edges.resize(kept);
+	return true;
+}
+
+// Add one segment as a pair of twin half-edges.
+void RoomGraph::addSegment(const Segment& s)
+{
+	// In this order: a node is placed at the first point of its cell.
+	const int a = findOrCreateNode(s.a);
+	const int b = findOrCreateNode(s.b);
+
+	addEdgePair(a, b);
+}
+
+void RoomGraph::addEdgePair(int a, int b)
+{
+	if (a == b)
+		return;
+
+	const int id = static_cast<int>(m_edges.size());
+	m_edges.resize(id + 2);
+
+	makeEdgePair(id, a, b, m_edges[id], m_edges[id + 1]);
+}
+
+// Fills the twin half-edges id (a to b) and id + 1 (b to a) and lists
+// them at their nodes.
+void RoomGraph::makeEdgePair(int id, int a, int b, HalfEdge& e1, HalfEdge& e2)
+{
+	e1 = HalfEdge();
+	e2 = HalfEdge();
+
+	e1.id = id;
+	e1.from = a;
+	e1.to = b;
+
+	e2.id = id + 1;
+	e2.from = b;
+	e2.to = a;
+
+	e1.twin = e2.id;
+	e2.twin = e1.id;
+
+	m_nodes[a].outgoingEdges.push_back(e1.id);
+	m_nodes[b].outgoingEdges.push_back(e2.id);
+}
+
+// Compare two edge indices by their direction angle.
+// The order is decided from the node coordinates with exact predicates,
+// so nearly collinear edges are never ordered inconsistently. Edges with
+// the same direction (duplicated or overlapping walls) fall back to their
+// pair index, ascending when they point right or straight up and
+// descending otherwise. The two ends of a duplicated wall see it in
+// opposite directions, so they agree on the order and the faces between
+// the copies stay closed; and as the rule only depends on the direction,
+// the order stays strict when the walls end at different nodes.
+bool RoomGraph::EdgeAngleLess::operator()(int e1, int e2) const
+{
+	const HalfEdge& h1 = graph->m_edges[e1];
+	const HalfEdge& h2 = graph->m_edges[e2];
+
+	const int cmp = compareDirections(graph->m_nodes[h1.from].pos,
+		graph->m_nodes[h1.to].pos, graph->m_nodes[h2.to].pos, counters);
+
+	if (cmp != 0)
+		return cmp < 0;
+
+	const int pair1 = std::min(e1, h1.twin);
+	const int pair2 = std::min(e2, h2.twin);
+
+	if (pair1 == pair2)
+		return e1 < e2;
+
+	const Vec2& from = graph->m_nodes[h1.from].pos;
+	const Vec2& to = graph->m_nodes[h1.to].pos;
+	const bool ascending = to.x > from.x || (to.x == from.x && to.y > from.y);
+
+	return ascending ? pair1 < pair2 : pair1 > pair2;
+}
+
+// For each node, sort outgoing half-edges by angle.
+// This gives a consistent circular ordering around the point.
+void RoomGraph::sortOutgoingByAngle()
+{
+	const int threads = buildThreads(m_nodes.size());
+
+	if (threads > 1)
+	{
+		runSlices(SliceOrder, NULL, static_cast<int>(m_nodes.size()), threads);
+		return;
+	}
+
+	for (size_t i = 0; i < m_nodes.size(); ++i)
+		sortOutgoingAt(static_cast<int>(i), &m_stats.predicates);
+}
+
+// counters receives the orientation tests, so that threads sorting
+// different nodes do not share them.
+void RoomGraph::sortOutgoingAt(int nodeId, PredicateCounters* counters)
+{
+	std::vector<int>& out = m_nodes[nodeId].outgoingEdges;
+
+	if (out.size() <= 1)
+		return;
+
+	EdgeAngleLess cmp(this, counters);
+	std::sort(out.begin(), out.end(), cmp);
+}
+
+
+// For a given half-edge e: from A to B,
+// we stand at B and take the twin(e) as reference,
+// then pick the previous edge in the sorted order (turning "right").
+// That edge becomes e.next when walking along a face.
+// Linked node by node, so no twin has to be searched for.
+void RoomGraph::buildNextRelations()
+{
+	const int threads = buildThreads(m_nodes.size());
+
+	if (threads > 1)
+	{
+		runSlices(SliceLink, NULL, static_cast<int>(m_nodes.size()), threads);
+		return;
+	}
+
+	for (size_t i = 0; i < m_nodes.size(); ++i)
+		linkNextAt(static_cast<int>(i));
+}
+
+// The edges arriving at a node are the twins of its outgoing edges: the
+// twin of out[k] continues with out[k - 1]. Linear in the degree, where
+// linkNext() on every arriving edge would be quadratic.
+void RoomGraph::linkNextAt(int nodeId)
+{
+	const std::vector<int>& out = m_nodes[nodeId].outgoingEdges;
+	const size_t n = out.size();
+
+	for (size_t k = 0; k < n; ++k)
+		m_edges[m_edges[out[k]].twin].next = out[(k + n - 1) % n];
+}
+
+void RoomGraph::linkNext(int edgeId)
+{
+	HalfEdge& e = m_edges[edgeId];
+	const int toNode = e.to;
+
+	if (toNode < 0 || toNode >= static_cast<int>(m_nodes.size()))
+		return;
+
+	const Node& node = m_nodes[toNode];
+	const std::vector<int>& out = node.outgoingEdges;
+
+	if (out.empty())
+		return;
+
+	const int twinId = e.twin;
+	int pos = -1;
+
+	for (size_t k = 0; k < out.size(); ++k)
+	{
+		if (out[k] == twinId)
+		{
+			pos = static_cast<int>(k);
+			break;
+		}
+	}
+
+	if (pos < 0)
+		return;
+
+	const int n = static_cast<int>(out.size());
+	const int nextPos = (pos - 1 + n) % n;
+
+	e.next = out[nextPos];
+}
+
+// Relative to the first vertex: on large coordinates the products of
+// absolute ones round by more than the area of a small room.
+double RoomGraph::computeSignedArea(const std::vector<Vec2>& poly) const
+{
+	if (poly.size() < 3)
+		return 0.0;
+
+	double area = 0.0;
+	const size_t n = poly.size();
+	const Vec2& o = poly[0];
+
+	for (size_t i = 0; i < n; ++i)
+	{
+		const Vec2& p = poly[i];
+		const Vec2& q = poly[(i + 1) % n];
+		area += (p.x - o.x) * (q.y - o.y) - (q.x - o.x) * (p.y - o.y);
+	}
+
+	return 0.5 * area;
+}
+
+// A face is degenerate when all its vertices lie on one line. Rounding
+// can give such slivers a non-zero area on large coordinates. Real rooms
+// usually fail the test at the first vertex, so this is cheap.
+bool RoomGraph::isDegenerateFace(const std::vector<Vec2>& poly)
+{
+	for (size_t i = 2; i < poly.size(); ++i)
+	{
+		if (!isCollinear(poly[0], poly[1], poly[i], &m_stats.predicates))
+			return false;
+	}
+
+	return true;
+}
+
+// Standard polygon centroid (area-weighted), relative to the first
+// vertex like computeSignedArea().
+Vec2 RoomGraph::computeCentroid(const std::vector<Vec2>& poly, double signedArea) const
+{
+	Vec2 c(0.0, 0.0);
+
+	if (poly.size() < 3)
+		return c;
+
+	const size_t n = poly.size();
+	const double factor = 1.0 / (6.0 * signedArea);
+	const Vec2& o = poly[0];
+
+	double cx = 0.0;
+	double cy = 0.0;
+
+	for (size_t i = 0; i < n; ++i)
+	{
+		const Vec2 p(poly[i].x - o.x, poly[i].y - o.y);
+		const Vec2 q(poly[(i + 1) % n].x - o.x, poly[(i + 1) % n].y - o.y);
+
+		const double cross = p.x * q.y - q.x * p.y;
+		cx += (p.x + q.x) * cross;
+		cy += (p.y + q.y) * cross;
+	}
+
+	c.x = o.x + cx * factor;
+	c.y = o.y + cy * factor;
+
+	return c;
+}
+
+// Walk all half-edges and try to follow e.next until we return
+// to the starting edge. Each closed loop becomes a Room.
+// Only counter-clockwise faces with positive area are kept.
+void RoomGraph::walkCycles()
+{
+	const int edgeCount = static_cast<int>(m_edges.size());
+
+	for (int i = 0; i < edgeCount; ++i)
+		walkCycleFrom(i);
+}
+
+void RoomGraph::walkCycleFrom(int startId)
+{
+	HalfEdge& start = m_edges[startId];
+	if (start.used)
+		return;
+
+	// Every walked cycle is a face, whether or not it becomes a room.
+	const int faceId = m_faceCount++;
+	m_faceRoom.push_back(-1);
+
+	std::vector<Vec2>& poly = m_walkPolygon;
+	poly.clear();
+
+	int currentId = start.id;
+
+	while (true)
+	{
+		HalfEdge& e = m_edges[currentId];
+		if (e.used)
+			break;
+
+		e.used = true;
+		e.face = faceId;
+
+		const int fromNode = e.from;
+		if (fromNode < 0 || fromNode >= static_cast<int>(m_nodes.size()))
+			break;
+
+		poly.push_back(m_nodes[fromNode].pos);
+
+		if (e.next < 0)
+			break;
+
+		if (e.next == start.id)
+		{
+			// Closed loop detected, do not push start node again.
+			break;
+		}
+
+		currentId = e.next;
+	}
+
+	if (poly.size() < 3)
+	{
+		++m_stats.degenerateFaces;
+		return;
+	}
+
+
+	double signedArea = computeSignedArea(poly);
+	if (std::fabs(signedArea) < 1e-6 || isDegenerateFace(poly))
+	{
+		++m_stats.degenerateFaces;
+		return;
+	}
+
+	// Keep only CCW faces as "rooms".
+	if (signedArea <= 0.0)
+	{
+		++m_stats.clockwiseFaces;
+		return;
+	}
+
+	const int roomId = static_cast<int>(m_rooms.size());
+	m_rooms.push_back(Room());
+
+	Room& room = m_rooms.back();
+	if (roomId < static_cast<int>(m_sparePolygons.size()))
+		room.polygon.swap(m_sparePolygons[roomId]);
+	room.polygon.assign(poly.begin(), poly.end());
+
+	// store positive area for display
+	room.area = std::fabs(signedArea);
+
+	// centroid needs the signed area
+	room.center = computeCentroid(poly, signedArea);
+
+	m_faceRoom[faceId] = roomId;
+	m_roomFace.push_back(faceId);
+}
+
+
+// Group nodes into connected components with a breadth-first search and
+// order the components by the distance of their bounds to the focus point.
+void RoomGraph::collectComponents()
+{
+	const int nodeCount = static_cast<int>(m_nodes.size());
+	std::vector<int> component(nodeCount, -1);
+	std::vector<double> distance;
+
+	m_componentNodes.reserve(nodeCount);
+
+	for (int seed = 0; seed < nodeCount; ++seed)
+	{
+		if (component[seed] >= 0 || m_nodes[seed].outgoingEdges.empty())
+			continue;
+
+		const int componentId = static_cast<int>(m_componentStart.size());
+		const size_t first = m_componentNodes.size();
+
+		m_componentStart.push_back(static_cast<int>(first));
+		m_componentNodes.push_back(seed);
+		component[seed] = componentId;
+
+		Vec2 lo = m_nodes[seed].pos;
+		Vec2 hi = m_nodes[seed].pos;
+
+		// The node list doubles as the search queue.
+		for (size_t k = first; k < m_componentNodes.size(); ++k)
+		{
+			const Node& node = m_nodes[m_componentNodes[k]];
+
+			lo.x = std::min(lo.x, node.pos.x);
+			lo.y = std::min(lo.y, node.pos.y);
+			hi.x = std::max(hi.x, node.pos.x);
+			hi.y = std::max(hi.y, node.pos.y);
+
+			for (size_t j = 0; j < node.outgoingEdges.size(); ++j)
+			{
+				const int to = m_edges[node.outgoingEdges[j]].to;
+				if (component[to] >= 0)
+					continue;
+
+				component[to] = componentId;
+				m_componentNodes.push_back(to);
+			}
+		}
+
+		// Squared distance from the focus to the bounding box, zero inside.
+		const double dx = std::max(0.0, std::max(lo.x - m_focus.x, m_focus.x - hi.x));
+		const double dy = std::max(0.0, std::max(lo.y - m_focus.y, m_focus.y - hi.y));
+		distance.push_back(dx * dx + dy * dy);
+	}
+
+	m_componentStart.push_back(static_cast<int>(m_componentNodes.size()));
+
+	m_componentOrder.resize(distance.size());
+	for (size_t c = 0; c < distance.size(); ++c)
+		m_componentOrder[c] = static_cast<int>(c);
+
+	ComponentDistanceLess cmp(&distance);
+	std::stable_sort(m_componentOrder.begin(), m_componentOrder.end(), cmp);
 }
 
-void RoomGraph::clear()
+bool RoomGraph::ComponentDistanceLess::operator()(int c1, int c2) const
 {
-	m_nodes.clear();
-	m_edges.clear();
-	m_rooms.clear();
-	m_nodeIndex.clear();
+	return (*distance)[c1] < (*distance)[c2];
 }
 
-const std::vector<RoomGraph::Room>& RoomGraph::getRooms() const
+// Run steps 2) to 4) of build() on a single component. Every node the
+// component's edges touch belongs to it, so the result is the same as
+// for the whole graph.
+void RoomGraph::processComponent(int componentId)
 {
-	return m_rooms;
+	const int first = m_componentStart[componentId];
+	const int last = m_componentStart[componentId + 1];
+	int k;
+
+	for (k = first; k < last; ++k)
+		sortOutgoingAt(m_componentNodes[k], &m_stats.predicates);
+
+	for (k = first; k < last; ++k)
+		linkNextAt(m_componentNodes[k]);
+
+	for (k = first; k < last; ++k)
+	{
+		const std::vector<int>& out = m_nodes[m_componentNodes[k]].outgoingEdges;
+		for (size_t j = 0; j < out.size(); ++j)
+			walkCycleFrom(out[j]);
+	}
 }
 
-void RoomGraph::build(const std::vector<Segment>& segments)
+
+// Node at the snapped position of p, or -1.
+int RoomGraph::findNode(const Vec2& p) const
 {
-	clear();
+	const int ix = static_cast<int>(std::floor(p.x / m_snapSize + 0.5));
+	const int iy = static_cast<int>(std::floor(p.y / m_snapSize + 0.5));
 
-	if (segments.empty())
-		return;
+	if (!m_nodeIndex.empty())
+	{
+		std::map<GridKey, int>::const_iterator it = m_nodeIndex.find(GridKey(ix, iy));
+		return it != m_nodeIndex.end() ? it->second : -1;
+	}
 
-	// 1) Build nodes and half-edges from raw segments.
-	buildNodesAndEdges(segments);
+	EndpointKey probe;
+	probe.key = GridKey(ix, iy);
+	probe.endpoint = -1;
 
-	// 2) Sort outgoing edges at each node by angle.
-	sortOutgoingByAngle();
+	std::vector<EndpointKey>::const_iterator it
+		= std::lower_bound(m_endpointKeys.begin(), m_endpointKeys.end(), probe);
 
-	// 3) For each half-edge, determine the "next" edge when walking a face.
-	buildNextRelations();
+	if (it == m_endpointKeys.end() || it->key.ix != ix || it->key.iy != iy)
+		return -1;
 
-	// 4) Walk all closed cycles and turn them into rooms.
-	walkCycles();
+	return m_endpointNode[it->endpoint];
 }
 
-// Snap the point to a discrete grid, and reuse existing node if possible.
-// This is enough for typical CAD coordinates that are already consistent.
-int RoomGraph::findOrCreateNode(const Vec2& p)
+// Drop a room; the last room takes its slot.
+void RoomGraph::removeRoom(int roomId)
 {
-	const int ix = static_cast<int>(std::floor(p.x / m_snapSize + 0.5));
-	const int iy = static_cast<int>(std::floor(p.y / m_snapSize + 0.5));
-	GridKey key(ix, iy);
+	const int last = static_cast<int>(m_rooms.size()) - 1;
 
-	std::map<GridKey, int>::iterator it = m_nodeIndex.find(key);
-	if (it != m_nodeIndex.end())
+	m_roomVersions.touch(roomId);
+	m_roomVersions.touch(last);
+	m_roomFaceVersions.touch(roomId);
+	m_roomFaceVersions.touch(last);
+	m_faceRoomVersions.touch(m_roomFace[roomId]);
+	m_faceRoomVersions.touch(m_roomFace[last]);
+
+	m_faceRoom[m_roomFace[roomId]] = -1;
+
+	if (roomId != last)
 	{
-		return it->second;
+		m_rooms[roomId].polygon.swap(m_rooms[last].polygon);
+		m_rooms[roomId].center = m_rooms[last].center;
+		m_rooms[roomId].area = m_rooms[last].area;
+
+		m_roomFace[roomId] = m_roomFace[last];
+		m_faceRoom[m_roomFace[roomId]] = roomId;
 	}
 
-	Node node;
-	node.id = static_cast<int>(m_nodes.size());
-	node.pos = p;
+	m_rooms.pop_back();
+	m_roomFace.pop_back();
+}
 
-	m_nodes.push_back(node);
-	m_nodeIndex.insert(std::make_pair(key, node.id));
+// Forget the face of edgeId: drop its room and mark its boundary as not
+// walked, so walkCycleFrom() can trace the new face after an edit.
+void RoomGraph::releaseFace(int edgeId)
+{
+	const int faceId = m_edges[edgeId].face;
 
-	return node.id;
+	if (faceId >= 0 && m_faceRoom[faceId] >= 0)
+		removeRoom(m_faceRoom[faceId]);
+
+	for (int current = edgeId; current >= 0 && m_edges[current].used; current = m_edges[current].next)
+	{
+		m_edgeVersions.touch(current);
+		m_edges[current].used = false;
+		m_edges[current].face = -1;
+	}
 }
 
-// Convert each input segment into two directed half-edges
-// and register them on the corresponding nodes.
-void RoomGraph::buildNodesAndEdges(const std::vector<Segment>& segments)
+// Merge the faces on both sides of the wall. With e = a->b and t its twin:
+// the edge entering a before e continues with the edge after t, and the
+// edge entering b before t continues with the edge after e. At a dead end
+// the predecessor is the twin itself and there is nothing to relink.
+bool RoomGraph::removeWall(const Vec2& a, const Vec2& b)
 {
-	m_nodes.reserve(segments.size() * 2);
-	m_edges.reserve(segments.size() * 2);
+	const int u = findNode(a);
+	const int v = findNode(b);
 
-	for (size_t i = 0; i < segments.size(); ++i)
-	{
-		const Segment& s = segments[i];
+	if (u < 0 || v < 0 || u == v || !isComplete())
+		return false;
 
-		int a = findOrCreateNode(s.a);
-		int b = findOrCreateNode(s.b);
+	int e = -1;
+	const std::vector<int>& outU = m_nodes[u].outgoingEdges;
+	for (size_t k = 0; k < outU.size(); ++k)
+	{
+		if (m_edges[outU[k]].to == v)
+		{
+			e = outU[k];
+			break;
+		}
+	}
 
-		if (a == b)
-			continue;
+	if (e < 0)
+		return false;
 
-		HalfEdge e1;
-		HalfEdge e2;
+	const int t = m_edges[e].twin;
 
-		e1.id = static_cast<int>(m_edges.size());
-		e1.from = a;
-		e1.to = b;
+	// The predecessor of an edge leaving a node is the twin of the next
+	// outgoing edge counter-clockwise (the inverse of linkNext()).
+	const std::vector<int>& outV = m_nodes[v].outgoingEdges;
 
-		e2.id = e1.id + 1;
-		e2.from = b;
-		e2.to = a;
+	const int posE = static_cast<int>(std::find(outU.begin(), outU.end(), e) - outU.begin());
+	const int posT = static_cast<int>(std::find(outV.begin(), outV.end(), t) - outV.begin());
 
-		e1.twin = e2.id;
-		e2.twin = e1.id;
+	const int prevE = m_edges[outU[(posE + 1) % outU.size()]].twin;
+	const int prevT = m_edges[outV[(posT + 1) % outV.size()]].twin;
 
-		const Vec2& pa = m_nodes[a].pos;
-		const Vec2& pb = m_nodes[b].pos;
+	releaseFace(e);
+	releaseFace(t);
 
-		// Direction angle at "from" node.
-		const double dx1 = pb.x - pa.x;
-		const double dy1 = pb.y - pa.y;
-		e1.angle = std::atan2(dy1, dx1);
+	m_edgeVersions.touch(prevE);
+	m_edgeVersions.touch(prevT);
+	m_edgeVersions.touch(e);
+	m_edgeVersions.touch(t);
+	m_nodeVersions.touch(u);
+	m_nodeVersions.touch(v);
 
-		const double dx2 = pa.x - pb.x;
-		const double dy2 = pa.y - pb.y;
-		e2.angle = std::atan2(dy2, dx2);
+	if (prevE != t)
+		m_edges[prevE].next = m_edges[t].next;
+	if (prevT != e)
+		m_edges[prevT].next = m_edges[e].next;
 
-		m_nodes[a].outgoingEdges.push_back(e1.id);
-		m_nodes[b].outgoingEdges.push_back(e2.id);
+	m_nodes[u].outgoingEdges.erase(m_nodes[u].outgoingEdges.begin() + posE);
+	m_nodes[v].outgoingEdges.erase(m_nodes[v].outgoingEdges.begin() + posT);
 
-		m_edges.push_back(e1);
-		m_edges.push_back(e2);
+	// Removed half-edges keep their slot, detached like a broken edge.
+	const int removed[2] = { e, t };
+	for (int k = 0; k < 2; ++k)
+	{
+		HalfEdge& h = m_edges[removed[k]];
+		h.from = -1;
+		h.to = -1;
+		h.next = -1;
+		h.face = -1;
+		h.used = true;
 	}
-}
 
-// For each node, sort outgoing half-edges by angle.
-// This gives a consistent circular ordering around the point.
-// Static compare function for sorting edges by angle.
-// VC6 does NOT support lambdas.
-// Compare two edge indices by their direction angle.
-bool RoomGraph::EdgeAngleLess::operator()(int e1, int e2) const
-{
-	return graph->m_edges[e1].angle < graph->m_edges[e2].angle;
+	m_overlayTags.clear();
+
+	if (prevE != t)
+		walkCycleFrom(prevE);
+	if (prevT != e)
+		walkCycleFrom(prevT);
+
+	return true;
 }
 
-// For each node, sort outgoing half-edges by angle.
-// This gives a consistent circular ordering around the point.
-void RoomGraph::sortOutgoingByAngle()
+// Split a face with a new edge pair. The new edges go into the angular
+// order at both nodes; the face is the one whose corner they fall into,
+// and it must be the same face at both ends.
+bool RoomGraph::insertWall(const Vec2& a, const Vec2& b)
 {
+	const int u = findNode(a);
+	const int v = findNode(b);
+
+	if (u < 0 || v < 0 || u == v || !isComplete())
+		return false;
+
+	if (m_nodes[u].outgoingEdges.empty() || m_nodes[v].outgoingEdges.empty())
+		return false;
+
+	const std::vector<int>& outU = m_nodes[u].outgoingEdges;
+	for (size_t k = 0; k < outU.size(); ++k)
+	{
+		if (m_edges[outU[k]].to == v)
+			return false;
+	}
+
+	m_nodeVersions.touch(u);
+	m_nodeVersions.touch(v);
+
+	const int edgeCount = static_cast<int>(m_edges.size());
+	addEdgePair(u, v);
+
+	const int h = edgeCount;
+	const int t = edgeCount + 1;
+
+	// addEdgePair() appended the new edges; move them to their angular slot.
 	EdgeAngleLess cmp(this);
+	int slot[2];
+	int corner[2];
+	const int node[2] = { u, v };
+	const int edge[2] = { h, t };
 
-	for (size_t i = 0; i < m_nodes.size(); ++i)
+	for (int k = 0; k < 2; ++k)
 	{
-		Node& node = m_nodes[i];
-		std::vector<int>& out = node.outgoingEdges;
+		std::vector<int>& out = m_nodes[node[k]].outgoingEdges;
+		out.pop_back();
 
-		if (out.size() <= 1)
-			continue;
+		slot[k] = static_cast<int>(std::upper_bound(out.begin(), out.end(), edge[k], cmp) - out.begin());
+		corner[k] = out[(slot[k] + out.size() - 1) % out.size()];
+	}
 
-		std::sort(out.begin(), out.end(), cmp);
+	const int face = m_edges[corner[0]].face;
+	if (face < 0 || face != m_edges[corner[1]].face)
+	{
+		m_edges.pop_back();
+		m_edges.pop_back();
+		return false;
 	}
-}
 
+	releaseFace(corner[0]);
 
-// For a given half-edge e: from A to B,
-// we stand at B and take the twin(e) as reference,
-// then pick the previous edge in the sorted order (turning "right").
-// That edge becomes e.next when walking along a face.
-void RoomGraph::buildNextRelations()
-{
-	for (size_t i = 0; i < m_edges.size(); ++i)
+	for (int k = 0; k < 2; ++k)
 	{
-		HalfEdge& e = m_edges[i];
-		const int toNode = e.to;
+		std::vector<int>& out = m_nodes[node[k]].outgoingEdges;
+		out.insert(out.begin() + slot[k], edge[k]);
+	}
 
-		if (toNode < 0 || toNode >= static_cast<int>(m_nodes.size()))
-			continue;
+	// Edges entering u and v just before the new ones change their next.
+	for (int k = 0; k < 2; ++k)
+	{
+		const std::vector<int>& out = m_nodes[node[k]].outgoingEdges;
+		const int before = m_edges[out[(slot[k] + 1) % out.size()]].twin;
 
-		const Node& node = m_nodes[toNode];
-		const std::vector<int>& out = node.outgoingEdges;
+		m_edgeVersions.touch(before);
+		linkNext(before);
+		linkNext(m_edges[edge[k]].twin);
+	}
 
-		if (out.empty())
-			continue;
+	m_overlayTags.clear();
 
-		const int twinId = e.twin;
-		int pos = -1;
+	walkCycleFrom(h);
+	walkCycleFrom(t);
 
-		for (size_t k = 0; k < out.size(); ++k)
-		{
-			if (out[k] == twinId)
-			{
-				pos = static_cast<int>(k);
-				break;
-			}
-		}
+	return true;
+}
 
-		if (pos < 0)
-			continue;
+int RoomGraph::commitVersion()
+{
+	if (!isComplete())
+		return -1;
+
+	// All arrays commit together, so they agree on the version id.
+	m_nodeVersions.commit(m_nodes);
+	m_edgeVersions.commit(m_edges);
+	m_roomVersions.commit(m_rooms);
+	m_faceRoomVersions.commit(m_faceRoom);
+	m_roomFaceVersions.commit(m_roomFace);
+	m_versionFaceCount.push_back(m_faceCount);
+
+	return static_cast<int>(m_versionFaceCount.size()) - 1;
+}
+
+bool RoomGraph::checkoutVersion(int version)
+{
+	if (!isComplete() || !m_nodeVersions.isAlive(version))
+		return false;
+
+	m_nodeVersions.checkout(version, m_nodes);
+	m_edgeVersions.checkout(version, m_edges);
+	m_roomVersions.checkout(version, m_rooms);
+	m_faceRoomVersions.checkout(version, m_faceRoom);
+	m_roomFaceVersions.checkout(version, m_roomFace);
+	m_faceCount = m_versionFaceCount[version];
 
-		const int n = static_cast<int>(out.size());
-		const int nextPos = (pos - 1 + n) % n;
+	m_overlayTags.clear();
 
-		e.next = out[nextPos];
+	return true;
+}
+
+void RoomGraph::releaseVersion(int version)
+{
+	m_nodeVersions.release(version);
+	m_edgeVersions.release(version);
+	m_roomVersions.release(version);
+	m_faceRoomVersions.release(version);
+	m_roomFaceVersions.release(version);
+}
+
+// Union-find over face ids, used to group overlay faces.
+static int findGroup(std::vector<int>& group, int f)
+{
+	while (group[f] != f)
+	{
+		group[f] = group[group[f]];
+		f = group[f];
 	}
+	return f;
 }
 
-double RoomGraph::computeSignedArea(const std::vector<Vec2>& poly) const
+static void uniteGroups(std::vector<int>& group, int f1, int f2)
 {
-	if (poly.size() < 3)
-		return 0.0;
+	f1 = findGroup(group, f1);
+	f2 = findGroup(group, f2);
+	if (f1 != f2)
+		group[std::max(f1, f2)] = std::min(f1, f2);
+}
 
-	double area = 0.0;
+// A point just left of the first edge, inside a counter-clockwise polygon.
+static Vec2 interiorPoint(const std::vector<Vec2>& poly)
+{
+	const Vec2& p = poly[0];
+	const Vec2& q = poly[1];
+	const double shift = 1e-3;
+
+	return Vec2(0.5 * (p.x + q.x) - shift * (q.y - p.y),
+		0.5 * (p.y + q.y) + shift * (q.x - p.x));
+}
+
+static bool containsPoint(const std::vector<Vec2>& poly, const Vec2& p)
+{
+	bool inside = false;
 	const size_t n = poly.size();
 
-	for (size_t i = 0; i < n; ++i)
+	for (size_t i = 0, j = n - 1; i < n; j = i++)
 	{
-		const Vec2& p = poly[i];
-		const Vec2& q = poly[(i + 1) % n];
-		area += p.x * q.y - q.x * p.y;
+		const Vec2& a = poly[i];
+		const Vec2& b = poly[j];
+
+		if ((a.y > p.y) != (b.y > p.y)
+			&& p.x < (b.x - a.x) * (p.y - a.y) / (b.y - a.y) + a.x)
+		{
+			inside = !inside;
+		}
 	}
 
-	return 0.5 * area;
+	return inside;
 }
 
-// Standard polygon centroid (area-weighted).
-Vec2 RoomGraph::computeCentroid(const std::vector<Vec2>& poly, double signedArea) const
+void RoomGraph::overlay(const std::vector<Segment>& a, const std::vector<Segment>& b)
 {
-	Vec2 c(0.0, 0.0);
+	clear();
 
-	if (poly.size() < 3)
-		return c;
+	// 1) Node both layouts together. Each piece knows its source segment,
+	// and sources below a.size() belong to layout A.
+	std::vector<Segment> all;
+	all.reserve(a.size() + b.size());
+	all.insert(all.end(), a.begin(), a.end());
+	all.insert(all.end(), b.begin(), b.end());
 
-	const size_t n = poly.size();
-	const double factor = 1.0 / (6.0 * signedArea);
+	std::vector<SnappedSegment> pieces;
+	m_stats.unnodedPieces = snapRoundPieces(all, m_snapSize, pieces);
 
-	double cx = 0.0;
-	double cy = 0.0;
+	m_nodes.reserve(pieces.size());
+	m_edges.reserve(pieces.size() * 2);
+	m_edgeLayers.reserve(pieces.size() * 2);
 
-	for (size_t i = 0; i < n; ++i)
+	// 2) One edge pair per distinct piece, tagged with the layouts using it.
+	// Equal pieces are adjacent, since pieces come sorted by endpoints.
+	const int countA = static_cast<int>(a.size());
+	size_t k = 0;
+
+	while (k < pieces.size())
 	{
-		const Vec2& p = poly[i];
-		const Vec2& q = poly[(i + 1) % n];
+		const SnappedSegment& piece = pieces[k];
+		unsigned char layers = 0;
 
-		const double cross = p.x * q.y - q.x * p.y;
-		cx += (p.x + q.x) * cross;
-		cy += (p.y + q.y) * cross;
+		for (; k < pieces.size(); ++k)
+		{
+			const SnappedSegment& other = pieces[k];
+			if (other.ax != piece.ax || other.ay != piece.ay || other.bx != piece.bx || other.by != piece.by)
+				break;
+
+			layers |= (other.source < countA) ? 1 : 2;
+		}
+
+		const size_t edgeCount = m_edges.size();
+		addSegment(Segment(Vec2(piece.ax * m_snapSize, piece.ay * m_snapSize),
+			Vec2(piece.bx * m_snapSize, piece.by * m_snapSize)));
+
+		if (m_edges.size() != edgeCount)
+		{
+			m_edgeLayers.push_back(layers);
+			m_edgeLayers.push_back(layers);
+		}
 	}
 
-	c.x = cx * factor;
-	c.y = cy * factor;
+	// 3) Faces of the combined graph, as in build().
+	sortOutgoingByAngle();
+	buildNextRelations();
+	walkCycles();
 
-	return c;
+	// 4) Each layout's own rooms, and the ones every overlay room lies in.
+	m_overlayTags.resize(m_rooms.size());
+
+	std::vector<int> edgeRoom;
+	for (int layer = 0; layer < 2; ++layer)
+	{
+		walkLayerFaces(layer, edgeRoom);
+		labelOverlay(layer, edgeRoom);
+	}
+
+	m_phase = PhaseDone;
 }
 
-// Walk all half-edges and try to follow e.next until we return
-// to the starting edge. Each closed loop becomes a Room.
-// Only counter-clockwise faces with positive area are kept.
-void RoomGraph::walkCycles()
+const std::vector<RoomGraph::OverlayTag>& RoomGraph::getOverlayTags() const
+{
+	return m_overlayTags;
+}
+
+const std::vector<RoomGraph::Room>& RoomGraph::getLayerRooms(int layer) const
+{
+	return m_layerRooms[layer];
+}
+
+// Faces of one layout on its own. "next" is relinked over that layout's
+// edges only, passing over the other layout's edges around each node.
+// edgeRoom receives, per half-edge, the layout room on its left or -1.
+void RoomGraph::walkLayerFaces(int layer, std::vector<int>& edgeRoom)
 {
+	const unsigned char bit = static_cast<unsigned char>(1 << layer);
 	const int edgeCount = static_cast<int>(m_edges.size());
+	std::vector<int> next(edgeCount, -1);
+	int i;
 
-	for (int i = 0; i < edgeCount; ++i)
+	// Same turn as linkNextAt(), over this layout's edges: the twin of an
+	// outgoing edge continues with the layout's edge before it, wrapping
+	// around to the last one (the edge itself when it is the only one).
+	for (size_t node = 0; node < m_nodes.size(); ++node)
 	{
-		HalfEdge& start = m_edges[i];
-		if (start.used)
-			continue;
+		const std::vector<int>& out = m_nodes[node].outgoingEdges;
+		int previous = -1;
+		size_t k;
 
-		std::vector<Vec2> poly;
-		int currentId = start.id;
-
-		while (true)
+		for (k = 0; k < out.size(); ++k)
 		{
-			HalfEdge& e = m_edges[currentId];
-			if (e.used)
-				break;
+			if (m_edgeLayers[out[k]] & bit)
+				previous = out[k];
+		}
 
-			e.used = true;
+		for (k = 0; k < out.size(); ++k)
+		{
+			if (!(m_edgeLayers[out[k]] & bit))
+				continue;
 
-			const int fromNode = e.from;
-			if (fromNode < 0 || fromNode >= static_cast<int>(m_nodes.size()))
-				break;
+			next[m_edges[out[k]].twin] = previous;
+			previous = out[k];
+		}
+	}
 
-			poly.push_back(m_nodes[fromNode].pos);
+	edgeRoom.assign(edgeCount, -1);
+	std::vector<char> seen(edgeCount, 0);
+	std::vector<int> cycle;
+	std::vector<Vec2> poly;
 
-			if (e.next < 0)
-				break;
+	for (i = 0; i < edgeCount; ++i)
+	{
+		if (!(m_edgeLayers[i] & bit) || seen[i])
+			continue;
 
-			if (e.next == start.id)
-			{
-				// Closed loop detected, do not push start node again.
-				break;
-			}
+		cycle.clear();
+		poly.clear();
 
-			currentId = e.next;
+		for (int current = i; current >= 0 && !seen[current]; current = next[current])
+		{
+			seen[current] = 1;
+			cycle.push_back(current);
+			poly.push_back(m_nodes[m_edges[current].from].pos);
 		}
 
 		if (poly.size() < 3)
 			continue;
 
-
-		double signedArea = computeSignedArea(poly);
-		if (std::fabs(signedArea) < 1e-6)
-			continue;
-
-		// Keep only CCW faces as "rooms".
-		if (signedArea <= 0.0)
+		const double signedArea = computeSignedArea(poly);
+		if (signedArea < 1e-6 || isDegenerateFace(poly))
 			continue;
 
 		Room room;
 		room.polygon = poly;
+		room.area = signedArea;
+		room.center = computeCentroid(poly, signedArea);
 
-		// store positive area for display
-		room.area = std::fabs(signedArea);
+		const int roomId = static_cast<int>(m_layerRooms[layer].size());
+		m_layerRooms[layer].push_back(room);
 
-		// centroid needs the signed area
-		room.center = computeCentroid(poly, signedArea);
+		for (size_t c = 0; c < cycle.size(); ++c)
+			edgeRoom[cycle[c]] = roomId;
+	}
+}
+
+// Crossing an edge the layout does not use never leaves a room of that
+// layout, so overlay faces joined across such edges share their room.
+// Each group takes the room of any boundary edge the layout does use.
+// Groups with no such edge, islands drawn only in the other layout, are
+// located by point instead.
+void RoomGraph::labelOverlay(int layer, const std::vector<int>& edgeRoom)
+{
+	const unsigned char bit = static_cast<unsigned char>(1 << layer);
+	const int edgeCount = static_cast<int>(m_edges.size());
+	const int unknown = -2;
+
+	std::vector<int> group(m_faceCount);
+	int i;
+
+	for (i = 0; i < m_faceCount; ++i)
+		group[i] = i;
+
+	// Twin half-edges are stored next to each other.
+	for (i = 0; i + 1 < edgeCount; i += 2)
+	{
+		const int f1 = m_edges[i].face;
+		const int f2 = m_edges[i + 1].face;
+
+		if (!(m_edgeLayers[i] & bit) && f1 >= 0 && f2 >= 0)
+			uniteGroups(group, f1, f2);
+	}
+
+	std::vector<int> label(m_faceCount, unknown);
+
+	for (i = 0; i < edgeCount; ++i)
+	{
+		const int f = m_edges[i].face;
+		if (!(m_edgeLayers[i] & bit) || f < 0)
+			continue;
+
+		const int root = findGroup(group, f);
+		if (label[root] == unknown)
+			label[root] = edgeRoom[i];
+	}
 
-		m_rooms.push_back(room);
+	for (size_t r = 0; r < m_rooms.size(); ++r)
+	{
+		const int root = findGroup(group, m_roomFace[r]);
+
+		if (label[root] == unknown)
+			label[root] = locateLayerRoom(layer, interiorPoint(m_rooms[r].polygon));
+
+		if (layer == 0)
+			m_overlayTags[r].roomA = label[root];
+		else
+			m_overlayTags[r].roomB = label[root];
+	}
+}
+
+// Smallest room of the layout containing p, or -1.
+int RoomGraph::locateLayerRoom(int layer, const Vec2& p) const
+{
+	const std::vector<Room>& rooms = m_layerRooms[layer];
+	int best = -1;
+
+	for (size_t r = 0; r < rooms.size(); ++r)
+	{
+		if (best >= 0 && rooms[r].area >= rooms[best].area)
+			continue;
 
+		if (containsPoint(rooms[r].polygon, p))
+			best = static_cast<int>(r);
 	}
+
+	return best;
 }
 
 
@@ -375,7 +2368,14 @@ void Cmd_TestRoomGraph()
 		return;
 	}
 
+	// LINE selections from CAD exports often repeat the same wall.
+	RoomGraph::Options options;
+	options.mergeCollinear = true;
+	options.hardwareCounters = true;
+	options.validate = true;
+
 	RoomGraph graph;
+	graph.setOptions(options);
 	graph.build(segments);
 
 	const std::vector<RoomGraph::Room>& rooms = graph.getRooms();
@@ -383,6 +2383,56 @@ void Cmd_TestRoomGraph()
 
 	acutPrintf(_T("\nRooms found: %d"), roomCount);
 
+	// Time per stage, with hardware events where the system counts them.
+	static const TCHAR* stageNames[RoomGraph::StageCount] =
+	{
+		_T("prepare"), _T("nodes"), _T("sort"), _T("link"), _T("walk")
+	};
+
+	const RoomGraph::BuildStats& stats = graph.getStats();
+	bool counted = false;
+
+	int stage;
+	for (stage = 0; stage < RoomGraph::StageCount; ++stage)
+	{
+		const HardwareCounters& events = stats.hardware[stage];
+
+		acutPrintf(_T("\n  %-8s %9.2f ms"), stageNames[stage], stats.stageMs[stage]);
+
+		if (events.available[EventCycles] && events.available[EventInstructions])
+		{
+			acutPrintf(_T("  %.0f cycles, IPC %.2f"),
+				static_cast<double>(events.counts[EventCycles]), events.ipc());
+			counted = true;
+		}
+		if (events.available[EventCacheMisses])
+		{
+			acutPrintf(_T("  %.0f LLC misses"), static_cast<double>(events.counts[EventCacheMisses]));
+			counted = true;
+		}
+		if (events.available[EventBranchMisses])
+		{
+			acutPrintf(_T("  %.0f branch misses"), static_cast<double>(events.counts[EventBranchMisses]));
+			counted = true;
+		}
+	}
+
+	if (!counted)
+		acutPrintf(_T("\n  (hardware counters unavailable)"));
+
+	const RoomGraph::Validation& check = stats.validation;
+	if (check.ok())
+	{
+		acutPrintf(_T("\nTopology check passed: %d faces in %d components, %.2f ms"),
+			check.faces, check.components, stats.validateMs);
+	}
+	else
+	{
+		acutPrintf(_T("\nTopology check FAILED: incidence %d, twin %d, next %d, permutation %d, faces %d, Euler %d, area %d, rooms %d"),
+			check.badIncidence, check.badTwin, check.badNext, check.badPermutation,
+			check.badFaces, check.badEuler, check.badArea, check.badRooms);
+	}
+
 	if (roomCount == 0)
 		return;
 
@@ -3,7 +3,14 @@
 
 #include <vector>
 #include <map>
+#include <string>
 #include "Geometry.h"
+#include "Predicates.h"
+#include "CowArray.h"
+#include "MemoryTracking.h"
+#include "Profiling.h"
+
+class CostModel; // BuildPlanner.h
 
 // The RoomGraph takes a set of line segments and reconstructs
 // all closed polygonal regions ("rooms") using a half-edge graph.
@@ -24,13 +31,401 @@ public:
 		Room() : center(), area(0.0) {}
 	};
 
+	// How a full build dedups nodes and how many threads it uses.
+	enum BuildStrategy
+	{
+		StrategyAuto = -2,    // chosen per input, see Options::strategy
+		StrategyDefault = -1, // sorted dedup on Options::threads threads
+		StrategySorted = 0,   // sorted dedup, one thread
+		StrategyParallel,     // sorted dedup, parallel steps on Options::threads threads
+		StrategyMap,          // a node map filled segment by segment; allocates per node
+		StrategyCount
+	};
+
+	// Optional processing stages.
+	struct Options
+	{
+		// Merge duplicated and overlapping collinear segments before
+		// building, so they do not turn into parallel half-edges.
+		bool mergeCollinear;
+
+		// Node all segments at their crossings with iterated snap rounding
+		// on the snap grid, so the graph is planar even where walls cross
+		// or where rounding would create new crossings.
+		bool snapRounding;
+
+		// Deduplicate nodes with external sorts on disk (0 = in-memory
+		// index). Beyond the graph itself, which still lives in memory,
+		// the build then holds about this many bytes: two sorts of 32-byte
+		// endpoint records with half each (at least 128 KB apiece), while
+		// the node of each endpoint is parked in the edge array. Local
+		// edits need the in-memory index and are refused after such a
+		// build.
+		size_t externalMemoryBudget;
+
+		// Where the sorted runs go; empty for the system's temp files.
+		std::string tempDirectory;
+
+		// Count hardware events (cycles, instructions, cache and branch
+		// misses) per stage of build(); see BuildStats::hardware.
+		bool hardwareCounters;
+
+		// Check the finished graph with validate() after every full
+		// build(); see BuildStats::validation.
+		bool validate;
+
+		// Threads for the parallel steps of a full build(): endpoint keys
+		// and their sort, edge order and next links (0 = one per
+		// processor). The walk stays serial, and the graph is the same for
+		// any count. Allocation tracking and hardware counters only see
+		// the calling thread, and warm rebuilds are only allocation-free
+		// with one thread.
+		int threads;
+
+		// Capture slow builds to reproduce them elsewhere (BuildCapture.h):
+		// a full build() taking captureThresholdMs or more writes its input
+		// segments, snap size, options and stats to a new file in
+		// captureDirectory, named after the process id, the time and a
+		// count of slow builds. Only one in captureSampling slow builds of the
+		// process is written, and none larger than captureMaxBytes (0 = no
+		// limit). Empty directory = no captures.
+		std::string captureDirectory;
+		double      captureThresholdMs;
+		int         captureSampling;
+		size_t      captureMaxBytes;
+
+		// Record every full build() in the process-wide metrics of
+		// BuildMetrics.h.
+		bool metrics;
+
+		// Strategy of a full build(), see BuildStrategy. StrategyAuto
+		// samples the segments (BuildStats::plan.profile) and takes the
+		// strategy costModel predicts to be fastest (NULL: the built-in
+		// model of BuildPlanner.h); threads then caps the threads of the
+		// parallel one, so it needs threads != 1. externalMemoryBudget
+		// still takes precedence for the node dedup.
+		int              strategy;
+		const CostModel* costModel;
+
+		Options()
+			: mergeCollinear(false),
+			snapRounding(false),
+			externalMemoryBudget(0),
+			tempDirectory(),
+			hardwareCounters(false),
+			validate(false),
+			threads(1),
+			captureDirectory(),
+			captureThresholdMs(1000.0),
+			captureSampling(1),
+			captureMaxBytes(64 * 1024 * 1024),
+			metrics(true),
+			strategy(StrategyDefault),
+			costModel(NULL)
+		{
+		}
+	};
+
+	// Result of validate(): the size of the structure it walked and how
+	// many times each invariant was broken. All failure counts are zero
+	// for a sound graph.
+	struct Validation
+	{
+		bool complete;   // false for an unfinished anytime build, not checked
+		int  edges;      // live half-edges
+		int  faces;      // cycles of next
+		int  components; // connected components with at least one edge
+
+		int badIncidence;   // edges listed at a node they do not start at, or at none
+		int badTwin;        // twin not reversed, or twin(twin(e)) != e
+		int badNext;        // next not starting where the edge ends
+		int badPermutation; // edges with no or several predecessors under next
+		int badFaces;       // cycles whose edges disagree on their face
+		int badEuler;       // components with V - E + F != 2, e.g. walls crossing without a node
+		int badArea;        // components whose CCW faces do not add up to their CW faces
+		int badRooms;       // rooms not matching the face they were walked from
+
+		Validation()
+			: complete(false),
+			edges(0),
+			faces(0),
+			components(0),
+			badIncidence(0),
+			badTwin(0),
+			badNext(0),
+			badPermutation(0),
+			badFaces(0),
+			badEuler(0),
+			badArea(0),
+			badRooms(0)
+		{
+		}
+
+		bool ok() const
+		{
+			return complete && badIncidence == 0 && badTwin == 0 && badNext == 0
+				&& badPermutation == 0 && badFaces == 0 && badEuler == 0
+				&& badArea == 0 && badRooms == 0;
+		}
+	};
+
+	// Source rooms of one overlay room: the room of layout A and the
+	// room of layout B that contain it, or -1 when outside all of them.
+	struct OverlayTag
+	{
+		int roomA;
+		int roomB;
+
+		OverlayTag() : roomA(-1), roomB(-1) {}
+	};
+
+	// Stages of build(), in order, as booked in BuildStats.
+	enum BuildStage
+	{
+		StagePrepare, // optional clean-up of the segments
+		StageNodes,   // node dedup and half-edges
+		StageSort,    // outgoing edges by angle
+		StageLink,    // next relations
+		StageWalk,    // cycles into rooms
+		StageCount
+	};
+
+	// What the sampling pass of StrategyAuto saw of the segments. The
+	// degrees are those within the sample: runs of consecutive segments,
+	// which in drawings tend to outline the same rooms.
+	struct InputProfile
+	{
+		size_t segments;
+		int    sampled;        // segments looked at, all of them for small inputs
+		double axisAligned;    // share of the sampled walls parallel to an axis
+		double zeroLength;     // share of the sampled walls within one snap cell
+		double meanDegree;     // of the nodes of the sample
+		int    maxDegree;
+		double degreeShare[4]; // nodes of degree 1, 2, 3 and 4 or more
+		double width;          // extent of the sample
+		double height;
+
+		InputProfile()
+			: segments(0),
+			sampled(0),
+			axisAligned(0.0),
+			zeroLength(0.0),
+			meanDegree(0.0),
+			maxDegree(0),
+			width(0.0),
+			height(0.0)
+		{
+			for (int d = 0; d < 4; ++d)
+				degreeShare[d] = 0.0;
+		}
+	};
+
+	// Strategy of the last full build and, for StrategyAuto, why.
+	struct BuildPlan
+	{
+		int          strategy;                   // StrategySorted, StrategyParallel or StrategyMap
+		int          threads;                    // 0 outside full builds: Options::threads
+		bool         tuned;                      // chosen by the cost model
+		double       predictedMs[StrategyCount]; // 0 for strategies not considered
+		double       sampleMs;                   // time of the sampling pass
+		InputProfile profile;
+
+		BuildPlan() : strategy(StrategySorted), threads(0), tuned(false), sampleMs(0.0), profile()
+		{
+			for (int s = 0; s < StrategyCount; ++s)
+				predictedMs[s] = 0.0;
+		}
+	};
+
+	// Counters collected during the last build.
+	struct BuildStats
+	{
+		// Orientation tests used to order edges around nodes and to
+		// reject degenerate faces, and how many needed exact arithmetic.
+		PredicateCounters predicates;
+
+		// Faces walked that did not become rooms: clockwise ones (the
+		// outside of every component, and holes) and degenerate ones
+		// (fewer than three edges, tiny or collinear). Endpoints of the
+		// last full build() that snapped onto an existing node.
+		unsigned long clockwiseFaces;
+		unsigned long degenerateFaces;
+		unsigned long snapMerges;
+
+		// Pieces that snap rounding (Options::snapRounding, or overlay())
+		// left passing another hot pixel when it ran out of routing steps.
+		// The graph may not be planar unless this is zero.
+		size_t unnodedPieces;
+
+		// Heap use per stage of the last full build(), and its highest
+		// live heap bytes. Zero unless allocationTrackingEnabled().
+		MemoryCounters memory[StageCount];
+		size_t         peakMemory;
+
+		// Wall time per stage of the last full build(), in milliseconds.
+		double stageMs[StageCount];
+
+		// Hardware events per stage, where Options::hardwareCounters asked
+		// for them and the system allows them.
+		HardwareCounters hardware[StageCount];
+
+		// Result and wall time of the check after the last full build(),
+		// where Options::validate asked for it.
+		Validation validation;
+		double     validateMs;
+
+		// Whether the last full build() was written to
+		// Options::captureDirectory.
+		bool captured;
+
+		BuildPlan plan;
+
+		BuildStats()
+			: predicates(),
+			clockwiseFaces(0),
+			degenerateFaces(0),
+			snapMerges(0),
+			unnodedPieces(0),
+			peakMemory(0),
+			validation(),
+			validateMs(0.0),
+			captured(false),
+			plan()
+		{
+			for (int s = 0; s < StageCount; ++s)
+				stageMs[s] = 0.0;
+		}
+	};
+
+	// Short name of a stage for reports, e.g. "walk".
+	static const char* stageName(int stage);
+
 	RoomGraph();
 
 	// Build the internal graph from segments and extract all rooms.
 	void build(const std::vector<Segment>& segments);
 
+	// Same, reading the segments in place, e.g. from shared memory. They
+	// are not copied unless a clean-up option is on.
+	void build(const Segment* segments, size_t count);
+
+	// Anytime build for interactive previews. Connected components are
+	// processed nearest to "focus" first, and the call returns once
+	// budgetMs milliseconds of wall time have elapsed. Returns true when
+	// all rooms are found; otherwise getRooms() holds the rooms completed
+	// so far and resume() continues where this call stopped.
+	bool build(const std::vector<Segment>& segments, const Vec2& focus, double budgetMs);
+
+	// Continue an unfinished anytime build for another budgetMs.
+	bool resume(double budgetMs);
+
+	// False while an anytime build still has work left.
+	bool isComplete() const;
+
+	// Check the topology of a complete graph: twins pair up, next starts
+	// where each edge ends and is a permutation, every cycle of next is
+	// one face, V - E + F = 2 and the CCW face areas equal the CW ones in
+	// every component, and each room matches its face. Linear in the
+	// size of the graph; the per-node checks run on up to threadCount
+	// threads (0 = one per processor) once the graph is large enough to
+	// pay for them. True when no check failed.
+	bool validate(Validation& result, int threadCount) const;
+
 	const std::vector<Room>& getRooms() const;
 
+	// One wall of the graph and the rooms on its left and right when
+	// looking from segment.a to segment.b (-1 where there is none).
+	struct Wall
+	{
+		Segment segment;
+		int leftRoom;
+		int rightRoom;
+
+		Wall() : segment(), leftRoom(-1), rightRoom(-1) {}
+	};
+
+	// All walls after snapping and clean-up, one per edge pair.
+	void getWalls(std::vector<Wall>& walls) const;
+
+	// Fixed-size room record for writeRooms(). The vertices of all rooms
+	// follow the records as x, y pairs.
+	struct FlatRoom
+	{
+		double area;
+		double centerX;
+		double centerY;
+		unsigned int firstVertex;
+		unsigned int vertexCount;
+	};
+
+	// Write the rooms into a caller's buffer (8-byte aligned) as
+	// getRooms().size() FlatRoom records followed by the vertices, so a
+	// reader can use them without parsing. Returns the bytes required;
+	// nothing is written if that exceeds capacity.
+	size_t writeRooms(void* buffer, size_t capacity) const;
+
+	// Overlay two layouts (rooms with fire zones, lease areas...). Both
+	// segment sets are noded together on the snap grid and built into one
+	// half-edge graph. getRooms() then returns the faces of the overlay,
+	// getOverlayTags() the layout rooms each face lies in (same order),
+	// and getLayerRooms(0 or 1) the rooms of layout A or B on its own.
+	void overlay(const std::vector<Segment>& a, const std::vector<Segment>& b);
+
+	const std::vector<OverlayTag>& getOverlayTags() const;
+	const std::vector<Room>& getLayerRooms(int layer) const;
+
+	// Local edits on a built graph: merge two rooms by removing the wall
+	// between them, or split a room with a new wall. Only the faces on
+	// both sides of the wall are walked again, so an edit costs time in
+	// proportion to their boundaries. The rooms of the edited faces are
+	// replaced and the last room moves into a freed slot, so room indices
+	// are not stable across edits. Overlay tags are dropped.
+
+	// Remove the wall between the nodes at a and b.
+	bool removeWall(const Vec2& a, const Vec2& b);
+
+	// Add a wall between the nodes at a and b, which must lie on the
+	// boundary of the same face. The wall must not cross other walls.
+	bool insertWall(const Vec2& a, const Vec2& b);
+
+	// Versions for undo/redo of local edits. commitVersion() records the
+	// graph and its rooms and returns the version id (-1 while an anytime
+	// build is unfinished). The graph is kept in copy-on-write chunks, so
+	// a commit copies only the chunks edited since the last commit or
+	// checkout and shares the rest. checkoutVersion() restores a version
+	// and likewise copies only the chunks that differ. All versions are
+	// dropped by the next build.
+	int commitVersion();
+	bool checkoutVersion(int version);
+	void releaseVersion(int version);
+
+	// Size of the snap grid in world units; takes effect on the next build.
+	void setSnapSize(double snapSize);
+	double getSnapSize() const;
+
+	void setOptions(const Options& options);
+	const Options& getOptions() const;
+
+	const BuildStats& getStats() const;
+
+	// Full builds on a graph that was built before reuse its memory, so a
+	// rebuild of an input no larger than the last one normally allocates
+	// nothing (without clean-up options, which copy the segments). This
+	// checks it: builds segments twice and returns false if the second
+	// build allocated, listing the stages that did in report. Needs
+	// allocation tracking; false without it.
+	bool checkAllocationFree(const std::vector<Segment>& segments, std::string& report);
+
+	// Fit a peak memory model by building growing prefixes of segments
+	// (steps of them, with this graph's snap size and options) on scratch
+	// graphs. Needs allocation tracking; false without it.
+	bool calibrateMemory(const std::vector<Segment>& segments, int steps, MemoryModel& model) const;
+
+	// Bytes held in the graph's vectors, in use or kept for the next
+	// build; a lower bound of its heap use (the node map of anytime builds
+	// and version chunks are left out). Linear in nodes and rooms.
+	size_t getWorkspaceBytes() const;
+
 private:
 	// Node represents a unique point in the graph.
 	struct Node
@@ -53,8 +448,8 @@ private:
 		int to;
 		int twin; // opposite half-edge
 		int next; // next edge when walking around a face
+		int face; // face this edge bounds, set while walking cycles
 		bool used;
-		double angle; // direction angle at the "from" node
 
 		HalfEdge()
 			: id(-1),
@@ -62,31 +457,105 @@ private:
 			to(-1),
 			twin(-1),
 			next(-1),
-			used(false),
-			angle(0.0)
+			face(-1),
+			used(false)
 		{
 		}
 	};
 
 
+	// Per-node part of validate(), for a range of nodes.
+	struct ValidateNodesTask;
+
+	// Node numbering pass of buildNodesExternal().
+	class NodeNumbering;
+
+	// Part of a parallel build step, for a range of endpoints or nodes.
+	struct BuildSlice;
+
+	enum SliceStep
+	{
+		SliceKeys,      // endpoint keys
+		SliceSortKeys,  // sort a run of endpoint keys
+		SliceMergeKeys, // merge two sorted runs into m_mergedKeys
+		SliceOrder,     // outgoing edges by angle
+		SliceLink       // next links
+	};
+
 	struct EdgeAngleLess
 	{
-		RoomGraph* graph;
+		RoomGraph*         graph;
+		PredicateCounters* counters;
 
-		EdgeAngleLess(RoomGraph* g) : graph(g) {}
+		EdgeAngleLess(RoomGraph* g) : graph(g), counters(&g->m_stats.predicates) {}
+		EdgeAngleLess(RoomGraph* g, PredicateCounters* c) : graph(g), counters(c) {}
 
 		bool operator()(int e1, int e2) const;
 	};
 
+	// Orders component ids by their distance to the focus point.
+	struct ComponentDistanceLess
+	{
+		const std::vector<double>* distance;
+
+		ComponentDistanceLess(const std::vector<double>* d) : distance(d) {}
+
+		bool operator()(int c1, int c2) const;
+	};
+
+	// Stages of an anytime build.
+	enum BuildPhase
+	{
+		PhaseIdle,
+		PhaseNodes,
+		PhaseComponents,
+		PhaseWalk,
+		PhaseDone
+	};
+
 	// Internal workflow.
 	void clear();
-	void buildNodesAndEdges(const std::vector<Segment>& segments);
+	bool prepareSegments(const Segment* segments, size_t count,
+		std::vector<Segment>& scratch, size_t& unnoded) const;
+	void buildNodesAndEdges(const Segment* segments, size_t count);
+	void buildNodesSorted(const Segment* segments, size_t count);
+	void buildNodesMapped(const Segment* segments, size_t count);
+	void choosePlan(const Segment* segments, size_t count);
+	void profileInput(const Segment* segments, size_t count, InputProfile& profile);
+	void makeEndpointKeys(const Segment* segments, int begin, int end);
+	void sortEndpointKeys(int threads);
+	int buildThreads(size_t items) const;
+	void runSlices(int step, const Segment* segments, int count, int threads);
+	void reuseEdgeList(Node& node);
+	bool buildNodesExternal(const Segment* segments, size_t count);
+	void addSegment(const Segment& s);
+	void addEdgePair(int a, int b);
+	void makeEdgePair(int id, int a, int b, HalfEdge& e1, HalfEdge& e2);
 	int findOrCreateNode(const Vec2& p);
 	void sortOutgoingByAngle();
+	void sortOutgoingAt(int nodeId, PredicateCounters* counters);
 	void buildNextRelations();
+	void linkNext(int edgeId);
+	void linkNextAt(int nodeId);
 	void walkCycles();
+	void walkCycleFrom(int startId);
+
+	// Anytime build helpers.
+	void collectComponents();
+	void processComponent(int componentId);
+
+	// Local edit helpers.
+	int findNode(const Vec2& p) const;
+	void removeRoom(int roomId);
+	void releaseFace(int edgeId);
+
+	// Overlay helpers.
+	void walkLayerFaces(int layer, std::vector<int>& edgeRoom);
+	void labelOverlay(int layer, const std::vector<int>& edgeRoom);
+	int locateLayerRoom(int layer, const Vec2& p) const;
 
 	double computeSignedArea(const std::vector<Vec2>& poly) const;
+	bool isDegenerateFace(const std::vector<Vec2>& poly);
 	Vec2 computeCentroid(const std::vector<Vec2>& poly, double signedArea) const;
 
 private:
@@ -94,6 +563,17 @@ private:
 	std::vector<HalfEdge> m_edges;
 	std::vector<Room>     m_rooms;
 
+	// Number of faces walked, and the room each face became (-1 if none).
+	int              m_faceCount;
+	std::vector<int> m_faceRoom;
+	std::vector<int> m_roomFace;
+
+	// Overlay results: layouts using each half-edge (bit 0 = A, bit 1 = B),
+	// the source rooms of each overlay room, and each layout's own rooms.
+	std::vector<unsigned char> m_edgeLayers;
+	std::vector<OverlayTag>    m_overlayTags;
+	std::vector<Room>          m_layerRooms[2];
+
 	// Simple grid key for snapping nearby points to a single node.
 	struct GridKey
 	{
@@ -110,11 +590,66 @@ private:
 		}
 	};
 
-	// Map snapped grid coordinates to node index.
+	// Map snapped grid coordinates to node index. Filled by the anytime
+	// build and overlays, which add segments one at a time.
 	std::map<GridKey, int> m_nodeIndex;
 
+	// Snap key of segment endpoint 2 * segment + side.
+	struct EndpointKey
+	{
+		GridKey key;
+		int     endpoint;
+
+		bool operator<(const EndpointKey& other) const
+		{
+			if (key < other.key) return true;
+			if (other.key < key) return false;
+			return endpoint < other.endpoint;
+		}
+	};
+
+	// Node index of a full build: endpoint keys sorted by key, and the node
+	// of every endpoint.
+	std::vector<EndpointKey> m_endpointKeys;
+	std::vector<int>         m_endpointNode;
+	std::vector<EndpointKey> m_mergedKeys; // merge buffer of the parallel sort
+	std::vector<GridKey>     m_sampleKeys; // endpoints of the sampling pass
+
+	// Workspace kept across builds, so that rebuilding a similar input
+	// reuses memory instead of allocating: the edge lists of the previous
+	// nodes and the polygons of the previous rooms (node or room n gets
+	// entry n back), and the polygon being walked.
+	std::vector<std::vector<int> >  m_spareEdgeLists;
+	std::vector<std::vector<Vec2> > m_sparePolygons;
+	std::vector<Vec2>               m_walkPolygon;
+
 	// Size of the snap grid in world units.
 	double m_snapSize;
+
+	Options m_options;
+	BuildStats m_stats;
+
+	// Resumable state of an anytime build.
+	int                  m_phase;
+	std::vector<Segment> m_pendingSegments;
+	size_t               m_segmentCursor;
+	Vec2                 m_focus;
+
+	// Nodes grouped by connected component (offsets into m_componentNodes),
+	// and the order in which components are processed.
+	std::vector<int> m_componentStart;
+	std::vector<int> m_componentNodes;
+	std::vector<int> m_componentOrder;
+	size_t           m_componentCursor;
+
+	// Versions of the graph, see commitVersion(). Local edits touch()
+	// every element they change in place.
+	CowArray<Node>     m_nodeVersions;
+	CowArray<HalfEdge> m_edgeVersions;
+	CowArray<Room>     m_roomVersions;
+	CowArray<int>      m_faceRoomVersions;
+	CowArray<int>      m_roomFaceVersions;
+	std::vector<int>   m_versionFaceCount;
 };
 
 
@@ -0,0 +1,1698 @@
+#include "stdafx.h"
+#include "stdarx.h"
+#include "RoomGraphBench.h"
+#include "BuildCapture.h"
+#include "Profiling.h"
+#include "ReferenceRooms.h"
+#include "TiledRoomBuilder.h"
+#include "SegmentMerge.h"
+#include "SnapRounding.h"
+#include "Threading.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <cstring>
+#include <cfloat>
+
+// Scales a MAD to the standard deviation of normally distributed noise.
+static const double kMadToSigma = 1.4826;
+
+static const char* kBenchFormat = "roomgraph-bench-1";
+
+static const double kPi = 3.14159265358979323846;
+
+BenchRandom::BenchRandom(unsigned int seed)
+: m_state(seed != 0 ? seed : 0x9e3779b9u)
+{
+}
+
+unsigned int BenchRandom::next()
+{
+	m_state ^= m_state << 13;
+	m_state ^= m_state >> 17;
+	m_state ^= m_state << 5;
+	return m_state;
+}
+
+int BenchRandom::below(int n)
+{
+	return n > 0 ? static_cast<int>(next() % static_cast<unsigned int>(n)) : 0;
+}
+
+double BenchRandom::unit()
+{
+	return (next() >> 8) / 16777216.0;
+}
+
+void generateGrid(int columns, int rows, double cell, std::vector<Segment>& segments)
+{
+	segments.clear();
+	segments.reserve(static_cast<size_t>(columns + 1) * rows + static_cast<size_t>(rows + 1) * columns);
+
+	int i;
+	int j;
+
+	for (i = 0; i <= columns; ++i)
+	{
+		for (j = 0; j < rows; ++j)
+			segments.push_back(Segment(Vec2(i * cell, j * cell), Vec2(i * cell, (j + 1) * cell)));
+	}
+
+	for (j = 0; j <= rows; ++j)
+	{
+		for (i = 0; i < columns; ++i)
+			segments.push_back(Segment(Vec2(i * cell, j * cell), Vec2((i + 1) * cell, j * cell)));
+	}
+}
+
+void generateFloorPlan(int columns, int rows, double removedShare, unsigned int seed,
+	std::vector<Segment>& segments)
+{
+	std::vector<Segment> grid;
+	generateGrid(columns, rows, 1.0, grid);
+
+	BenchRandom random(seed);
+	segments.clear();
+	segments.reserve(grid.size());
+
+	for (size_t i = 0; i < grid.size(); ++i)
+	{
+		const Segment& s = grid[i];
+
+		// The outline always stays.
+		const bool outline = (s.a.x == s.b.x && (s.a.x == 0.0 || s.a.x == columns))
+			|| (s.a.y == s.b.y && (s.a.y == 0.0 || s.a.y == rows));
+
+		if (outline || random.unit() >= removedShare)
+			segments.push_back(s);
+	}
+}
+
+void jitterSegments(std::vector<Segment>& segments, double jitter, unsigned int seed)
+{
+	BenchRandom random(seed);
+
+	size_t i;
+	for (i = 0; i < segments.size(); ++i)
+	{
+		Segment& s = segments[i];
+		s.a.x += (2.0 * random.unit() - 1.0) * jitter;
+		s.a.y += (2.0 * random.unit() - 1.0) * jitter;
+		s.b.x += (2.0 * random.unit() - 1.0) * jitter;
+		s.b.y += (2.0 * random.unit() - 1.0) * jitter;
+
+		if (random.below(2) == 1)
+			std::swap(s.a, s.b);
+	}
+
+	for (i = segments.size(); i > 1; --i)
+		std::swap(segments[i - 1], segments[random.below(static_cast<int>(i))]);
+}
+
+static void addCase(const std::string& name, const std::vector<Segment>& segments,
+	const RoomGraph::Options& options, std::vector<BenchCase>& cases)
+{
+	cases.push_back(BenchCase());
+	cases.back().name = name;
+	cases.back().segments = segments;
+	cases.back().options = options;
+}
+
+void makeBenchMatrix(double scale, std::vector<BenchCase>& cases)
+{
+	cases.clear();
+
+	// Cell counts grow with the square root, segment counts with scale.
+	const double factor = std::sqrt(scale > 0.0 ? scale : 1.0);
+	const int small = std::max(2, static_cast<int>(100 * factor));
+	const int medium = std::max(2, static_cast<int>(200 * factor));
+	const int large = std::max(2, static_cast<int>(300 * factor));
+
+	RoomGraph::Options plain;
+	RoomGraph::Options merging;
+	merging.mergeCollinear = true;
+
+	std::vector<Segment> segments;
+	char name[64];
+
+	generateGrid(small, small, 1.0, segments);
+	std::sprintf(name, "grid-%d", small);
+	addCase(name, segments, plain, cases);
+
+	generateGrid(large, large, 1.0, segments);
+	std::sprintf(name, "grid-%d", large);
+	addCase(name, segments, plain, cases);
+
+	generateFloorPlan(medium, medium, 0.3, 1, segments);
+	std::sprintf(name, "plan-%d", medium);
+	addCase(name, segments, plain, cases);
+
+	// Well inside the default snap size of 1e-3.
+	generateGrid(medium, medium, 1.0, segments);
+	jitterSegments(segments, 2.5e-4, 2);
+	std::sprintf(name, "jitter-%d", medium);
+	addCase(name, segments, plain, cases);
+
+	// Every wall twice, for the clean-up stage.
+	generateGrid(small, small, 1.0, segments);
+	segments.insert(segments.end(), segments.begin(), segments.end());
+	std::sprintf(name, "merge-%d", small);
+	addCase(name, segments, merging, cases);
+}
+
+static double median(std::vector<double> values)
+{
+	if (values.empty())
+		return 0.0;
+
+	std::sort(values.begin(), values.end());
+
+	const size_t half = values.size() / 2;
+	if (values.size() % 2 == 1)
+		return values[half];
+
+	return 0.5 * (values[half - 1] + values[half]);
+}
+
+static double medianAbsoluteDeviation(const std::vector<double>& values, double center)
+{
+	std::vector<double> deviations(values.size());
+	for (size_t i = 0; i < values.size(); ++i)
+		deviations[i] = std::fabs(values[i] - center);
+
+	return median(deviations);
+}
+
+static void addResult(const BenchCase& benchCase, const char* stage, const std::vector<double>& times,
+	std::vector<BenchResult>& results)
+{
+	BenchResult result;
+	result.caseName = benchCase.name;
+	result.segments = benchCase.segments.size();
+	result.stage = stage;
+	result.median = median(times);
+	result.mad = medianAbsoluteDeviation(times, result.median);
+	result.runs = static_cast<int>(times.size());
+
+	results.push_back(result);
+}
+
+void runBenchCase(const BenchCase& benchCase, int repetitions, std::vector<BenchResult>& results)
+{
+	RoomGraph graph;
+	graph.setOptions(benchCase.options);
+
+	// Warm-up, so every measured build runs on a warm graph.
+	graph.build(benchCase.segments);
+
+	std::vector<double> stageTimes[RoomGraph::StageCount];
+	std::vector<double> totalTimes;
+
+	for (int run = 0; run < std::max(1, repetitions); ++run)
+	{
+		const double start = monotonicMs();
+		graph.build(benchCase.segments);
+		totalTimes.push_back(monotonicMs() - start);
+
+		for (int stage = 0; stage < RoomGraph::StageCount; ++stage)
+			stageTimes[stage].push_back(graph.getStats().stageMs[stage]);
+	}
+
+	for (int stage = 0; stage < RoomGraph::StageCount; ++stage)
+		addResult(benchCase, RoomGraph::stageName(stage), stageTimes[stage], results);
+
+	addResult(benchCase, "total", totalTimes, results);
+}
+
+void runBenchmarks(const BenchSettings& settings, std::vector<BenchResult>& results)
+{
+	std::vector<BenchCase> cases;
+	makeBenchMatrix(settings.scale, cases);
+
+	for (size_t c = 0; c < cases.size(); ++c)
+		runBenchCase(cases[c], settings.repetitions, results);
+}
+
+bool writeBenchJson(const std::string& path, const std::vector<BenchResult>& results)
+{
+	std::FILE* file = std::fopen(path.c_str(), "w");
+	if (file == NULL)
+		return false;
+
+	std::fprintf(file, "{\n\"format\": \"%s\",\n\"results\": [\n", kBenchFormat);
+
+	for (size_t i = 0; i < results.size(); ++i)
+	{
+		const BenchResult& r = results[i];
+		std::fprintf(file,
+			"{\"case\": \"%s\", \"segments\": %lu, \"stage\": \"%s\", \"median\": %.6f, \"mad\": %.6f, \"runs\": %d}%s\n",
+			r.caseName.c_str(), static_cast<unsigned long>(r.segments), r.stage.c_str(),
+			r.median, r.mad, r.runs, i + 1 < results.size() ? "," : "");
+	}
+
+	std::fprintf(file, "]\n}\n");
+
+	return std::fclose(file) == 0;
+}
+
+bool readBenchJson(const std::string& path, std::vector<BenchResult>& results)
+{
+	std::FILE* file = std::fopen(path.c_str(), "r");
+	if (file == NULL)
+		return false;
+
+	bool formatSeen = false;
+	char line[512];
+
+	while (std::fgets(line, sizeof(line), file) != NULL)
+	{
+		if (std::strstr(line, "\"format\"") != NULL)
+			formatSeen = std::strstr(line, kBenchFormat) != NULL;
+
+		if (std::strncmp(line, "{\"case\"", 7) != 0)
+			continue;
+
+		char caseName[128];
+		char stage[32];
+		unsigned long segments = 0;
+		BenchResult r;
+
+		if (std::sscanf(line,
+			"{\"case\": \"%127[^\"]\", \"segments\": %lu, \"stage\": \"%31[^\"]\", \"median\": %lf, \"mad\": %lf, \"runs\": %d",
+			caseName, &segments, stage, &r.median, &r.mad, &r.runs) != 6)
+		{
+			continue;
+		}
+
+		r.caseName = caseName;
+		r.segments = segments;
+		r.stage = stage;
+		results.push_back(r);
+	}
+
+	std::fclose(file);
+	return formatSeen;
+}
+
+int compareWithBaseline(const std::vector<BenchResult>& baseline, const std::vector<BenchResult>& current,
+	const GateSettings& gate, std::string& report)
+{
+	int regressions = 0;
+	char line[256];
+
+	for (size_t i = 0; i < current.size(); ++i)
+	{
+		const BenchResult& now = current[i];
+		const BenchResult* before = NULL;
+
+		for (size_t j = 0; j < baseline.size() && before == NULL; ++j)
+		{
+			if (baseline[j].caseName == now.caseName && baseline[j].segments == now.segments
+				&& baseline[j].stage == now.stage)
+			{
+				before = &baseline[j];
+			}
+		}
+
+		if (before == NULL)
+		{
+			std::sprintf(line, "%-12s %-8s %10.3f ms  (no baseline)\n",
+				now.caseName.c_str(), now.stage.c_str(), now.median);
+			report += line;
+			continue;
+		}
+
+		const double delta = now.median - before->median;
+		const double noise = kMadToSigma * std::sqrt(before->mad * before->mad + now.mad * now.mad);
+		const bool regression = delta > gate.noiseFactor * noise
+			&& delta > gate.minRelative * before->median
+			&& delta > gate.minAbsoluteMs;
+
+		const double change = before->median > 0.0 ? 100.0 * delta / before->median : 0.0;
+
+		std::sprintf(line, "%-12s %-8s %10.3f -> %10.3f ms %+7.1f%%%s\n",
+			now.caseName.c_str(), now.stage.c_str(), before->median, now.median, change,
+			regression ? "  REGRESSION" : "");
+		report += line;
+
+		if (regression)
+			++regressions;
+	}
+
+	return regressions;
+}
+
+int runBenchmarkGate(const BenchSettings& settings, const GateSettings& gate,
+	const std::string& outputPath, const std::string& baselinePath, std::string& report)
+{
+	std::vector<BenchResult> results;
+	runBenchmarks(settings, results);
+
+	if (!writeBenchJson(outputPath, results))
+	{
+		report += "cannot write " + outputPath + "\n";
+		return 2;
+	}
+
+	if (baselinePath.empty())
+	{
+		compareWithBaseline(std::vector<BenchResult>(), results, gate, report);
+		return 0;
+	}
+
+	std::vector<BenchResult> baseline;
+	if (!readBenchJson(baselinePath, baseline))
+	{
+		report += "cannot read " + baselinePath + "\n";
+		return 2;
+	}
+
+	const int regressions = compareWithBaseline(baseline, results, gate, report);
+
+	char line[64];
+	std::sprintf(line, "%d regression(s)\n", regressions);
+	report += line;
+
+	return regressions > 0 ? 1 : 0;
+}
+
+void generateRandomPlanar(unsigned int seed, int size, double snapSize, std::vector<Segment>& segments)
+{
+	BenchRandom random(seed);
+	segments.clear();
+
+	// Off the snap grid, so lattice points fall anywhere in their cell.
+	const double ox = random.below(1000) + random.unit();
+	const double oy = random.below(1000) + random.unit();
+
+	int i;
+	int j;
+
+	// Lattice walls: some missing, some split in two.
+	for (int horizontal = 0; horizontal < 2; ++horizontal)
+	{
+		for (i = 0; i <= size; ++i)
+		{
+			for (j = 0; j < size; ++j)
+			{
+				const Vec2 a = horizontal ? Vec2(ox + j, oy + i) : Vec2(ox + i, oy + j);
+				const Vec2 b = horizontal ? Vec2(ox + j + 1, oy + i) : Vec2(ox + i, oy + j + 1);
+				const double r = random.unit();
+
+				if (r < 0.25)
+					continue;
+
+				if (r < 0.35)
+				{
+					const Vec2 m(0.5 * (a.x + b.x), 0.5 * (a.y + b.y));
+					segments.push_back(Segment(a, m));
+					segments.push_back(Segment(m, b));
+				}
+				else
+				{
+					segments.push_back(Segment(a, b));
+				}
+			}
+		}
+	}
+
+	// At most one feature per cell, so walls never cross.
+	for (i = 0; i < size; ++i)
+	{
+		for (j = 0; j < size; ++j)
+		{
+			const double x = ox + i;
+			const double y = oy + j;
+			const double r = random.unit();
+
+			if (r < 0.12)
+			{
+				if (random.below(2) == 0)
+					segments.push_back(Segment(Vec2(x, y), Vec2(x + 1, y + 1)));
+				else
+					segments.push_back(Segment(Vec2(x + 1, y), Vec2(x, y + 1)));
+			}
+			else if (r < 0.18)
+			{
+				// Sliver room, ending on the walls above and below.
+				segments.push_back(Segment(Vec2(x + 3 * snapSize, y), Vec2(x + 3 * snapSize, y + 1)));
+			}
+			else if (r < 0.23)
+			{
+				// Island.
+				segments.push_back(Segment(Vec2(x + 0.3, y + 0.3), Vec2(x + 0.7, y + 0.3)));
+				segments.push_back(Segment(Vec2(x + 0.7, y + 0.3), Vec2(x + 0.7, y + 0.7)));
+				segments.push_back(Segment(Vec2(x + 0.7, y + 0.7), Vec2(x + 0.3, y + 0.7)));
+				segments.push_back(Segment(Vec2(x + 0.3, y + 0.7), Vec2(x + 0.3, y + 0.3)));
+			}
+			else if (r < 0.28)
+			{
+				// Dangling wall.
+				segments.push_back(Segment(Vec2(x, y), Vec2(x + 0.2165, y + 0.125)));
+			}
+			else if (r < 0.31)
+			{
+				// Short wall drawn twice; the jitter below moves the copies
+				// apart within their snap cells.
+				const Vec2 a(x + 0.5, y + 0.5);
+				const Vec2 b(x + 0.5 + 7 * snapSize, y + 0.5 + 3 * snapSize);
+				segments.push_back(Segment(a, b));
+				segments.push_back(Segment(b, a));
+			}
+		}
+	}
+
+	// Duplicated, reversed and zero-length walls.
+	const size_t count = segments.size();
+	for (size_t k = 0; k < count; ++k)
+	{
+		if (random.unit() < 0.03)
+			segments.push_back(Segment(segments[k].b, segments[k].a));
+		if (random.unit() < 0.01)
+			segments.push_back(Segment(segments[k].a, segments[k].a));
+	}
+
+	jitterSegments(segments, 0.45 * snapSize, seed ^ 0x5bd1e995u);
+}
+
+void generateSharedNodeOverlaps(std::vector<Segment>& segments)
+{
+	segments.clear();
+
+	// Keeps the rooms off the border of the first tile of the tiled
+	// engine, whose stitching build would take the walls in another order.
+	segments.push_back(Segment(Vec2(-0.5, -0.5), Vec2(-0.25, -0.5)));
+
+	// The nodes then come in this order: (1, 0), (0, 0), (0.5, 0).
+	segments.push_back(Segment(Vec2(1.0, 0.0), Vec2(1.0, 1.0)));
+	segments.push_back(Segment(Vec2(0.0, 0.0), Vec2(0.0, 1.0)));
+	segments.push_back(Segment(Vec2(0.5, 0.0), Vec2(0.5, 1.0)));
+	segments.push_back(Segment(Vec2(0.0, 1.0), Vec2(1.0, 1.0)));
+
+	// From (0, 0) to a node after it and to one before it, and the same
+	// from (1, 0) the other way.
+	segments.push_back(Segment(Vec2(0.0, 0.0), Vec2(0.5, 0.0)));
+	segments.push_back(Segment(Vec2(0.0, 0.0), Vec2(1.0, 0.0)));
+	segments.push_back(Segment(Vec2(1.0, 0.0), Vec2(0.5, 0.0)));
+	segments.push_back(Segment(Vec2(1.0, 0.0), Vec2(0.0, 0.0)));
+
+	// Vertical ones, pointing up and down from the top corners.
+	segments.push_back(Segment(Vec2(0.0, 1.0), Vec2(0.0, 1.5)));
+	segments.push_back(Segment(Vec2(0.0, 1.0), Vec2(0.0, 0.0)));
+	segments.push_back(Segment(Vec2(1.0, 1.0), Vec2(1.0, 0.0)));
+	segments.push_back(Segment(Vec2(1.0, 1.0), Vec2(1.0, 0.5)));
+}
+
+const char* engineName(int engine)
+{
+	switch (engine)
+	{
+	case EnginePlain:        return "plain";
+	case EngineWarm:         return "warm";
+	case EngineExternal:     return "external";
+	case EngineAnytime:      return "anytime";
+	case EngineVersions:     return "versions";
+	case EngineTiled:        return "tiled";
+	case EngineMerge:        return "merge";
+	case EngineSnapRounding: return "snap-rounding";
+	default:                 return "?";
+	}
+}
+
+void runEngine(int engine, const std::vector<Segment>& segments, double snapSize,
+	std::vector<RoomGraph::Room>& rooms)
+{
+	RoomGraph graph;
+	RoomGraph::Options options;
+	graph.setSnapSize(snapSize);
+
+	switch (engine)
+	{
+	case EngineWarm:
+		{
+			std::vector<Segment> other;
+			generateGrid(4, 4, 1.0, other);
+			graph.build(other);
+			graph.build(segments);
+		}
+		break;
+
+	case EngineExternal:
+		options.externalMemoryBudget = 1;
+		graph.setOptions(options);
+		graph.build(segments);
+		break;
+
+	case EngineAnytime:
+		graph.build(segments, Vec2(0.0, 0.0), 1e30);
+		break;
+
+	case EngineVersions:
+		{
+			graph.build(segments);
+			const int version = graph.commitVersion();
+
+			std::vector<RoomGraph::Wall> walls;
+			graph.getWalls(walls);
+
+			for (size_t w = 0; w < walls.size(); w += 3)
+				graph.removeWall(walls[w].segment.a, walls[w].segment.b);
+
+			graph.checkoutVersion(version);
+		}
+		break;
+
+	case EngineTiled:
+		{
+			TiledRoomBuilder builder;
+			builder.setSnapSize(snapSize);
+			builder.setTileSize(2.5);
+			builder.build(segments);
+			rooms = builder.getRooms();
+		}
+		return;
+
+	case EngineMerge:
+		options.mergeCollinear = true;
+		graph.setOptions(options);
+		graph.build(segments);
+		break;
+
+	case EngineSnapRounding:
+		options.snapRounding = true;
+		graph.setOptions(options);
+		graph.build(segments);
+		break;
+
+	default:
+		graph.build(segments);
+		break;
+	}
+
+	rooms = graph.getRooms();
+}
+
+void runReference(int engine, const std::vector<Segment>& segments, double snapSize,
+	std::vector<RoomGraph::Room>& rooms)
+{
+	std::vector<Segment> cleaned;
+
+	if (engine == EngineMerge)
+		mergeCollinearSegments(segments, snapSize, cleaned);
+	else if (engine == EngineSnapRounding)
+		snapRoundSegments(segments, snapSize, cleaned);
+	else
+		cleaned = segments;
+
+	findRoomsReference(cleaned, snapSize, rooms);
+}
+
+// A room as the snap cells of its vertices, starting at the smallest.
+struct CanonicalRoom
+{
+	std::vector<std::pair<int, int> > cells;
+	const RoomGraph::Room*            room;
+
+	bool operator<(const CanonicalRoom& other) const
+	{
+		return cells < other.cells;
+	}
+};
+
+static void canonicalRooms(const std::vector<RoomGraph::Room>& rooms, double snapSize,
+	std::vector<CanonicalRoom>& result)
+{
+	result.resize(rooms.size());
+
+	for (size_t r = 0; r < rooms.size(); ++r)
+	{
+		const std::vector<Vec2>& polygon = rooms[r].polygon;
+		std::vector<std::pair<int, int> > cells(polygon.size());
+
+		for (size_t k = 0; k < polygon.size(); ++k)
+		{
+			cells[k].first = static_cast<int>(std::floor(polygon[k].x / snapSize + 0.5));
+			cells[k].second = static_cast<int>(std::floor(polygon[k].y / snapSize + 0.5));
+		}
+
+		// The smallest rotation; walls dangling into a room repeat cells, so
+		// the smallest cell alone is not enough.
+		std::vector<std::pair<int, int> > best(cells);
+		std::vector<std::pair<int, int> > rotated(cells.size());
+
+		for (size_t k = 1; k < cells.size(); ++k)
+		{
+			std::rotate_copy(cells.begin(), cells.begin() + k, cells.end(), rotated.begin());
+			if (rotated < best)
+				best.swap(rotated);
+		}
+
+		result[r].cells.swap(best);
+		result[r].room = &rooms[r];
+	}
+
+	std::sort(result.begin(), result.end());
+}
+
+static void describeRoom(const char* label, const CanonicalRoom& room, std::string& text)
+{
+	char line[160];
+	std::sprintf(line, "%s: %lu vertices from cell (%d, %d), area %.17g, center (%.17g, %.17g)\n",
+		label, static_cast<unsigned long>(room.cells.size()),
+		room.cells.empty() ? 0 : room.cells[0].first, room.cells.empty() ? 0 : room.cells[0].second,
+		room.room->area, room.room->center.x, room.room->center.y);
+	text += line;
+}
+
+bool sameRooms(const std::vector<RoomGraph::Room>& expected, const std::vector<RoomGraph::Room>& actual,
+	double snapSize, std::string& difference)
+{
+	std::vector<CanonicalRoom> a;
+	std::vector<CanonicalRoom> b;
+	canonicalRooms(expected, snapSize, a);
+	canonicalRooms(actual, snapSize, b);
+
+	char line[96];
+
+	for (size_t r = 0; r < a.size() || r < b.size(); ++r)
+	{
+		if (r == a.size() || r == b.size() || a[r].cells != b[r].cells)
+		{
+			std::sprintf(line, "room sets differ (%lu expected, %lu found)\n",
+				static_cast<unsigned long>(a.size()), static_cast<unsigned long>(b.size()));
+			difference = line;
+
+			if (r < a.size())
+				describeRoom("expected", a[r], difference);
+			if (r < b.size())
+				describeRoom("found", b[r], difference);
+
+			return false;
+		}
+
+		// Rounding of the area and centroid sums grows with the square and
+		// the cube of the coordinates.
+		const std::vector<Vec2>& polygon = a[r].room->polygon;
+		double extent = 1.0;
+
+		for (size_t k = 0; k < polygon.size(); ++k)
+			extent = std::max(extent, std::max(std::fabs(polygon[k].x), std::fabs(polygon[k].y)));
+
+		const double rounding = 16.0 * DBL_EPSILON * polygon.size() * extent * extent;
+		const double areaTolerance = 1e-12 + rounding;
+		const double centerTolerance = 1e-9 + rounding * extent / a[r].room->area;
+
+		const RoomGraph::Room& p = *a[r].room;
+		const RoomGraph::Room& q = *b[r].room;
+
+		if (std::fabs(p.area - q.area) > areaTolerance
+			|| std::fabs(p.center.x - q.center.x) > centerTolerance
+			|| std::fabs(p.center.y - q.center.y) > centerTolerance)
+		{
+			difference = "area or center differs\n";
+			describeRoom("expected", a[r], difference);
+			describeRoom("found", b[r], difference);
+			return false;
+		}
+	}
+
+	return true;
+}
+
+// True when two segments join the same pair of snap cells.
+static bool hasDuplicatedWalls(const std::vector<Segment>& segments, double snapSize)
+{
+	std::vector<std::pair<std::pair<int, int>, std::pair<int, int> > > walls(segments.size());
+
+	for (size_t k = 0; k < segments.size(); ++k)
+	{
+		std::pair<int, int> a(static_cast<int>(std::floor(segments[k].a.x / snapSize + 0.5)),
+			static_cast<int>(std::floor(segments[k].a.y / snapSize + 0.5)));
+		std::pair<int, int> b(static_cast<int>(std::floor(segments[k].b.x / snapSize + 0.5)),
+			static_cast<int>(std::floor(segments[k].b.y / snapSize + 0.5)));
+
+		walls[k] = a < b ? std::make_pair(a, b) : std::make_pair(b, a);
+	}
+
+	std::sort(walls.begin(), walls.end());
+	return std::adjacent_find(walls.begin(), walls.end()) != walls.end();
+}
+
+bool checkEngines(const std::vector<Segment>& segments, double snapSize, std::string& difference)
+{
+	std::vector<RoomGraph::Room> reference;
+	std::vector<RoomGraph::Room> rooms;
+
+	for (int engine = 0; engine < EngineCount; ++engine)
+	{
+		// The plain reference serves every engine that does not clean up.
+		if (engine == 0 || engine == EngineMerge || engine == EngineSnapRounding)
+			runReference(engine, segments, snapSize, reference);
+
+		// The reference merges and nodes with the same code, so check
+		// their results.
+		if (engine == EngineMerge)
+		{
+			std::vector<Segment> merged;
+			mergeCollinearSegments(segments, snapSize, merged);
+
+			if (hasDuplicatedWalls(merged, snapSize))
+			{
+				difference = "engine merge: duplicated walls left after merging\n";
+				return false;
+			}
+		}
+		else if (engine == EngineSnapRounding)
+		{
+			std::vector<Segment> noded;
+			if (snapRoundSegments(segments, snapSize, noded) != 0)
+			{
+				difference = "engine snap-rounding: pieces left unresolved\n";
+				return false;
+			}
+		}
+
+		runEngine(engine, segments, snapSize, rooms);
+
+		if (!sameRooms(reference, rooms, snapSize, difference))
+		{
+			difference = std::string("engine ") + engineName(engine) + ": " + difference;
+			return false;
+		}
+	}
+
+	return true;
+}
+
+void shrinkFailure(std::vector<Segment>& segments, double snapSize)
+{
+	std::string difference;
+	size_t chunk = segments.size() / 2;
+
+	while (chunk > 0)
+	{
+		bool removed = false;
+		size_t start = 0;
+
+		while (start < segments.size())
+		{
+			std::vector<Segment> candidate(segments.begin(), segments.begin() + start);
+			candidate.insert(candidate.end(),
+				segments.begin() + std::min(start + chunk, segments.size()), segments.end());
+
+			if (!checkEngines(candidate, snapSize, difference))
+			{
+				segments.swap(candidate);
+				removed = true;
+			}
+			else
+			{
+				start += chunk;
+			}
+		}
+
+		if (!removed)
+			chunk /= 2;
+		else
+			chunk = std::min(chunk, segments.size());
+	}
+}
+
+// Shrinks a failing input and reports it under title, with the
+// difference and its segments.
+static void reportFailure(const char* title, std::vector<Segment>& segments, double snapSize,
+	std::string& report)
+{
+	std::string difference;
+	shrinkFailure(segments, snapSize);
+	checkEngines(segments, snapSize, difference);
+
+	char line[160];
+	std::sprintf(line, "%s, shrunk to %lu segments\n",
+		title, static_cast<unsigned long>(segments.size()));
+	report += line;
+	report += difference;
+
+	for (size_t k = 0; k < segments.size(); ++k)
+	{
+		std::sprintf(line, "  (%.17g, %.17g) - (%.17g, %.17g)\n",
+			segments[k].a.x, segments[k].a.y, segments[k].b.x, segments[k].b.y);
+		report += line;
+	}
+}
+
+int runDifferentialTest(unsigned int seed, int count, std::string& report)
+{
+	const double snapSize = 1e-3;
+	int failures = 0;
+
+	std::vector<Segment> segments;
+	std::string difference;
+
+	generateSharedNodeOverlaps(segments);
+	if (!checkEngines(segments, snapSize, difference))
+	{
+		++failures;
+		reportFailure("overlapping walls", segments, snapSize, report);
+	}
+
+	for (int i = 0; i < count; ++i)
+	{
+		const unsigned int caseSeed = seed + i;
+		const int size = 2 + i % 9;
+
+		generateRandomPlanar(caseSeed, size, snapSize, segments);
+		if (checkEngines(segments, snapSize, difference))
+			continue;
+
+		++failures;
+
+		char title[64];
+		std::sprintf(title, "seed %u, size %d", caseSeed, size);
+		reportFailure(title, segments, snapSize, report);
+	}
+
+	return failures;
+}
+
+void generateStar(int spokes, std::vector<Segment>& segments)
+{
+	segments.clear();
+	segments.reserve(2 * static_cast<size_t>(std::max(spokes, 0)));
+
+	// Rim points stay cells apart up to millions of spokes.
+	const double radius = 1000.0;
+	const Vec2 hub(0.0, 0.0);
+
+	for (int i = 0; i < spokes; ++i)
+	{
+		const double a0 = 2.0 * kPi * i / spokes;
+		const double a1 = 2.0 * kPi * (i + 1) / spokes;
+		const Vec2 p(radius * std::cos(a0), radius * std::sin(a0));
+		const Vec2 q(radius * std::cos(a1), radius * std::sin(a1));
+
+		segments.push_back(Segment(hub, p));
+		segments.push_back(Segment(p, q));
+	}
+}
+
+void generateSpiral(int segmentCount, std::vector<Segment>& segments)
+{
+	segments.clear();
+
+	// Walls of about 0.1 along the outer spiral, turns 1 apart and the
+	// spirals 0.5 apart; both take the same angles, so the joins at the
+	// ends are radial and nothing crosses.
+	const double wall = 0.1;
+	const int steps = std::max(1, (segmentCount - 2) / 2);
+
+	std::vector<double> angles(steps + 1, 0.0);
+	int i;
+
+	for (i = 1; i <= steps; ++i)
+		angles[i] = angles[i - 1] + wall / (1.5 + angles[i - 1] / (2.0 * kPi));
+
+	segments.reserve(2 * steps + 2);
+
+	for (int spiral = 0; spiral < 2; ++spiral)
+	{
+		const double start = 1.0 + 0.5 * spiral;
+		Vec2 previous(start, 0.0);
+
+		for (i = 1; i <= steps; ++i)
+		{
+			const double r = start + angles[i] / (2.0 * kPi);
+			const Vec2 p(r * std::cos(angles[i]), r * std::sin(angles[i]));
+
+			segments.push_back(Segment(previous, p));
+			previous = p;
+		}
+	}
+
+	// Join the spirals at the center and at the outside.
+	segments.push_back(Segment(segments[0].a, segments[steps].a));
+	segments.push_back(Segment(segments[steps - 1].b, segments[2 * steps - 1].b));
+}
+
+void generateDuplicateWalls(int copies, std::vector<Segment>& segments)
+{
+	segments.clear();
+	segments.reserve(4 * static_cast<size_t>(std::max(copies, 0)));
+
+	const Vec2 corners[4] = { Vec2(0.0, 0.0), Vec2(0.5, 0.0), Vec2(0.5, 0.5), Vec2(0.0, 0.5) };
+
+	for (int c = 0; c < copies; ++c)
+	{
+		for (int k = 0; k < 4; ++k)
+		{
+			const Vec2& a = corners[k];
+			const Vec2& b = corners[(k + 1) % 4];
+			segments.push_back(c % 2 == 0 ? Segment(a, b) : Segment(b, a));
+		}
+	}
+}
+
+void generateOverlappingWalls(int count, unsigned int seed, std::vector<Segment>& segments)
+{
+	BenchRandom random(seed);
+	segments.clear();
+	segments.reserve(static_cast<size_t>(std::max(count, 0)) + 4);
+
+	const double length = std::max(1.0, 0.01 * count);
+
+	// The outline, with its full bottom wall.
+	segments.push_back(Segment(Vec2(0.0, 0.0), Vec2(length, 0.0)));
+	segments.push_back(Segment(Vec2(length, 0.0), Vec2(length, 1.0)));
+	segments.push_back(Segment(Vec2(length, 1.0), Vec2(0.0, 1.0)));
+	segments.push_back(Segment(Vec2(0.0, 1.0), Vec2(0.0, 0.0)));
+
+	for (int i = 0; i < count; ++i)
+	{
+		const double a = random.unit() * length;
+		const double b = random.unit() * length;
+		segments.push_back(Segment(Vec2(a, 0.0), Vec2(b, 0.0)));
+	}
+}
+
+void generateWideRange(int squares, std::vector<Segment>& segments)
+{
+	segments.clear();
+
+	const int side = std::max(1, static_cast<int>(std::ceil(std::sqrt(static_cast<double>(squares)))));
+	const double spacing = 2e6 / side;
+	const double size = 0.01;
+	const double outline = 1.05e6;
+
+	segments.reserve(4 * static_cast<size_t>(std::max(squares, 0)) + 4);
+
+	for (int i = 0; i < squares; ++i)
+	{
+		const double x = -1e6 + (i % side) * spacing;
+		const double y = -1e6 + (i / side) * spacing;
+
+		segments.push_back(Segment(Vec2(x, y), Vec2(x + size, y)));
+		segments.push_back(Segment(Vec2(x + size, y), Vec2(x + size, y + size)));
+		segments.push_back(Segment(Vec2(x + size, y + size), Vec2(x, y + size)));
+		segments.push_back(Segment(Vec2(x, y + size), Vec2(x, y)));
+	}
+
+	segments.push_back(Segment(Vec2(-outline, -outline), Vec2(outline, -outline)));
+	segments.push_back(Segment(Vec2(outline, -outline), Vec2(outline, outline)));
+	segments.push_back(Segment(Vec2(outline, outline), Vec2(-outline, outline)));
+	segments.push_back(Segment(Vec2(-outline, outline), Vec2(-outline, -outline)));
+}
+
+// Generators of the scaling families, by segment count.
+static void starOfSize(int size, std::vector<Segment>& segments)
+{
+	generateStar(size / 2, segments);
+}
+
+static void duplicatesOfSize(int size, std::vector<Segment>& segments)
+{
+	generateDuplicateWalls(size / 4, segments);
+}
+
+static void overlappingOfSize(int size, std::vector<Segment>& segments)
+{
+	generateOverlappingWalls(size, 1, segments);
+}
+
+static void denseGridOfSize(int size, std::vector<Segment>& segments)
+{
+	const int cells = std::max(1, static_cast<int>(std::sqrt(size / 2.0)));
+	generateGrid(cells, cells, 0.01, segments);
+}
+
+static void wideRangeOfSize(int size, std::vector<Segment>& segments)
+{
+	generateWideRange(size / 4, segments);
+}
+
+static void addFamily(const char* name, int largest, void (*generate)(int, std::vector<Segment>&),
+	const RoomGraph::Options& options, std::vector<ScalingFamily>& families)
+{
+	families.push_back(ScalingFamily());
+	families.back().name = name;
+	families.back().largest = largest;
+	families.back().options = options;
+	families.back().generate = generate;
+}
+
+void makeScalingFamilies(std::vector<ScalingFamily>& families)
+{
+	families.clear();
+
+	RoomGraph::Options plain;
+	RoomGraph::Options merging;
+	merging.mergeCollinear = true;
+
+	addFamily("star", 200000, starOfSize, plain, families);
+	addFamily("spiral", 200000, generateSpiral, plain, families);
+	addFamily("duplicates", 40000, duplicatesOfSize, plain, families);
+	addFamily("overlap", 200000, overlappingOfSize, merging, families);
+	addFamily("dense", 200000, denseGridOfSize, plain, families);
+	addFamily("wide", 200000, wideRangeOfSize, plain, families);
+}
+
+double fitScalingExponent(const std::vector<size_t>& segments, const std::vector<double>& times)
+{
+	const size_t n = std::min(segments.size(), times.size());
+	double sx = 0.0;
+	double sy = 0.0;
+	size_t i;
+
+	for (i = 0; i < n; ++i)
+	{
+		sx += std::log(static_cast<double>(std::max<size_t>(segments[i], 1)));
+		sy += std::log(std::max(times[i], 1e-6));
+	}
+
+	if (n < 2)
+		return 0.0;
+
+	const double mx = sx / n;
+	const double my = sy / n;
+	double sxx = 0.0;
+	double sxy = 0.0;
+
+	for (i = 0; i < n; ++i)
+	{
+		const double dx = std::log(static_cast<double>(std::max<size_t>(segments[i], 1))) - mx;
+		sxx += dx * dx;
+		sxy += dx * (std::log(std::max(times[i], 1e-6)) - my);
+	}
+
+	return sxx > 0.0 ? sxy / sxx : 0.0;
+}
+
+// Stand-in for a half-edge in randomReadMs().
+struct ReadRecord
+{
+	int value;
+	int padding[7];
+};
+
+// Keeps the reads of randomReadMs() from being optimized away.
+static volatile int s_readSink = 0;
+
+double randomReadMs(size_t count, int repetitions)
+{
+	std::vector<ReadRecord> records(std::max<size_t>(count, 1));
+	std::vector<int> order(records.size());
+	size_t i;
+
+	for (i = 0; i < records.size(); ++i)
+	{
+		records[i].value = static_cast<int>(i);
+		order[i] = static_cast<int>(i);
+	}
+
+	BenchRandom random(0x2545f491u);
+	for (i = order.size() - 1; i > 0; --i)
+		std::swap(order[i], order[random.below(static_cast<int>(i) + 1)]);
+
+	std::vector<double> times;
+	int sum = 0;
+
+	for (int run = 0; run < std::max(1, repetitions); ++run)
+	{
+		const double start = monotonicMs();
+
+		for (i = 0; i < order.size(); ++i)
+			sum += records[order[i]].value;
+
+		times.push_back(monotonicMs() - start);
+	}
+
+	s_readSink = sum;
+	return median(times);
+}
+
+int checkScaling(const ScalingSettings& settings, std::vector<ScalingResult>& results, std::string& report)
+{
+	std::vector<ScalingFamily> families;
+	makeScalingFamilies(families);
+
+	const int steps = std::max(2, settings.steps);
+	int overLimit = 0;
+	char line[256];
+
+	for (size_t f = 0; f < families.size(); ++f)
+	{
+		const ScalingFamily& family = families[f];
+
+		// One result per stage and the total, in runBenchCase() order.
+		const size_t first = results.size();
+		results.resize(first + RoomGraph::StageCount + 1);
+
+		std::vector<BenchCase> cases(steps);
+		int step;
+
+		for (step = 0; step < steps; ++step)
+		{
+			const double size = family.largest * settings.scale / static_cast<double>(1 << (steps - 1 - step));
+
+			cases[step].name = family.name;
+			cases[step].options = family.options;
+			family.generate(std::max(8, static_cast<int>(size)), cases[step].segments);
+		}
+
+		// One build of every size per round; each size keeps its fastest.
+		std::vector<std::vector<double> > fastest(steps);
+		std::vector<double> fastestRead(steps, 0.0);
+
+		for (int round = 0; round < std::max(1, settings.repetitions); ++round)
+		{
+			for (step = 0; step < steps; ++step)
+			{
+				std::vector<BenchResult> times;
+				runBenchCase(cases[step], 1, times);
+
+				// Two half-edges per segment.
+				const double readMs = randomReadMs(2 * cases[step].segments.size(), 1);
+
+				if (round == 0 || readMs < fastestRead[step])
+					fastestRead[step] = readMs;
+
+				fastest[step].resize(times.size(), 0.0);
+				for (size_t k = 0; k < times.size(); ++k)
+				{
+					if (round == 0 || times[k].median < fastest[step][k])
+						fastest[step][k] = times[k].median;
+				}
+			}
+		}
+
+		for (step = 0; step < steps; ++step)
+		{
+			for (size_t k = 0; k < fastest[step].size() && first + k < results.size(); ++k)
+			{
+				ScalingResult& r = results[first + k];
+				const int stage = static_cast<int>(k);
+
+				r.family = family.name;
+				r.stage = stage < RoomGraph::StageCount ? RoomGraph::stageName(stage) : "total";
+				r.memoryBound = stage == RoomGraph::StageLink || stage == RoomGraph::StageWalk;
+				r.segments.push_back(cases[step].segments.size());
+				r.fastest.push_back(fastest[step][k]);
+
+				if (r.memoryBound)
+					r.readMs.push_back(fastestRead[step]);
+			}
+		}
+
+		for (size_t k = first; k < results.size(); ++k)
+		{
+			ScalingResult& r = results[k];
+
+			if (r.memoryBound)
+			{
+				// The time in units of one random read at the same size.
+				std::vector<double> reads(r.fastest.size());
+				for (size_t i = 0; i < reads.size(); ++i)
+					reads[i] = r.fastest[i] * r.segments[i] / std::max(r.readMs[i], 1e-6);
+
+				r.exponent = fitScalingExponent(r.segments, reads);
+			}
+			else
+			{
+				r.exponent = fitScalingExponent(r.segments, r.fastest);
+			}
+
+			r.judged = !r.fastest.empty() && r.fastest.back() >= settings.minMs;
+			r.withinLimit = !r.judged || r.exponent <= settings.maxExponent;
+
+			if (!r.withinLimit)
+				++overLimit;
+
+			std::sprintf(line, "%-10s %-8s %8lu segments %10.3f ms  exponent %5.2f%s%s\n",
+				r.family.c_str(), r.stage.c_str(),
+				static_cast<unsigned long>(r.segments.empty() ? 0 : r.segments.back()),
+				r.fastest.empty() ? 0.0 : r.fastest.back(), r.exponent,
+				r.memoryBound ? " in random reads" : "",
+				!r.judged ? "  (too fast to judge)" : r.withinLimit ? "" : "  TOO STEEP");
+			report += line;
+		}
+	}
+
+	std::sprintf(line, "%d stage(s) grow faster than segments^%.2f\n", overLimit, settings.maxExponent);
+	report += line;
+
+	return overLimit;
+}
+
+double serialFraction(double speedup, int threads)
+{
+	if (threads <= 1 || speedup <= 0.0)
+		return 0.0;
+
+	const double p = static_cast<double>(threads);
+	return (1.0 / speedup - 1.0 / p) / (1.0 - 1.0 / p);
+}
+
+void runThreadScaling(const ThreadScalingSettings& settings, std::vector<ThreadScalingResult>& results)
+{
+	const int maxThreads = settings.maxThreads > 0 ? settings.maxThreads : hardwareThreadCount();
+
+	std::vector<int> threadCounts;
+	for (int t = 1; t < maxThreads; t *= 2)
+		threadCounts.push_back(t);
+	threadCounts.push_back(maxThreads);
+
+	std::vector<BenchCase> cases;
+	makeBenchMatrix(settings.scale, cases);
+
+	for (size_t c = 0; c < cases.size(); ++c)
+	{
+		// Medians at one thread, per stage, to compare the others with.
+		std::vector<double> serial;
+
+		for (size_t k = 0; k < threadCounts.size(); ++k)
+		{
+			BenchCase benchCase = cases[c];
+			benchCase.options.threads = threadCounts[k];
+
+			std::vector<BenchResult> times;
+			runBenchCase(benchCase, settings.repetitions, times);
+
+			for (size_t s = 0; s < times.size(); ++s)
+			{
+				if (k == 0)
+					serial.push_back(times[s].median);
+
+				ThreadScalingResult r;
+				r.caseName = times[s].caseName;
+				r.segments = times[s].segments;
+				r.stage = times[s].stage;
+				r.threads = threadCounts[k];
+				r.median = times[s].median;
+				r.speedup = r.median > 0.0 && s < serial.size() ? serial[s] / r.median : 1.0;
+				r.efficiency = r.speedup / r.threads;
+				r.serialFraction = serialFraction(r.speedup, r.threads);
+
+				results.push_back(r);
+			}
+		}
+	}
+}
+
+bool writeThreadScalingCsv(const std::string& path, const std::vector<ThreadScalingResult>& results)
+{
+	std::FILE* file = std::fopen(path.c_str(), "w");
+	if (file == NULL)
+		return false;
+
+	std::fprintf(file, "case,segments,stage,threads,median_ms,speedup,efficiency,serial_fraction\n");
+
+	for (size_t i = 0; i < results.size(); ++i)
+	{
+		const ThreadScalingResult& r = results[i];
+		std::fprintf(file, "%s,%lu,%s,%d,%.6f,%.4f,%.4f,%.4f\n",
+			r.caseName.c_str(), static_cast<unsigned long>(r.segments), r.stage.c_str(),
+			r.threads, r.median, r.speedup, r.efficiency, r.serialFraction);
+	}
+
+	return std::fclose(file) == 0;
+}
+
+void formatThreadScaling(const std::vector<ThreadScalingResult>& results, std::string& table)
+{
+	char line[256];
+	int most = 1;
+	size_t i;
+
+	for (i = 0; i < results.size(); ++i)
+		most = std::max(most, results[i].threads);
+
+	// A block per case, in it the thread counts of each stage together.
+	size_t first = 0;
+	while (first < results.size())
+	{
+		size_t last = first;
+		while (last < results.size() && results[last].caseName == results[first].caseName
+			&& results[last].segments == results[first].segments)
+		{
+			++last;
+		}
+
+		std::sprintf(line, "\n%s (%lu segments)\n%-8s %7s %10s %8s %10s %8s\n",
+			results[first].caseName.c_str(), static_cast<unsigned long>(results[first].segments),
+			"stage", "threads", "ms", "speedup", "efficiency", "serial");
+		table += line;
+
+		// The first thread count lists every stage once.
+		for (size_t s = first; s < last && results[s].threads == results[first].threads; ++s)
+		{
+			for (i = first; i < last; ++i)
+			{
+				const ThreadScalingResult& r = results[i];
+				if (r.stage != results[s].stage)
+					continue;
+
+				std::sprintf(line, "%-8s %7d %10.3f %7.2fx %9.0f%% %8.3f\n",
+					r.stage.c_str(), r.threads, r.median, r.speedup, 100.0 * r.efficiency, r.serialFraction);
+				table += line;
+
+				// Amdahl's limit from the most threads measured.
+				if (r.threads == most && most > 1 && r.serialFraction > 0.0)
+				{
+					std::sprintf(line, "%-8s serial %.1f%%, speedup at most %.1fx\n",
+						"", 100.0 * r.serialFraction, 1.0 / r.serialFraction);
+					table += line;
+				}
+			}
+		}
+
+		first = last;
+	}
+}
+
+static const char* strategyName(int strategy)
+{
+	static const char* names[RoomGraph::StrategyCount] = { "sorted", "parallel", "map" };
+	return strategy >= 0 && strategy < RoomGraph::StrategyCount ? names[strategy] : "default";
+}
+
+// Median total of a case built with a strategy.
+static double strategyMs(const BenchCase& benchCase, int strategy, int threads, int repetitions)
+{
+	BenchCase tuned = benchCase;
+	tuned.options.strategy = strategy;
+	tuned.options.threads = threads;
+	tuned.options.metrics = false;
+
+	std::vector<BenchResult> times;
+	runBenchCase(tuned, repetitions, times);
+
+	return times.back().median;
+}
+
+int trainCostModel(const TuningSettings& settings, CostModel& model, std::string& report)
+{
+	const int threads = settings.threads > 0 ? settings.threads : hardwareThreadCount();
+
+	// Measured medians per case and strategy, to judge the picks after
+	// the fit.
+	std::vector<BenchCase> cases;
+	std::vector<RoomGraph::InputProfile> profiles;
+	std::vector<double> measured;
+
+	int step;
+	int s;
+	size_t c;
+
+	for (step = 0; step < settings.steps; ++step)
+	{
+		std::vector<BenchCase> matrix;
+		makeBenchMatrix(settings.scale / (1 << step), matrix);
+
+		for (c = 0; c < matrix.size(); ++c)
+		{
+			// The profile the sampling pass sees, after any clean-up.
+			RoomGraph graph;
+			RoomGraph::Options options = matrix[c].options;
+			options.strategy = RoomGraph::StrategyAuto;
+			options.metrics = false;
+			graph.setOptions(options);
+			graph.build(matrix[c].segments);
+
+			const RoomGraph::InputProfile profile = graph.getStats().plan.profile;
+
+			for (s = 0; s < RoomGraph::StrategyCount; ++s)
+			{
+				double ms = 0.0;
+				if (s != RoomGraph::StrategyParallel || threads > 1)
+				{
+					ms = strategyMs(matrix[c], s, threads, settings.repetitions);
+					model.addSample(s, profile, ms);
+				}
+				measured.push_back(ms);
+			}
+
+			cases.push_back(matrix[c]);
+			cases.back().segments.clear();
+			profiles.push_back(profile);
+		}
+	}
+
+	model.fit();
+
+	char line[256];
+	int mispicked = 0;
+
+	std::sprintf(line, "%-10s %8s %10s  coefficients (ms per feature)\n", "strategy", "samples", "rms ms");
+	report += line;
+
+	for (s = 0; s < RoomGraph::StrategyCount; ++s)
+	{
+		std::sprintf(line, "%-10s %8lu %10.3f ", strategyName(s),
+			static_cast<unsigned long>(model.getSampleCount(s)), model.getFitError(s));
+		report += line;
+
+		for (int f = 0; f < CostFeatureCount; ++f)
+		{
+			std::sprintf(line, " %.4g", model.getCoefficient(s, f));
+			report += line;
+		}
+		report += "\n";
+	}
+
+	std::sprintf(line, "\n%-18s %9s %10s %10s %10s\n", "case", "segments", "picked", "fastest", "slower");
+	report += line;
+
+	for (c = 0; c < cases.size(); ++c)
+	{
+		const double* times = &measured[c * RoomGraph::StrategyCount];
+
+		double predicted[RoomGraph::StrategyCount];
+		const int picked = model.choose(profiles[c], threads, predicted);
+
+		int fastest = RoomGraph::StrategySorted;
+		for (s = 0; s < RoomGraph::StrategyCount; ++s)
+		{
+			if (times[s] > 0.0 && times[s] < times[fastest])
+				fastest = s;
+		}
+
+		const double slower = times[fastest] > 0.0 ? times[picked] / times[fastest] - 1.0 : 0.0;
+		const bool wrong = slower > 0.1;
+		if (wrong)
+			++mispicked;
+
+		std::sprintf(line, "%-18s %9lu %10s %10s %9.1f%%%s\n",
+			cases[c].name.c_str(), static_cast<unsigned long>(profiles[c].segments),
+			strategyName(picked), strategyName(fastest), 100.0 * slower, wrong ? "  MISPICK" : "");
+		report += line;
+	}
+
+	return mispicked;
+}
+
+// Print ASCII text through acutPrintf, one line at a time.
+static void printReport(const std::string& report)
+{
+	TCHAR line[256];
+	size_t length = 0;
+
+	for (size_t i = 0; i <= report.size(); ++i)
+	{
+		if (i == report.size() || report[i] == '\n' || length + 1 == sizeof(line) / sizeof(line[0]))
+		{
+			line[length] = 0;
+			if (length > 0)
+				acutPrintf(_T("\n%s"), line);
+			length = 0;
+		}
+
+		if (i < report.size() && report[i] != '\n')
+			line[length++] = static_cast<TCHAR>(report[i]);
+	}
+}
+
+//////////////////////////////////////////////////////////////////////////
+// Command: run the benchmark matrix, write roomgraph-bench.json and
+// compare it with roomgraph-bench-baseline.json when that file exists
+// (both in the current directory). Copy the results over the baseline to
+// accept them.
+void Cmd_RoomGraphBench()
+{
+	const std::string outputPath = "roomgraph-bench.json";
+	const std::string baselinePath = "roomgraph-bench-baseline.json";
+
+	std::FILE* baselineFile = std::fopen(baselinePath.c_str(), "r");
+	const bool hasBaseline = baselineFile != NULL;
+	if (baselineFile != NULL)
+		std::fclose(baselineFile);
+
+	acutPrintf(_T("\nRunning benchmarks..."));
+
+	std::string report;
+	const int status = runBenchmarkGate(BenchSettings(), GateSettings(),
+		outputPath, hasBaseline ? baselinePath : std::string(), report);
+
+	printReport(report);
+
+	if (status == 0)
+		acutPrintf(_T("\nBenchmark gate passed."));
+	else if (status == 1)
+		acutPrintf(_T("\nBenchmark gate FAILED: slower than the baseline."));
+	else
+		acutPrintf(_T("\nBenchmark gate could not run."));
+}
+
+//////////////////////////////////////////////////////////////////////////
+// Command: differential test of every engine against the reference on
+// 500 random inputs. Failing inputs are printed shrunk.
+void Cmd_RoomGraphCheck()
+{
+	acutPrintf(_T("\nChecking engines against the reference..."));
+
+	std::string report;
+	const int failures = runDifferentialTest(1, 500, report);
+
+	printReport(report);
+
+	if (failures == 0)
+		acutPrintf(_T("\nAll engines agree with the reference."));
+	else
+		acutPrintf(_T("\n%d input(s) FAILED."), failures);
+}
+
+//////////////////////////////////////////////////////////////////////////
+// Command: run the adversarial inputs at growing sizes and report how
+// fast every stage grows with the input.
+void Cmd_RoomGraphScaling()
+{
+	acutPrintf(_T("\nRunning scaling checks..."));
+
+	std::string report;
+	std::vector<ScalingResult> results;
+	const int overLimit = checkScaling(ScalingSettings(), results, report);
+
+	printReport(report);
+
+	if (overLimit == 0)
+		acutPrintf(_T("\nEvery stage within its complexity."));
+	else
+		acutPrintf(_T("\nScaling check FAILED."));
+}
+
+//////////////////////////////////////////////////////////////////////////
+// Command: run the benchmark matrix at 1, 2, 4, ... threads up to one per
+// processor, write roomgraph-threads.csv in the current directory and
+// print speedup, efficiency and serial fraction per stage.
+void Cmd_RoomGraphThreads()
+{
+	const std::string outputPath = "roomgraph-threads.csv";
+
+	acutPrintf(_T("\nRunning thread scaling..."));
+
+	std::vector<ThreadScalingResult> results;
+	runThreadScaling(ThreadScalingSettings(), results);
+
+	std::string table;
+	formatThreadScaling(results, table);
+	printReport(table);
+
+	if (writeThreadScalingCsv(outputPath, results))
+		acutPrintf(_T("\nResults written to %s."), _T("roomgraph-threads.csv"));
+	else
+		acutPrintf(_T("\nCould not write %s."), _T("roomgraph-threads.csv"));
+}
+
+//////////////////////////////////////////////////////////////////////////
+// Command: replay a capture of a slow build (see BuildCapture.h) as it
+// was captured, with each clean-up option and thread count switched, and
+// auto-tuned, profiling every stage with hardware counters where
+// available.
+void Cmd_RoomGraphReplay()
+{
+	TCHAR input[512];
+	if (acedGetString(0, _T("\nCapture file: "), input) != RTNORM || input[0] == 0)
+		return;
+
+	std::string path;
+	for (int i = 0; input[i] != 0; ++i)
+		path += static_cast<char>(input[i]);
+
+	BuildCapture capture;
+	if (!readBuildCapture(path, capture))
+	{
+		acutPrintf(_T("\nNot a readable capture file."));
+		return;
+	}
+
+	RoomGraph::Options captured = capture.options;
+	captured.hardwareCounters = true;
+
+	// The strategy the captured build took, not a new pick.
+	if (capture.stats.plan.threads > 0)
+	{
+		captured.strategy = capture.stats.plan.strategy;
+		captured.threads = capture.stats.plan.threads;
+	}
+	captured.validate = true;
+
+	std::vector<RoomGraph::Options> configurations;
+	std::vector<const TCHAR*> names;
+
+	configurations.push_back(captured);
+	names.push_back(_T("as captured"));
+
+	RoomGraph::Options changed = captured;
+	changed.mergeCollinear = !captured.mergeCollinear;
+	configurations.push_back(changed);
+	names.push_back(changed.mergeCollinear ? _T("with collinear merging") : _T("without collinear merging"));
+
+	changed = captured;
+	changed.snapRounding = !captured.snapRounding;
+	configurations.push_back(changed);
+	names.push_back(changed.snapRounding ? _T("with snap rounding") : _T("without snap rounding"));
+
+	changed = captured;
+	changed.threads = captured.threads == 1 ? 0 : 1;
+	configurations.push_back(changed);
+	names.push_back(changed.threads == 1 ? _T("on one thread") : _T("on all processors"));
+
+	changed = captured;
+	changed.strategy = RoomGraph::StrategyAuto;
+	changed.threads = 0;
+	configurations.push_back(changed);
+	names.push_back(_T("auto-tuned"));
+
+	for (size_t c = 0; c < configurations.size(); ++c)
+	{
+		acutPrintf(_T("\nReplaying %s..."), names[c]);
+
+		ReplayResult result;
+		replayCapture(capture, configurations[c], 5, result);
+
+		std::string report;
+		formatReplay(capture, result, report);
+		printReport(report);
+	}
+}
+
+//////////////////////////////////////////////////////////////////////////
+// Command: train the cost model of the auto-tuned strategy on this
+// machine and write it to roomgraph-costmodel.rgc in the current
+// directory, for CostModel::load().
+void Cmd_RoomGraphTune()
+{
+	acutPrintf(_T("\nTraining the cost model..."));
+
+	CostModel model;
+	std::string report;
+	const int mispicked = trainCostModel(TuningSettings(), model, report);
+
+	printReport(report);
+
+	if (!model.save("roomgraph-costmodel.rgc"))
+		acutPrintf(_T("\nCould not write %s."), _T("roomgraph-costmodel.rgc"));
+	else if (mispicked == 0)
+		acutPrintf(_T("\nCost model written; no pick is more than 10%% slower than the fastest."));
+	else
+		acutPrintf(_T("\nCost model written; %d case(s) picked more than 10%% slower."), mispicked);
+}
@@ -0,0 +1,345 @@
+#ifndef ROOMGRAPHBENCH_H
+#define ROOMGRAPHBENCH_H
+
+#include <vector>
+#include <string>
+#include "Geometry.h"
+#include "RoomGraph.h"
+#include "BuildPlanner.h"
+
+// Small deterministic random generator (xorshift), so generated inputs
+// are the same on every platform and baselines stay comparable.
+class BenchRandom
+{
+public:
+	explicit BenchRandom(unsigned int seed);
+
+	unsigned int next();
+
+	// Uniform in [0, n).
+	int below(int n);
+
+	// Uniform in [0, 1).
+	double unit();
+
+private:
+	unsigned int m_state;
+};
+
+// Input generators. All produce walls that meet at their endpoints, as
+// the plain build expects.
+
+// columns x rows square cells of the given size, one segment per cell side.
+void generateGrid(int columns, int rows, double cell, std::vector<Segment>& segments);
+
+// Office-like plan: a grid with a share of the inner walls removed, so
+// rooms of many shapes and some dangling walls appear.
+void generateFloorPlan(int columns, int rows, double removedShare, unsigned int seed,
+	std::vector<Segment>& segments);
+
+// Moves every endpoint by up to jitter in x and y and shuffles the
+// segments and their direction; exercises snapping and node dedup.
+void jitterSegments(std::vector<Segment>& segments, double jitter, unsigned int seed);
+
+// One input of the benchmark matrix.
+struct BenchCase
+{
+	std::string          name;
+	std::vector<Segment> segments;
+	RoomGraph::Options   options;
+};
+
+// The fixed matrix: grids, floor plans, jittered input and a case with
+// collinear merging, at sizes multiplied by scale (1 = the default,
+// about 20k to 200k segments).
+void makeBenchMatrix(double scale, std::vector<BenchCase>& cases);
+
+// Time of one stage of one case ("total" for the whole build) over
+// repeated builds: median and median absolute deviation, in ms.
+struct BenchResult
+{
+	std::string caseName;
+	size_t      segments;
+	std::string stage;
+	double      median;
+	double      mad;
+	int         runs;
+
+	BenchResult() : caseName(), segments(0), stage(), median(0.0), mad(0.0), runs(0) {}
+};
+
+struct BenchSettings
+{
+	double scale;       // size of the matrix, see makeBenchMatrix()
+	int    repetitions; // measured builds per case, after one warm-up
+
+	BenchSettings() : scale(1.0), repetitions(9) {}
+};
+
+// Run every case of the matrix and append one result per stage and one
+// for the total.
+void runBenchmarks(const BenchSettings& settings, std::vector<BenchResult>& results);
+void runBenchCase(const BenchCase& benchCase, int repetitions, std::vector<BenchResult>& results);
+
+// Results as JSON, one result object per line. readBenchJson() reads
+// files written by writeBenchJson().
+bool writeBenchJson(const std::string& path, const std::vector<BenchResult>& results);
+bool readBenchJson(const std::string& path, std::vector<BenchResult>& results);
+
+// When a slowdown counts as a regression: the median must grow by more
+// than noiseFactor times the combined MAD (scaled to a standard
+// deviation), and by more than minRelative of the baseline and
+// minAbsoluteMs.
+struct GateSettings
+{
+	double noiseFactor;
+	double minRelative;
+	double minAbsoluteMs;
+
+	GateSettings() : noiseFactor(3.0), minRelative(0.05), minAbsoluteMs(0.05) {}
+};
+
+// Compare current results with a baseline, matched by case, size and
+// stage. Appends one line per compared stage to report, marking
+// regressions, and returns their number.
+int compareWithBaseline(const std::vector<BenchResult>& baseline, const std::vector<BenchResult>& current,
+	const GateSettings& gate, std::string& report);
+
+// Run the matrix, write results to outputPath, and compare them with
+// baselinePath unless it is empty. Returns an exit code: 0 without
+// regressions, 1 with, 2 if a file could not be read or written.
+int runBenchmarkGate(const BenchSettings& settings, const GateSettings& gate,
+	const std::string& outputPath, const std::string& baselinePath, std::string& report);
+
+// Differential testing: every engine configuration against the
+// reference of ReferenceRooms.h.
+
+// Random small input on a lattice of size x size cells with the cases
+// that tend to break things: missing and split walls, diagonals, thin
+// slivers, walls ending on other walls, islands, dangling, zero-length
+// and duplicated walls (short ones too), and endpoints jittered close to
+// the snap cell borders.
+void generateRandomPlanar(unsigned int seed, int size, double snapSize, std::vector<Segment>& segments);
+
+// Walls overlapping along one line from shared nodes, on coordinates
+// exact in binary so that they are exactly collinear. Node numbers go by
+// first appearance, and the far end of one overlapping wall comes before
+// the shared node while the near end comes after it.
+void generateSharedNodeOverlaps(std::vector<Segment>& segments);
+
+// Engine configurations compared with the reference.
+enum BenchEngine
+{
+	EnginePlain,         // build()
+	EngineWarm,          // build() on a graph built before
+	EngineExternal,      // external node dedup, multi-pass
+	EngineAnytime,       // anytime build with an unlimited budget
+	EngineVersions,      // walls removed, then the first version checked out
+	EngineTiled,         // TiledRoomBuilder with small tiles
+	EngineMerge,         // collinear merging
+	EngineSnapRounding,  // snap rounding
+	EngineCount
+};
+
+const char* engineName(int engine);
+
+// Rooms of one engine, and the reference rooms for the same engine:
+// built from the same cleaned segments where the engine cleans them up.
+void runEngine(int engine, const std::vector<Segment>& segments, double snapSize,
+	std::vector<RoomGraph::Room>& rooms);
+void runReference(int engine, const std::vector<Segment>& segments, double snapSize,
+	std::vector<RoomGraph::Room>& rooms);
+
+// Same rooms in any order, polygons compared by snap cells up to
+// rotation, areas and centroids up to rounding. Describes the first
+// difference otherwise.
+bool sameRooms(const std::vector<RoomGraph::Room>& expected, const std::vector<RoomGraph::Room>& actual,
+	double snapSize, std::string& difference);
+
+// All engines against the reference, the merged input of the merge
+// engine free of duplicated walls, and the snap-rounding engine's input
+// fully noded; false with the engine and the difference of the first
+// mismatch.
+bool checkEngines(const std::vector<Segment>& segments, double snapSize, std::string& difference);
+
+// Remove segments from a failing input for as long as checkEngines()
+// still fails, down to an input where removing any one segment passes.
+void shrinkFailure(std::vector<Segment>& segments, double snapSize);
+
+// Check generateSharedNodeOverlaps(), then count random inputs, seeds from
+// seed on. Every failure is shrunk and reported with its seed and
+// segments. Returns the number of failures.
+int runDifferentialTest(unsigned int seed, int count, std::string& report);
+
+// Adversarial inputs, for the scaling checks.
+
+// One hub with spokes walls to a rim of as many walls: a node of degree
+// spokes, and as many thin triangles.
+void generateStar(int spokes, std::vector<Segment>& segments);
+
+// Two interleaved spirals of short walls joined at both ends: a single
+// corridor room with about segmentCount vertices.
+void generateSpiral(int segmentCount, std::vector<Segment>& segments);
+
+// A unit square with each wall copies times, every second copy reversed:
+// parallel half-edges by the thousand at the corners.
+void generateDuplicateWalls(int copies, std::vector<Segment>& segments);
+
+// A long thin room whose bottom wall is count overlapping collinear
+// pieces at random offsets, for collinear merging.
+void generateOverlappingWalls(int count, unsigned int seed, std::vector<Segment>& segments);
+
+// squares tiny squares spread over +-1e6, inside one square outline:
+// features of a few snap cells at the largest coordinates that the int
+// snap cells of the default snap size can take.
+void generateWideRange(int squares, std::vector<Segment>& segments);
+
+// An input family: the same kind of input at growing sizes.
+struct ScalingFamily
+{
+	std::string        name;
+	int                largest; // segments of the largest size, at scale 1
+	RoomGraph::Options options;
+
+	// Input of about size segments.
+	void (*generate)(int size, std::vector<Segment>& segments);
+};
+
+// Star, spiral, duplicated walls, overlapping collinear walls, a dense
+// grid of short walls and the wide coordinate range.
+void makeScalingFamilies(std::vector<ScalingFamily>& families);
+
+struct ScalingSettings
+{
+	double scale;       // multiplies the largest size of every family
+	int    steps;       // sizes per family, halving from the largest
+	int    repetitions; // rounds, one measured build of every size each
+	double maxExponent; // steepest growth accepted, see checkScaling()
+	double minMs;       // stages faster than this at the largest size are not judged
+
+	ScalingSettings() : scale(1.0), steps(4), repetitions(5), maxExponent(1.3), minMs(1.0) {}
+};
+
+// Fastest times of one stage of one family at each size, and the
+// exponent k of the time ~ segments^k fitted to them. For the stages
+// bound by memory latency (linking and walking) the exponent is fitted
+// to the time in units of one random read, from randomReadMs() at the
+// same size.
+struct ScalingResult
+{
+	std::string         family;
+	std::string         stage;
+	std::vector<size_t> segments;
+	std::vector<double> fastest;
+	std::vector<double> readMs; // empty unless memoryBound
+	double              exponent;
+	bool                memoryBound;
+	bool                judged;
+	bool                withinLimit;
+
+	ScalingResult()
+		: family(),
+		stage(),
+		segments(),
+		fastest(),
+		readMs(),
+		exponent(0.0),
+		memoryBound(false),
+		judged(false),
+		withinLimit(true)
+	{
+	}
+};
+
+// Least-squares slope of log(time) over log(segments).
+double fitScalingExponent(const std::vector<size_t>& segments, const std::vector<double>& times);
+
+// Median time of repetitions passes reading count 32-byte records, about
+// a half-edge each, in a random order. Its growth per record is what the
+// caches and the TLB add once the records outgrow them.
+double randomReadMs(size_t count, int repetitions);
+
+// Every stage of build() is meant to be O(n log n) or better in the
+// number of segments, whatever the input: time must not grow faster than
+// segments^maxExponent. Linking and walking chase half-edges all over
+// the graph, so their time per segment grows with the sizes as the
+// graph outgrows the caches, by as much as a random read does (about
+// segments^1.5 between these sizes on some machines). They are judged
+// in units of a random read at each size instead, which keeps the limit
+// tight for every stage: a quadratic stage still comes out near 2. Runs
+// every family at every size, one result per stage and one for the
+// total, a line per result in report. Returns the number of results
+// over the limit. The sizes of a family take turns round by round, so
+// a machine getting faster or slower during the check does not bend the
+// fit.
+int checkScaling(const ScalingSettings& settings, std::vector<ScalingResult>& results, std::string& report);
+
+// Thread scaling: the parallel steps of build() at 1, 2, 4, ... threads.
+
+// Median time of one stage of one case at one thread count, and what it
+// says about the parallel part of the stage.
+struct ThreadScalingResult
+{
+	std::string caseName;
+	size_t      segments;
+	std::string stage;
+	int         threads;
+	double      median;
+	double      speedup;        // median at 1 thread / median here
+	double      efficiency;     // speedup / threads
+	double      serialFraction; // Karp-Flatt estimate, see serialFraction()
+
+	ThreadScalingResult()
+		: caseName(), segments(0), stage(), threads(1), median(0.0),
+		speedup(1.0), efficiency(1.0), serialFraction(0.0)
+	{
+	}
+};
+
+struct ThreadScalingSettings
+{
+	double scale;       // size of the matrix, see makeBenchMatrix()
+	int    maxThreads;  // highest thread count, 0 = one per processor
+	int    repetitions; // measured builds per case and thread count
+
+	ThreadScalingSettings() : scale(1.0), maxThreads(0), repetitions(5) {}
+};
+
+// Serial fraction f of Amdahl's law, speedup = 1 / (f + (1 - f) / threads),
+// solved for f from one measured speedup (the Karp-Flatt metric). 1 / f
+// bounds the speedup of any thread count. 0 for one thread.
+double serialFraction(double speedup, int threads);
+
+// Every case of the benchmark matrix with Options::threads at 1, 2, 4,
+// ... and maxThreads, one result per case, stage and thread count, and
+// one for the total.
+void runThreadScaling(const ThreadScalingSettings& settings, std::vector<ThreadScalingResult>& results);
+
+// The results as CSV, one line per result, with a header line.
+bool writeThreadScalingCsv(const std::string& path, const std::vector<ThreadScalingResult>& results);
+
+// The results as a table, a block per case, and for every stage the
+// speedup limit its serial fraction at the most threads gives.
+void formatThreadScaling(const std::vector<ThreadScalingResult>& results, std::string& table);
+
+// Training of the cost model of RoomGraph::StrategyAuto on this machine.
+
+struct TuningSettings
+{
+	double scale;       // largest size of the matrix, see makeBenchMatrix()
+	int    steps;       // sizes, halving from the largest
+	int    repetitions; // measured builds per case and strategy
+	int    threads;     // threads of the parallel strategy, 0 = one per processor
+
+	TuningSettings() : scale(1.0), steps(5), repetitions(3), threads(0) {}
+};
+
+// Build every case of the matrix at every size with every strategy
+// (the parallel one only with more than one thread), add the median
+// times to model and fit it. report gets the fit per strategy and, per
+// case, the strategy the fitted model picks against the fastest one
+// measured. Returns the cases where the pick was more than 10% slower
+// than the fastest.
+int trainCostModel(const TuningSettings& settings, CostModel& model, std::string& report);
+
+#endif // ROOMGRAPHBENCH_H
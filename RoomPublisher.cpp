@@ -0,0 +1,166 @@
+#include "stdafx.h"
+#include "RoomPublisher.h"
+#include "Threading.h"
+
+#include <climits>
+
+RoomPublisher::RoomPublisher()
+: m_current(NULL),
+m_epoch(1),
+m_retired(),
+m_version(0),
+m_snapSize(1e-3),
+m_options()
+{
+	for (int i = 0; i < kMaxReaders; ++i)
+	{
+		m_readers[i].epoch = 0;
+		m_readers[i].claimed = 0;
+	}
+}
+
+RoomPublisher::~RoomPublisher()
+{
+	for (size_t i = 0; i < m_retired.size(); ++i)
+		delete m_retired[i].snapshot;
+
+	delete m_current;
+}
+
+int RoomPublisher::registerReader()
+{
+	for (int i = 0; i < kMaxReaders; ++i)
+	{
+		if (m_readers[i].claimed == 0 && atomicCompareExchange(&m_readers[i].claimed, 1, 0) == 0)
+			return i;
+	}
+	return -1;
+}
+
+void RoomPublisher::unregisterReader(int slot)
+{
+	m_readers[slot].epoch = 0;
+	memoryFence();
+	m_readers[slot].claimed = 0;
+}
+
+// The epoch is announced before the pointer is read, and the fence keeps
+// that order. A snapshot swapped out before the announcement cannot be
+// seen any more; one swapped out after it is retired in an epoch no
+// older than the announced one, so reclaim() keeps it.
+const RoomSnapshot* RoomPublisher::enter(int slot)
+{
+	m_readers[slot].epoch = m_epoch;
+	memoryFence();
+	return m_current;
+}
+
+void RoomPublisher::leave(int slot)
+{
+	memoryFence();
+	m_readers[slot].epoch = 0;
+}
+
+void RoomPublisher::setSnapSize(double snapSize)
+{
+	m_snapSize = snapSize;
+}
+
+void RoomPublisher::setOptions(const RoomGraph::Options& options)
+{
+	m_options = options;
+}
+
+void RoomPublisher::publish(const std::vector<Segment>& segments)
+{
+	RoomSnapshot* snapshot = new RoomSnapshot;
+	snapshot->graph.setSnapSize(m_snapSize);
+	snapshot->graph.setOptions(m_options);
+	snapshot->graph.build(segments);
+
+	publish(snapshot);
+}
+
+// Only the writer swaps m_current, so it can read it without entering.
+RoomSnapshot* RoomPublisher::copyCurrent() const
+{
+	RoomSnapshot* snapshot = new RoomSnapshot;
+
+	if (m_current != NULL)
+	{
+		snapshot->graph = m_current->graph;
+	}
+	else
+	{
+		snapshot->graph.setSnapSize(m_snapSize);
+		snapshot->graph.setOptions(m_options);
+	}
+
+	return snapshot;
+}
+
+void RoomPublisher::publish(RoomSnapshot* snapshot)
+{
+	snapshot->version = ++m_version;
+
+	// Everything written to the snapshot becomes visible before the
+	// pointer does: the exchange is a full barrier.
+	void* old = atomicExchangePointer(reinterpret_cast<void* volatile*>(&m_current), snapshot);
+
+	if (old != NULL)
+	{
+		Retired retired;
+		retired.snapshot = static_cast<RoomSnapshot*>(old);
+		retired.epoch = m_epoch;
+		m_retired.push_back(retired);
+	}
+
+	atomicIncrement(&m_epoch);
+
+	reclaim();
+}
+
+size_t RoomPublisher::reclaim()
+{
+	if (m_retired.empty())
+		return 0;
+
+	memoryFence();
+
+	long oldest = LONG_MAX;
+	for (int i = 0; i < kMaxReaders; ++i)
+	{
+		const long epoch = m_readers[i].epoch;
+		if (epoch != 0 && epoch < oldest)
+			oldest = epoch;
+	}
+
+	size_t kept = 0;
+	for (size_t i = 0; i < m_retired.size(); ++i)
+	{
+		if (m_retired[i].epoch < oldest)
+			delete m_retired[i].snapshot;
+		else
+			m_retired[kept++] = m_retired[i];
+	}
+	m_retired.resize(kept);
+
+	return kept;
+}
+
+SnapshotReader::SnapshotReader(RoomPublisher& publisher, int slot)
+: m_publisher(publisher),
+m_slot(slot),
+m_snapshot(publisher.enter(slot))
+{
+}
+
+SnapshotReader::~SnapshotReader()
+{
+	m_publisher.leave(m_slot);
+}
+
+const RoomSnapshot* SnapshotReader::get() const
+{
+	return m_snapshot;
+}
@@ -0,0 +1,119 @@
+#ifndef ROOMPUBLISHER_H
+#define ROOMPUBLISHER_H
+
+#include <vector>
+#include "Geometry.h"
+#include "RoomGraph.h"
+
+// One published build. It is never modified once published.
+struct RoomSnapshot
+{
+	RoomGraph graph;
+
+	// Publication counter, starting at 1.
+	unsigned long version;
+
+	RoomSnapshot() : graph(), version(0) {}
+};
+
+// Hands builds from one writer thread to any number of reader threads
+// without locks (read-copy-update). The writer builds into a fresh
+// snapshot while readers keep using the current one, then swaps the
+// current pointer atomically. Old snapshots are retired and freed once
+// no reader can still hold them: every reader announces the epoch it
+// entered in, and a snapshot retired in epoch E is freed when all
+// readers inside are past E. Readers never wait; the writer never waits
+// for readers either, it only frees later.
+class RoomPublisher
+{
+public:
+	enum { kMaxReaders = 64 };
+
+	RoomPublisher();
+
+	// No reader may be inside when the publisher is destroyed.
+	~RoomPublisher();
+
+	// Reader side. Each reader thread claims a slot once and passes it to
+	// enter()/leave(). registerReader() returns -1 when all slots are
+	// taken. Between enter() and leave() the returned snapshot (NULL
+	// before the first publish) stays valid; a slot is entered by one
+	// thread at a time and calls do not nest.
+	int registerReader();
+	void unregisterReader(int slot);
+
+	const RoomSnapshot* enter(int slot);
+	void leave(int slot);
+
+	// Writer side, one thread at a time.
+
+	// Applied to graphs built by publish(segments).
+	void setSnapSize(double snapSize);
+	void setOptions(const RoomGraph::Options& options);
+
+	// Build the segments into a fresh snapshot and publish it.
+	void publish(const std::vector<Segment>& segments);
+
+	// Copy of the current graph (empty before the first publish) for
+	// local edits; hand it back to publish() when done.
+	RoomSnapshot* copyCurrent() const;
+
+	// Publish a snapshot the caller built. The publisher takes ownership.
+	void publish(RoomSnapshot* snapshot);
+
+	// Free retired snapshots no reader can still see. publish() calls it,
+	// but a writer may also call it while idle. Returns the number of
+	// snapshots still waiting.
+	size_t reclaim();
+
+private:
+	RoomPublisher(const RoomPublisher&);
+	RoomPublisher& operator=(const RoomPublisher&);
+
+	// One cache line per reader, so announcing an epoch does not slow
+	// down the other readers.
+	struct ReaderSlot
+	{
+		volatile long epoch; // 0 while outside
+		volatile long claimed;
+		char padding[64 - 2 * sizeof(long)];
+	};
+
+	struct Retired
+	{
+		RoomSnapshot* snapshot;
+		long epoch;
+	};
+
+private:
+	RoomSnapshot* volatile m_current;
+	volatile long          m_epoch;
+	ReaderSlot             m_readers[kMaxReaders];
+
+	// Writer-only state.
+	std::vector<Retired> m_retired;
+	unsigned long        m_version;
+	double               m_snapSize;
+	RoomGraph::Options   m_options;
+};
+
+// Keeps the current snapshot pinned for the lifetime of the guard.
+class SnapshotReader
+{
+public:
+	SnapshotReader(RoomPublisher& publisher, int slot);
+	~SnapshotReader();
+
+	// NULL before the first publish.
+	const RoomSnapshot* get() const;
+
+private:
+	SnapshotReader(const SnapshotReader&);
+	SnapshotReader& operator=(const SnapshotReader&);
+
+	RoomPublisher&      m_publisher;
+	int                 m_slot;
+	const RoomSnapshot* m_snapshot;
+};
+
+#endif // ROOMPUBLISHER_H
@@ -0,0 +1,174 @@
+#include "stdafx.h"
+#include "RoomService.h"
+
+RoomJob::RoomJob()
+: segments(),
+rooms(),
+m_done(0)
+{
+}
+
+void RoomJob::wait()
+{
+	m_done.wait();
+}
+
+void RoomService::Worker::run()
+{
+	for (RoomJob* job = service->pop(); job != NULL; job = service->pop())
+	{
+		graph.build(job->segments);
+		job->rooms = graph.getRooms();
+		job->m_done.post();
+	}
+}
+
+RoomService::RoomService(int workerCount, size_t queueCapacity)
+: m_workerCount(workerCount > 0 ? workerCount : hardwareThreadCount()),
+m_capacity(queueCapacity > 0 ? queueCapacity : 1),
+m_queue(),
+m_head(0),
+m_count(0),
+m_queueLock(),
+m_free(0),
+m_queued(0),
+m_submitLock(),
+m_running(false),
+m_workers(),
+m_threads(),
+m_snapSize(1e-3),
+m_options()
+{
+	// Room for every job plus one stop marker per worker.
+	m_queue.resize(m_capacity + m_workerCount, NULL);
+
+	for (size_t i = 0; i < m_capacity; ++i)
+		m_free.post();
+}
+
+RoomService::~RoomService()
+{
+	stop();
+}
+
+void RoomService::setSnapSize(double snapSize)
+{
+	m_snapSize = snapSize;
+}
+
+void RoomService::setOptions(const RoomGraph::Options& options)
+{
+	m_options = options;
+}
+
+void RoomService::start()
+{
+	ScopedLock lock(m_submitLock);
+
+	if (m_running)
+		return;
+
+	m_workers.resize(m_workerCount);
+
+	for (int i = 0; i < m_workerCount; ++i)
+	{
+		Worker& worker = m_workers[i];
+		worker.service = this;
+		worker.graph.setSnapSize(m_snapSize);
+		worker.graph.setOptions(m_options);
+
+		Thread* thread = new Thread;
+		if (thread->start(&worker))
+			m_threads.push_back(thread);
+		else
+			delete thread;
+	}
+
+	m_running = true;
+}
+
+// Queued jobs are finished first: the stop markers go in behind them.
+// They bypass m_free, the queue keeps a slot per worker for them.
+void RoomService::stop()
+{
+	{
+		ScopedLock lock(m_submitLock);
+
+		if (!m_running)
+			return;
+
+		m_running = false;
+	}
+
+	for (size_t i = 0; i < m_threads.size(); ++i)
+		push(NULL);
+
+	for (size_t i = 0; i < m_threads.size(); ++i)
+		delete m_threads[i];
+
+	m_threads.clear();
+	m_workers.clear();
+}
+
+bool RoomService::submit(RoomJob* job)
+{
+	if (job == NULL)
+		return false;
+
+	// Wait for a slot before taking the lock, so that trySubmit() and
+	// stop() are not held up behind a full queue.
+	m_free.wait();
+
+	ScopedLock lock(m_submitLock);
+
+	if (!m_running)
+	{
+		m_free.post();
+		return false;
+	}
+
+	push(job);
+
+	return true;
+}
+
+bool RoomService::trySubmit(RoomJob* job)
+{
+	ScopedLock lock(m_submitLock);
+
+	if (!m_running || job == NULL || !m_free.tryWait())
+		return false;
+
+	push(job);
+
+	return true;
+}
+
+void RoomService::push(RoomJob* job)
+{
+	{
+		ScopedLock lock(m_queueLock);
+		m_queue[(m_head + m_count) % m_queue.size()] = job;
+		++m_count;
+	}
+
+	m_queued.post();
+}
+
+RoomJob* RoomService::pop()
+{
+	m_queued.wait();
+
+	RoomJob* job;
+	{
+		ScopedLock lock(m_queueLock);
+		job = m_queue[m_head];
+		m_head = (m_head + 1) % m_queue.size();
+		--m_count;
+	}
+
+	if (job != NULL)
+		m_free.post();
+
+	return job;
+}
@@ -0,0 +1,100 @@
+#ifndef ROOMSERVICE_H
+#define ROOMSERVICE_H
+
+#include <vector>
+#include "Geometry.h"
+#include "RoomGraph.h"
+#include "Threading.h"
+
+// One drawing to process. The caller fills in the segments, submits the
+// job and waits for it; the rooms are valid once wait() returns.
+class RoomJob
+{
+public:
+	RoomJob();
+
+	std::vector<Segment>         segments;
+	std::vector<RoomGraph::Room> rooms;
+
+	void wait();
+
+private:
+	RoomJob(const RoomJob&);
+	RoomJob& operator=(const RoomJob&);
+
+	friend class RoomService;
+	Semaphore m_done;
+};
+
+// Long-running pool of builder threads for many small drawings. Every
+// worker keeps one RoomGraph for its whole life, so the buffers of one
+// build are reused by the next instead of being allocated again. Jobs
+// wait in a bounded queue; when it is full, submit() blocks, which slows
+// the producer down to the speed of the workers.
+class RoomService
+{
+public:
+	// workerCount <= 0 uses one worker per processor.
+	RoomService(int workerCount, size_t queueCapacity);
+
+	// Finishes the queued jobs, then stops the workers.
+	~RoomService();
+
+	// Applied to the worker graphs; call before start().
+	void setSnapSize(double snapSize);
+	void setOptions(const RoomGraph::Options& options);
+
+	void start();
+	void stop();
+
+	// Queue a job, waiting while the queue is full. Returns false when the
+	// service is not running.
+	bool submit(RoomJob* job);
+
+	// Queue a job only if there is room for it right now.
+	bool trySubmit(RoomJob* job);
+
+private:
+	RoomService(const RoomService&);
+	RoomService& operator=(const RoomService&);
+
+	class Worker : public Runnable
+	{
+	public:
+		Worker() : service(NULL), graph() {}
+
+		virtual void run();
+
+		RoomService* service;
+		RoomGraph    graph;
+	};
+
+	void push(RoomJob* job);
+	RoomJob* pop();
+
+private:
+	int    m_workerCount;
+	size_t m_capacity;
+
+	// Ring buffer of queued jobs. m_free counts empty slots, m_queued
+	// the jobs; a NULL job tells one worker to exit.
+	std::vector<RoomJob*> m_queue;
+	size_t                m_head;
+	size_t                m_count;
+	Mutex                 m_queueLock;
+	Semaphore             m_free;
+	Semaphore             m_queued;
+
+	// Held while a job is pushed, so none lands behind the stop markers.
+	// Never held while waiting for a free slot.
+	Mutex m_submitLock;
+	bool  m_running;
+
+	std::vector<Worker>  m_workers;
+	std::vector<Thread*> m_threads;
+
+	double             m_snapSize;
+	RoomGraph::Options m_options;
+};
+
+#endif // ROOMSERVICE_H
@@ -0,0 +1,563 @@
+#include "stdafx.h"
+#include "SegmentMerge.h"
+
+#include <algorithm>
+#include <cmath>
+
+static const double kPi = 3.14159265358979323846;
+
+// Lines closer than this to the boundary of their bucket, in buckets, are
+// joined with the lines of the bucket across it.
+static const double kNearBoundary = 0.25;
+
+// Snapped endpoint, same rounding as RoomGraph::findOrCreateNode.
+struct PointKey
+{
+	int ix;
+	int iy;
+
+	PointKey() : ix(0), iy(0) {}
+	PointKey(int x_, int y_) : ix(x_), iy(y_) {}
+
+	bool operator<(const PointKey& other) const
+	{
+		if (ix != other.ix) return ix < other.ix;
+		return iy < other.iy;
+	}
+
+	bool operator==(const PointKey& other) const
+	{
+		return ix == other.ix && iy == other.iy;
+	}
+};
+
+static PointKey snapKey(const Vec2& p, double tolerance)
+{
+	return PointKey(static_cast<int>(std::floor(p.x / tolerance + 0.5)),
+		static_cast<int>(std::floor(p.y / tolerance + 0.5)));
+}
+
+// A segment expressed on its quantized supporting line.
+struct LineRecord
+{
+	int angle;    // quantized direction angle
+	int offset;   // quantized distance of the line from the origin
+	double t0;    // interval along the line direction, t0 <= t1
+	double t1;
+	Vec2 p0;      // endpoint at t0
+	Vec2 p1;      // endpoint at t1
+	int index;    // source segment
+};
+
+struct LineRecordLess
+{
+	bool operator()(const LineRecord& r1, const LineRecord& r2) const
+	{
+		if (r1.angle != r2.angle) return r1.angle < r2.angle;
+		if (r1.offset != r2.offset) return r1.offset < r2.offset;
+		if (r1.t0 != r2.t0) return r1.t0 < r2.t0;
+		return r1.index < r2.index;
+	}
+};
+
+// An (angle, offset) bucket and the bucket its records are merged into.
+struct LineCell
+{
+	int    angle;
+	int    offset;
+	size_t root;
+
+	bool operator<(const LineCell& other) const
+	{
+		if (angle != other.angle) return angle < other.angle;
+		return offset < other.offset;
+	}
+
+	bool operator==(const LineCell& other) const
+	{
+		return angle == other.angle && offset == other.offset;
+	}
+};
+
+// Direction of an angle bucket.
+static void bucketAxis(int angle, double angleStep, double& ux, double& uy)
+{
+	const double qangle = angle * angleStep;
+	ux = std::cos(qangle);
+	uy = std::sin(qangle);
+}
+
+// Signed distance from the origin of the line through p along (ux, uy).
+static double lineOffset(const Vec2& p, double ux, double uy)
+{
+	return -uy * p.x + ux * p.y;
+}
+
+// Put the segment on the axis (ux, uy) of an angle bucket: the interval
+// along the bucket's direction, with the original endpoints.
+static void projectRecord(const Segment& s, int angle, double ux, double uy, LineRecord& r)
+{
+	// Project on the bucket's direction, not the segment's own, so that
+	// every member of a group shares the same axis.
+	const double ta = ux * s.a.x + uy * s.a.y;
+	const double tb = ux * s.b.x + uy * s.b.y;
+
+	r.angle = angle;
+
+	if (ta <= tb)
+	{
+		r.t0 = ta; r.p0 = s.a;
+		r.t1 = tb; r.p1 = s.b;
+	}
+	else
+	{
+		r.t0 = tb; r.p0 = s.b;
+		r.t1 = ta; r.p1 = s.a;
+	}
+}
+
+struct Breakpoint
+{
+	double t;
+	Vec2 pos;
+	PointKey key;
+	int own;      // endpoints of the run in this snap cell
+};
+
+struct BreakpointKeyLess
+{
+	bool operator()(const Breakpoint& b1, const Breakpoint& b2) const
+	{
+		if (!(b1.key == b2.key)) return b1.key < b2.key;
+		return b1.t < b2.t;
+	}
+};
+
+struct BreakpointLess
+{
+	bool operator()(const Breakpoint& b1, const Breakpoint& b2) const
+	{
+		if (b1.t != b2.t) return b1.t < b2.t;
+		return b1.key < b2.key;
+	}
+};
+
+// Output segment tagged with the first source segment it came from,
+// so the output keeps roughly the input order.
+struct Piece
+{
+	int order;
+	Segment seg;
+};
+
+struct PieceLess
+{
+	bool operator()(const Piece& p1, const Piece& p2) const
+	{
+		return p1.order < p2.order;
+	}
+};
+
+// A piece as the snap cells of its endpoints, the smaller one first.
+struct WallKey
+{
+	PointKey low;
+	PointKey high;
+	size_t   piece;
+};
+
+struct WallKeyLess
+{
+	bool operator()(const WallKey& w1, const WallKey& w2) const
+	{
+		if (!(w1.low == w2.low)) return w1.low < w2.low;
+		if (!(w1.high == w2.high)) return w1.high < w2.high;
+		return w1.piece < w2.piece;
+	}
+};
+
+// Sine of the turn at p on the way from a to b.
+static double turnSine(const Vec2& a, const Vec2& p, const Vec2& b)
+{
+	const double lengths = distance(a, p) * distance(p, b);
+
+	if (lengths == 0.0)
+		return 0.0;
+
+	return std::fabs((p.x - a.x) * (b.y - p.y) - (p.y - a.y) * (b.x - p.x)) / lengths;
+}
+
+static int countKey(const std::vector<PointKey>& sortedKeys, const PointKey& key)
+{
+	std::pair<std::vector<PointKey>::const_iterator, std::vector<PointKey>::const_iterator> range =
+		std::equal_range(sortedKeys.begin(), sortedKeys.end(), key);
+	return static_cast<int>(range.second - range.first);
+}
+
+// Emit one run of overlapping collinear records [first, last).
+// An interior breakpoint is kept only if some segment outside the run
+// also ends there, or if the walls of the run bend at it.
+static void flushRun(const std::vector<LineRecord>& records, size_t first, size_t last,
+	const std::vector<PointKey>& endpointKeys, double tolerance, double angleStep,
+	std::vector<Breakpoint>& points, std::vector<Piece>& pieces)
+{
+	if (last - first == 1)
+	{
+		const LineRecord& r = records[first];
+		Piece piece;
+		piece.order = r.index;
+		piece.seg = Segment(r.p0, r.p1);
+		pieces.push_back(piece);
+		return;
+	}
+
+	int order = records[first].index;
+	points.clear();
+
+	for (size_t i = first; i < last; ++i)
+	{
+		const LineRecord& r = records[i];
+		order = std::min(order, r.index);
+
+		Breakpoint b0;
+		b0.t = r.t0;
+		b0.pos = r.p0;
+		b0.key = snapKey(r.p0, tolerance);
+		b0.own = 1;
+		points.push_back(b0);
+
+		Breakpoint b1;
+		b1.t = r.t1;
+		b1.pos = r.p1;
+		b1.key = snapKey(r.p1, tolerance);
+		b1.own = 1;
+		points.push_back(b1);
+	}
+
+	// Collapse equal keys to their first point along the line. Points of
+	// one cell need not be next to each other by t when walls overlap at
+	// slightly different angles.
+	std::sort(points.begin(), points.end(), BreakpointKeyLess());
+
+	size_t unique = 0;
+	size_t i = 0;
+	while (i < points.size())
+	{
+		size_t j = i + 1;
+		while (j < points.size() && points[j].key == points[i].key)
+			++j;
+
+		points[unique] = points[i];
+		points[unique].own = static_cast<int>(j - i);
+		++unique;
+
+		i = j;
+	}
+
+	points.resize(unique);
+	std::sort(points.begin(), points.end(), BreakpointLess());
+
+	// Decide which breakpoints survive. Buckets of short walls are wide,
+	// as they come from the snapped endpoints, so where walls only meet,
+	// with none running through, a turn by more than an angle step is a
+	// bend, as on a curve drawn in short walls, and is kept.
+	size_t kept = 0;
+	size_t record = first;
+	double coverEnd = -1e300;
+
+	for (i = 0; i < points.size(); ++i)
+	{
+		while (record < last && records[record].t0 <= points[i].t - tolerance)
+		{
+			coverEnd = std::max(coverEnd, records[record].t1);
+			++record;
+		}
+
+		const bool isEnd = (i == 0 || i + 1 == points.size());
+
+		if (isEnd || countKey(endpointKeys, points[i].key) > points[i].own
+			|| (coverEnd < points[i].t + tolerance
+				&& turnSine(points[kept - 1].pos, points[i].pos, points[i + 1].pos) > angleStep))
+			points[kept++] = points[i];
+	}
+
+	for (size_t k = 1; k < kept; ++k)
+	{
+		Piece piece;
+		piece.order = order;
+		piece.seg = Segment(points[k - 1].pos, points[k].pos);
+		pieces.push_back(piece);
+	}
+}
+
+void mergeCollinearSegments(const std::vector<Segment>& segments, double tolerance,
+	std::vector<Segment>& merged)
+{
+	merged.clear();
+
+	if (segments.empty() || tolerance <= 0.0)
+	{
+		merged = segments;
+		return;
+	}
+
+	std::vector<PointKey> endpointKeys;
+	endpointKeys.reserve(segments.size() * 2);
+
+	// The angle bucket is sized so that two segments in the same bucket
+	// drift apart by at most "tolerance" over the longest segment.
+	double maxLength = 0.0;
+	size_t i;
+
+	for (i = 0; i < segments.size(); ++i)
+	{
+		const Segment& s = segments[i];
+		const PointKey ka = snapKey(s.a, tolerance);
+		const PointKey kb = snapKey(s.b, tolerance);
+
+		if (ka == kb)
+			continue;
+
+		endpointKeys.push_back(ka);
+		endpointKeys.push_back(kb);
+		maxLength = std::max(maxLength, distance(s.a, s.b));
+	}
+
+	std::sort(endpointKeys.begin(), endpointKeys.end());
+
+	const double angleStep = std::max(tolerance / std::max(maxLength, tolerance), 2e-9);
+	const int angleBuckets = static_cast<int>(std::floor(kPi / angleStep + 0.5));
+	const double stepCos = std::cos(angleStep);
+	const double stepSin = std::sin(angleStep);
+
+	std::vector<LineRecord> records;
+	records.reserve(segments.size());
+
+	// Per record close to the boundary of its angle or offset bucket, the
+	// bucket across it, where a nearly equal line may have gone; the root
+	// is the record.
+	std::vector<LineCell> nearCells;
+	nearCells.reserve(2 * segments.size());
+
+	for (i = 0; i < segments.size(); ++i)
+	{
+		const Segment& s = segments[i];
+		const PointKey ka = snapKey(s.a, tolerance);
+		const PointKey kb = snapKey(s.b, tolerance);
+
+		if (ka == kb)
+			continue;
+
+		// The line through the snapped endpoints: walls duplicated with
+		// jitter inside the snap cells get the same buckets, however short.
+		const Vec2 sa(ka.ix * tolerance, ka.iy * tolerance);
+		const Vec2 sb(kb.ix * tolerance, kb.iy * tolerance);
+		const Vec2 mid(0.5 * (sa.x + sb.x), 0.5 * (sa.y + sb.y));
+
+		// Fold the direction to [0, pi) so both orientations share a line.
+		double angle = std::atan2(sb.y - sa.y, sb.x - sa.x);
+		if (angle < 0.0)
+			angle += kPi;
+
+		const double rawAngle = angle / angleStep;
+		const int nearest = static_cast<int>(std::floor(rawAngle + 0.5));
+		const int qa = nearest % angleBuckets;
+
+		double ux;
+		double uy;
+		bucketAxis(qa, angleStep, ux, uy);
+
+		LineRecord r;
+		r.index = static_cast<int>(i);
+		projectRecord(s, qa, ux, uy, r);
+
+		const double rawOffset = lineOffset(mid, ux, uy) / tolerance;
+		r.offset = static_cast<int>(std::floor(rawOffset + 0.5));
+
+		LineCell near;
+		near.root = records.size();
+
+		if (std::fabs(rawOffset - r.offset) > kNearBoundary)
+		{
+			near.angle = qa;
+			near.offset = rawOffset > r.offset ? r.offset + 1 : r.offset - 1;
+			nearCells.push_back(near);
+		}
+
+		// The next bucket by a turn of one step, but past pi the direction
+		// flips, and the offset with it.
+		if (std::fabs(rawAngle - nearest) > kNearBoundary)
+		{
+			const int side = rawAngle > nearest ? 1 : -1;
+			near.angle = qa + side;
+
+			if (near.angle >= 0 && near.angle < angleBuckets)
+			{
+				const double sideSin = side * stepSin;
+				const double nx = ux * stepCos - uy * sideSin;
+				const double ny = uy * stepCos + ux * sideSin;
+				near.offset = static_cast<int>(std::floor(lineOffset(mid, nx, ny) / tolerance + 0.5));
+			}
+			else
+			{
+				near.angle = (near.angle + angleBuckets) % angleBuckets;
+				bucketAxis(near.angle, angleStep, ux, uy);
+				near.offset = static_cast<int>(std::floor(lineOffset(mid, ux, uy) / tolerance + 0.5));
+			}
+
+			nearCells.push_back(near);
+		}
+
+		records.push_back(r);
+	}
+
+	const size_t unassigned = records.size();
+
+	// The buckets in order, and the bucket of each record.
+	std::vector<LineCell> keys(records.size());
+	for (i = 0; i < records.size(); ++i)
+	{
+		keys[i].angle = records[i].angle;
+		keys[i].offset = records[i].offset;
+		keys[i].root = i;
+	}
+
+	std::sort(keys.begin(), keys.end());
+
+	std::vector<LineCell> cells;
+	std::vector<size_t> recordCells(records.size(), 0);
+
+	for (i = 0; i < keys.size(); ++i)
+	{
+		if (cells.empty() || !(cells.back() == keys[i]))
+		{
+			cells.push_back(keys[i]);
+			cells.back().root = unassigned;
+		}
+
+		recordCells[keys[i].root] = cells.size() - 1;
+	}
+
+	// Pairs of buckets holding records of nearly the same line, found by
+	// walking the sorted near buckets along the buckets.
+	std::sort(nearCells.begin(), nearCells.end());
+
+	std::vector<std::pair<size_t, size_t> > links;
+	size_t cell = 0;
+
+	for (i = 0; i < nearCells.size() && cell < cells.size(); ++i)
+	{
+		while (cell < cells.size() && cells[cell] < nearCells[i])
+			++cell;
+
+		if (cell == cells.size() || !(cells[cell] == nearCells[i]))
+			continue;
+
+		const size_t own = recordCells[nearCells[i].root];
+		if (own != cell)
+		{
+			links.push_back(std::make_pair(own, cell));
+			links.push_back(std::make_pair(cell, own));
+		}
+	}
+
+	std::sort(links.begin(), links.end());
+	links.erase(std::unique(links.begin(), links.end()), links.end());
+
+	// Each bucket joins the first linked bucket before it that did not
+	// join another one itself. Buckets are only joined to such a root, not
+	// through each other, so a chain of nearly equal lines cannot drift
+	// into one group.
+	std::vector<std::pair<size_t, size_t> >::const_iterator link = links.begin();
+
+	for (i = 0; i < cells.size(); ++i)
+	{
+		while (link != links.end() && link->first < i)
+			++link;
+
+		if (cells[i].root != unassigned)
+			continue;
+
+		cells[i].root = i;
+
+		for (std::vector<std::pair<size_t, size_t> >::const_iterator next = link;
+			next != links.end() && next->first == i; ++next)
+		{
+			if (cells[next->second].root == unassigned)
+				cells[next->second].root = i;
+		}
+	}
+
+	for (i = 0; i < records.size(); ++i)
+	{
+		LineRecord& r = records[i];
+		const LineCell& root = cells[cells[recordCells[i]].root];
+
+		if (root.angle != r.angle || root.offset != r.offset)
+		{
+			double ux;
+			double uy;
+			bucketAxis(root.angle, angleStep, ux, uy);
+			projectRecord(segments[r.index], root.angle, ux, uy, r);
+			r.offset = root.offset;
+		}
+	}
+
+	std::sort(records.begin(), records.end(), LineRecordLess());
+
+	std::vector<Piece> pieces;
+	std::vector<Breakpoint> points;
+	pieces.reserve(records.size());
+
+	size_t first = 0;
+	while (first < records.size())
+	{
+		const LineRecord& head = records[first];
+		double runEnd = head.t1;
+		size_t last = first + 1;
+
+		while (last < records.size()
+			&& records[last].angle == head.angle
+			&& records[last].offset == head.offset
+			&& records[last].t0 <= runEnd + tolerance)
+		{
+			runEnd = std::max(runEnd, records[last].t1);
+			++last;
+		}
+
+		flushRun(records, first, last, endpointKeys, tolerance, angleStep, points, pieces);
+		first = last;
+	}
+
+	std::stable_sort(pieces.begin(), pieces.end(), PieceLess());
+
+	// Groups are kept apart when their lines are more than a bucket from
+	// the group's first one, yet a merged run can end up on the same snap
+	// cells as a wall of the next group. Keep the first of such pieces.
+	std::vector<WallKey> walls(pieces.size());
+	for (i = 0; i < pieces.size(); ++i)
+	{
+		const PointKey ka = snapKey(pieces[i].seg.a, tolerance);
+		const PointKey kb = snapKey(pieces[i].seg.b, tolerance);
+
+		walls[i].low = ka < kb ? ka : kb;
+		walls[i].high = ka < kb ? kb : ka;
+		walls[i].piece = i;
+	}
+
+	std::sort(walls.begin(), walls.end(), WallKeyLess());
+
+	std::vector<char> duplicate(pieces.size(), 0);
+	for (i = 1; i < walls.size(); ++i)
+	{
+		if (walls[i].low == walls[i - 1].low && walls[i].high == walls[i - 1].high)
+			duplicate[walls[i].piece] = 1;
+	}
+
+	merged.reserve(pieces.size());
+	for (i = 0; i < pieces.size(); ++i)
+	{
+		if (!duplicate[i])
+			merged.push_back(pieces[i].seg);
+	}
+}
@@ -0,0 +1,23 @@
+#ifndef SEGMENTMERGE_H
+#define SEGMENTMERGE_H
+
+#include <vector>
+#include "Geometry.h"
+
+// Remove duplicated and overlapping collinear segments.
+//
+// Segments are grouped by their quantized supporting line (direction angle
+// folded to [0, pi) and offset from the origin, both taken from the
+// snapped endpoints), with lines in neighbouring buckets joined, and the
+// overlapping intervals of each group are merged in 1D. A merged run is emitted as
+// pieces between the endpoints other segments attach to, or where walls
+// meeting end to end turn by more than an angle bucket, so no node the
+// graph depends on is lost. Original endpoint coordinates are kept.
+//
+// "tolerance" is the snap size of the graph: it sets the width of an
+// offset bucket and the distance under which two endpoints are the same.
+// Runs in O(n log n).
+void mergeCollinearSegments(const std::vector<Segment>& segments, double tolerance,
+	std::vector<Segment>& merged);
+
+#endif // SEGMENTMERGE_H
@@ -0,0 +1,359 @@
+#include "stdafx.h"
+#include "SharedMemory.h"
+#include "RoomGraph.h"
+#include "Threading.h"
+
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+
+static const unsigned int kRingMagic = 0x474e5252; // "RRNG"
+
+SharedRegion::SharedRegion()
+: m_data(NULL),
+m_size(0),
+m_owner(false),
+m_name(),
+m_mapping(NULL)
+{
+}
+
+SharedRegion::~SharedRegion()
+{
+	close();
+}
+
+#ifdef _WIN32
+
+bool SharedRegion::create(const char* name, size_t size)
+{
+	close();
+
+	const unsigned __int64 bytes = size;
+	HANDLE mapping = CreateFileMappingA(INVALID_HANDLE_VALUE, NULL, PAGE_READWRITE,
+		static_cast<DWORD>(bytes >> 32), static_cast<DWORD>(bytes), name);
+	if (mapping == NULL)
+		return false;
+
+	m_data = MapViewOfFile(mapping, FILE_MAP_ALL_ACCESS, 0, 0, size);
+	if (m_data == NULL)
+	{
+		CloseHandle(mapping);
+		return false;
+	}
+
+	m_mapping = mapping;
+	m_size = size;
+	m_owner = true;
+	m_name = name;
+	return true;
+}
+
+bool SharedRegion::open(const char* name)
+{
+	close();
+
+	HANDLE mapping = OpenFileMappingA(FILE_MAP_ALL_ACCESS, FALSE, name);
+	if (mapping == NULL)
+		return false;
+
+	m_data = MapViewOfFile(mapping, FILE_MAP_ALL_ACCESS, 0, 0, 0);
+	if (m_data == NULL)
+	{
+		CloseHandle(mapping);
+		return false;
+	}
+
+	// The view covers the whole mapping, rounded up to pages.
+	MEMORY_BASIC_INFORMATION info;
+	VirtualQuery(m_data, &info, sizeof(info));
+
+	m_mapping = mapping;
+	m_size = info.RegionSize;
+	m_owner = false;
+	m_name = name;
+	return true;
+}
+
+void SharedRegion::close()
+{
+	if (m_data != NULL)
+		UnmapViewOfFile(m_data);
+	if (m_mapping != NULL)
+		CloseHandle(static_cast<HANDLE>(m_mapping));
+
+	m_data = NULL;
+	m_mapping = NULL;
+	m_size = 0;
+	m_owner = false;
+	m_name.clear();
+}
+
+#else
+
+bool SharedRegion::create(const char* name, size_t size)
+{
+	close();
+
+	const int fd = ::shm_open(name, O_CREAT | O_RDWR | O_TRUNC, 0600);
+	if (fd < 0)
+		return false;
+
+	void* data = MAP_FAILED;
+	if (::ftruncate(fd, static_cast<off_t>(size)) == 0)
+		data = ::mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+
+	::close(fd);
+
+	if (data == MAP_FAILED)
+	{
+		::shm_unlink(name);
+		return false;
+	}
+
+	m_data = data;
+	m_size = size;
+	m_owner = true;
+	m_name = name;
+	return true;
+}
+
+bool SharedRegion::open(const char* name)
+{
+	close();
+
+	const int fd = ::shm_open(name, O_RDWR, 0600);
+	if (fd < 0)
+		return false;
+
+	struct stat info;
+	void* data = MAP_FAILED;
+	if (::fstat(fd, &info) == 0 && info.st_size > 0)
+		data = ::mmap(NULL, static_cast<size_t>(info.st_size), PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+
+	::close(fd);
+
+	if (data == MAP_FAILED)
+		return false;
+
+	m_data = data;
+	m_size = static_cast<size_t>(info.st_size);
+	m_owner = false;
+	m_name = name;
+	return true;
+}
+
+void SharedRegion::close()
+{
+	if (m_data != NULL)
+		::munmap(m_data, m_size);
+	if (m_owner)
+		::shm_unlink(m_name.c_str());
+
+	m_data = NULL;
+	m_size = 0;
+	m_owner = false;
+	m_name.clear();
+}
+
+#endif
+
+void* SharedRegion::data() const
+{
+	return m_data;
+}
+
+size_t SharedRegion::size() const
+{
+	return m_size;
+}
+
+SharedJobRing::SharedJobRing()
+: m_header(NULL),
+m_jobs(NULL)
+{
+}
+
+size_t SharedJobRing::bytesFor(unsigned int capacity)
+{
+	return sizeof(Header) + capacity * sizeof(SharedRoomJob);
+}
+
+bool SharedJobRing::format(void* memory, size_t size, unsigned int capacity)
+{
+	if (memory == NULL || capacity == 0 || bytesFor(capacity) > size)
+		return false;
+
+	m_header = static_cast<Header*>(memory);
+	m_jobs = reinterpret_cast<SharedRoomJob*>(m_header + 1);
+
+	for (unsigned int i = 0; i < capacity; ++i)
+	{
+		SharedRoomJob& job = m_jobs[i];
+		job.state = SlotFree;
+		job.segmentOffset = 0;
+		job.segmentCount = 0;
+		job.outputOffset = 0;
+		job.outputCapacity = 0;
+		job.status = JobOk;
+		job.roomCount = 0;
+		job.outputSize = 0;
+	}
+
+	m_header->capacity = capacity;
+	m_header->head = 0;
+	m_header->tail = 0;
+
+	// The magic goes in last: a consumer attaching early sees no ring.
+	memoryFence();
+	m_header->magic = kRingMagic;
+
+	return true;
+}
+
+bool SharedJobRing::attach(void* memory, size_t size)
+{
+	if (memory == NULL || size < sizeof(Header))
+		return false;
+
+	Header* header = static_cast<Header*>(memory);
+	if (header->magic != kRingMagic)
+		return false;
+
+	memoryFence();
+
+	if (header->capacity == 0 || bytesFor(header->capacity) > size)
+		return false;
+
+	m_header = header;
+	m_jobs = reinterpret_cast<SharedRoomJob*>(m_header + 1);
+	return true;
+}
+
+// Slots are filled in order; a slot whose results were not released yet
+// keeps the ring full even if later ones are free again.
+int SharedJobRing::submit(size_t segmentOffset, unsigned int segmentCount, size_t outputOffset, size_t outputCapacity)
+{
+	const long head = m_header->head;
+	const int slot = static_cast<int>(head % m_header->capacity);
+	SharedRoomJob& job = m_jobs[slot];
+
+	if (job.state != SlotFree)
+		return -1;
+
+	job.segmentOffset = segmentOffset;
+	job.segmentCount = segmentCount;
+	job.outputOffset = outputOffset;
+	job.outputCapacity = outputCapacity;
+	job.status = JobOk;
+	job.roomCount = 0;
+	job.outputSize = 0;
+
+	memoryFence();
+	job.state = SlotSubmitted;
+	m_header->head = head + 1;
+
+	return slot;
+}
+
+bool SharedJobRing::isDone(int slot) const
+{
+	const bool done = m_jobs[slot].state == SlotDone;
+
+	// The results are read after the state.
+	memoryFence();
+	return done;
+}
+
+void SharedJobRing::release(int slot)
+{
+	memoryFence();
+	m_jobs[slot].state = SlotFree;
+}
+
+// Consumers race for the tail with compare-and-swap; the winner owns
+// the slot it pointed at.
+int SharedJobRing::take()
+{
+	for (;;)
+	{
+		const long tail = m_header->tail;
+		const int slot = static_cast<int>(tail % m_header->capacity);
+
+		if (m_jobs[slot].state != SlotSubmitted)
+			return -1;
+
+		if (atomicCompareExchange(&m_header->tail, tail + 1, tail) == tail)
+		{
+			m_jobs[slot].state = SlotTaken;
+			return slot;
+		}
+	}
+}
+
+void SharedJobRing::finish(int slot)
+{
+	memoryFence();
+	m_jobs[slot].state = SlotDone;
+}
+
+SharedRoomJob& SharedJobRing::job(int slot) const
+{
+	return m_jobs[slot];
+}
+
+// True if [offset, offset + bytes) lies inside a region of the given size
+// and starts 8-byte aligned.
+static bool fitsRegion(size_t offset, size_t bytes, size_t size)
+{
+	return offset % sizeof(double) == 0 && offset <= size && bytes <= size - offset;
+}
+
+int processSharedJobs(SharedJobRing& ring, const SharedRegion& input, const SharedRegion& output,
+	RoomGraph& graph, int maxJobs)
+{
+	int done = 0;
+
+	for (; done < maxJobs; ++done)
+	{
+		const int slot = ring.take();
+		if (slot < 0)
+			break;
+
+		SharedRoomJob& job = ring.job(slot);
+		const size_t inputBytes = job.segmentCount * sizeof(Segment);
+
+		if (!fitsRegion(job.segmentOffset, inputBytes, input.size())
+			|| !fitsRegion(job.outputOffset, job.outputCapacity, output.size()))
+		{
+			job.status = SharedJobRing::JobBadInput;
+			ring.finish(slot);
+			continue;
+		}
+
+		const char* in = static_cast<const char*>(input.data()) + job.segmentOffset;
+		char* out = static_cast<char*>(output.data()) + job.outputOffset;
+
+		graph.build(reinterpret_cast<const Segment*>(in), job.segmentCount);
+		job.outputSize = graph.writeRooms(out, job.outputCapacity);
+
+		if (job.outputSize > job.outputCapacity)
+		{
+			job.status = SharedJobRing::JobOutputTooSmall;
+		}
+		else
+		{
+			job.status = SharedJobRing::JobOk;
+			job.roomCount = static_cast<unsigned int>(graph.getRooms().size());
+		}
+
+		ring.finish(slot);
+	}
+
+	return done;
+}
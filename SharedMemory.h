@@ -0,0 +1,125 @@
+#ifndef SHAREDMEMORY_H
+#define SHAREDMEMORY_H
+
+#include <string>
+#include <cstddef>
+
+class RoomGraph;
+
+// Named memory region shared between processes: POSIX shm_open() and
+// mmap(), or a Win32 file mapping backed by the paging file. POSIX names
+// start with a slash ("/rooms-in").
+class SharedRegion
+{
+public:
+	SharedRegion();
+
+	// Unmaps the region; the creator also removes the name.
+	~SharedRegion();
+
+	bool create(const char* name, size_t size);
+	bool open(const char* name);
+	void close();
+
+	void* data() const;
+	size_t size() const;
+
+private:
+	SharedRegion(const SharedRegion&);
+	SharedRegion& operator=(const SharedRegion&);
+
+	void*       m_data;
+	size_t      m_size;
+	bool        m_owner;
+	std::string m_name;
+	void*       m_mapping; // Win32 mapping handle
+};
+
+// One job in a SharedJobRing. Offsets are in bytes from the start of the
+// input and output regions and must be 8-byte aligned. Both processes
+// must be built for the same platform, the layout is native.
+struct SharedRoomJob
+{
+	volatile long state;
+
+	// Input: segmentCount Segments (four doubles each) at segmentOffset.
+	size_t       segmentOffset;
+	unsigned int segmentCount;
+
+	// Output: RoomGraph::writeRooms() layout at outputOffset.
+	size_t outputOffset;
+	size_t outputCapacity;
+
+	// Results: status, rooms written, and the bytes they need (also set
+	// when the output was too small).
+	unsigned int status;
+	unsigned int roomCount;
+	size_t       outputSize;
+};
+
+// Ring of job descriptors in shared memory. The producer submits jobs
+// pointing into an input region it filled and an output region it reads
+// back; one or more consumers take them, build them straight from the
+// input and write the rooms straight into the output. Nothing is copied
+// or parsed on the way, only the descriptors move. Slots change hands
+// with atomic operations, so no locks are shared between processes;
+// waiting (polling) is left to the caller.
+class SharedJobRing
+{
+public:
+	enum SlotState
+	{
+		SlotFree,
+		SlotSubmitted,
+		SlotTaken,
+		SlotDone
+	};
+
+	enum JobStatus
+	{
+		JobOk,
+		JobBadInput,
+		JobOutputTooSmall
+	};
+
+	SharedJobRing();
+
+	// Bytes needed for a ring of the given capacity.
+	static size_t bytesFor(unsigned int capacity);
+
+	// Producer: lay out an empty ring. Consumer: use a ring laid out by
+	// another process. Both return false if the memory does not fit.
+	bool format(void* memory, size_t size, unsigned int capacity);
+	bool attach(void* memory, size_t size);
+
+	// Producer side. submit() returns the slot, or -1 while the ring is
+	// full; release() frees a done slot once its results were read.
+	int submit(size_t segmentOffset, unsigned int segmentCount, size_t outputOffset, size_t outputCapacity);
+	bool isDone(int slot) const;
+	void release(int slot);
+
+	// Consumer side. take() returns the next submitted slot or -1.
+	int take();
+	void finish(int slot);
+
+	SharedRoomJob& job(int slot) const;
+
+private:
+	struct Header
+	{
+		unsigned int  magic;
+		unsigned int  capacity;
+		volatile long head; // next slot to submit
+		volatile long tail; // next slot to take
+	};
+
+	Header*        m_header;
+	SharedRoomJob* m_jobs;
+};
+
+// Run up to maxJobs waiting jobs of the ring with graph, reading segments
+// from input and writing rooms to output. Returns the number of jobs run.
+int processSharedJobs(SharedJobRing& ring, const SharedRegion& input, const SharedRegion& output,
+	RoomGraph& graph, int maxJobs);
+
+#endif // SHAREDMEMORY_H
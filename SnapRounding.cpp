@@ -0,0 +1,801 @@
+#include "stdafx.h"
+#include "SnapRounding.h"
+#include "Predicates.h"
+
+#include <algorithm>
+#include <climits>
+#include <cmath>
+#include <queue>
+#include <set>
+
+// Routing steps allowed per input segment. Iterated snap rounding always
+// terminates; the limit only guards against rounding in the hit tests,
+// and pieces it leaves unresolved are counted for the caller.
+static const int kMaxRefinements = 256;
+
+// Hot pixels a grid cell holds before it is split into kRefine x kRefine
+// smaller cells, and the smallest cell size, in pixels, worth splitting to.
+static const size_t kCrowdedCell = 16;
+static const int kRefine = 4;
+static const int kMinCellPixels = 4;
+
+// Integer cell or pixel coordinates.
+struct GridPoint
+{
+	int ix;
+	int iy;
+
+	GridPoint() : ix(0), iy(0) {}
+	GridPoint(int x_, int y_) : ix(x_), iy(y_) {}
+
+	bool operator<(const GridPoint& other) const
+	{
+		if (ix != other.ix) return ix < other.ix;
+		return iy < other.iy;
+	}
+
+	bool operator==(const GridPoint& other) const
+	{
+		return ix == other.ix && iy == other.iy;
+	}
+
+	bool operator!=(const GridPoint& other) const
+	{
+		return !(*this == other);
+	}
+};
+
+// Item (segment or hot pixel) registered in one cell of the grid index.
+struct CellEntry
+{
+	GridPoint cell;
+	int item;
+};
+
+struct CellEntryLess
+{
+	bool operator()(const CellEntry& e1, const CellEntry& e2) const
+	{
+		if (e1.cell != e2.cell) return e1.cell < e2.cell;
+		return e1.item < e2.item;
+	}
+};
+
+// Hot pixel met while routing, with its position along the segment.
+struct PixelHit
+{
+	int pixel;
+	double t;
+};
+
+struct PixelHitByPixel
+{
+	bool operator()(const PixelHit& h1, const PixelHit& h2) const
+	{
+		return h1.pixel < h2.pixel;
+	}
+};
+
+struct PixelHitByT
+{
+	bool operator()(const PixelHit& h1, const PixelHit& h2) const
+	{
+		if (h1.t != h2.t) return h1.t < h2.t;
+		return h1.pixel < h2.pixel;
+	}
+};
+
+struct SnappedSegmentLess
+{
+	bool operator()(const SnappedSegment& s1, const SnappedSegment& s2) const
+	{
+		if (s1.ax != s2.ax) return s1.ax < s2.ax;
+		if (s1.ay != s2.ay) return s1.ay < s2.ay;
+		if (s1.bx != s2.bx) return s1.bx < s2.bx;
+		if (s1.by != s2.by) return s1.by < s2.by;
+		return s1.source < s2.source;
+	}
+};
+
+static bool sameSnappedSegment(const SnappedSegment& s1, const SnappedSegment& s2)
+{
+	return s1.ax == s2.ax && s1.ay == s2.ay && s1.bx == s2.bx && s1.by == s2.by;
+}
+
+static int gridCoord(double v, double size)
+{
+	return static_cast<int>(std::floor(v / size));
+}
+
+static GridPoint pixelOf(const Vec2& p, double pixelSize)
+{
+	return GridPoint(static_cast<int>(std::floor(p.x / pixelSize + 0.5)),
+		static_cast<int>(std::floor(p.y / pixelSize + 0.5)));
+}
+
+static Vec2 pixelCenter(const GridPoint& p, double pixelSize)
+{
+	return Vec2(p.ix * pixelSize, p.iy * pixelSize);
+}
+
+// Cells of size "cell" touched by segment a-b, limited to the cells from
+// "low" to "high".
+static void cellsAlong(const Vec2& a, const Vec2& b, double cell,
+	const GridPoint& low, const GridPoint& high, std::vector<GridPoint>& cells)
+{
+	cells.clear();
+
+	const double minX = std::min(a.x, b.x);
+	const double maxX = std::max(a.x, b.x);
+	const double dx = b.x - a.x;
+
+	const int firstColumn = std::max(gridCoord(minX, cell), low.ix);
+	const int lastColumn = std::min(gridCoord(maxX, cell), high.ix);
+
+	for (int cx = firstColumn; cx <= lastColumn; ++cx)
+	{
+		// Part of the segment inside this column (clamped to its extent).
+		const double x0 = std::min(std::max(cx * cell, minX), maxX);
+		const double x1 = std::min(std::max((cx + 1) * cell, minX), maxX);
+
+		double y0 = std::min(a.y, b.y);
+		double y1 = std::max(a.y, b.y);
+
+		if (dx != 0.0)
+		{
+			const double ya = a.y + (b.y - a.y) * (x0 - a.x) / dx;
+			const double yb = a.y + (b.y - a.y) * (x1 - a.x) / dx;
+			y0 = std::min(ya, yb);
+			y1 = std::max(ya, yb);
+		}
+
+		const int firstRow = std::max(gridCoord(y0, cell), low.iy);
+		const int lastRow = std::min(gridCoord(y1, cell), high.iy);
+
+		for (int cy = firstRow; cy <= lastRow; ++cy)
+			cells.push_back(GridPoint(cx, cy));
+	}
+}
+
+// Liang-Barsky clip of a-b against the closed square of a hot pixel.
+// On a hit, t is the middle of the clipped parameter range.
+static bool hitsPixel(const Vec2& a, const Vec2& b, const Vec2& center, double half, double& t)
+{
+	double t0 = 0.0;
+	double t1 = 1.0;
+
+	const double d[2] = { b.x - a.x, b.y - a.y };
+	const double lo[2] = { center.x - half - a.x, center.y - half - a.y };
+	const double hi[2] = { center.x + half - a.x, center.y + half - a.y };
+
+	for (int k = 0; k < 2; ++k)
+	{
+		if (d[k] == 0.0)
+		{
+			if (lo[k] > 0.0 || hi[k] < 0.0)
+				return false;
+			continue;
+		}
+
+		double ta = lo[k] / d[k];
+		double tb = hi[k] / d[k];
+		if (ta > tb)
+			std::swap(ta, tb);
+
+		t0 = std::max(t0, ta);
+		t1 = std::min(t1, tb);
+
+		if (t0 > t1)
+			return false;
+	}
+
+	t = 0.5 * (t0 + t1);
+	return true;
+}
+
+// Range of entries registered in one cell.
+static void cellRange(const std::vector<CellEntry>& entries, const GridPoint& cell,
+	size_t& first, size_t& last)
+{
+	CellEntry key;
+	key.cell = cell;
+	key.item = -1;
+
+	first = std::lower_bound(entries.begin(), entries.end(), key, CellEntryLess()) - entries.begin();
+
+	key.item = INT_MAX;
+	last = std::upper_bound(entries.begin() + first, entries.end(), key, CellEntryLess()) - entries.begin();
+}
+
+// Hot pixels by grid cell. Each level below the first has cells a
+// quarter the size of the level above, and only holds the pixels of the
+// cells that are crowded there.
+struct HotLevel
+{
+	double cellSize;
+	std::vector<CellEntry> entries;
+	std::vector<GridPoint> cells;   // scratch for the cells along a segment
+};
+
+// Shared state of one noding run. Routing works in pixel units, where
+// pixel centers are whole numbers and their squares' sides are exact.
+struct SnapRounder
+{
+	std::vector<GridPoint> hotPixels;   // sorted, unique
+	std::vector<HotLevel> levels;
+
+	// Scratch buffer reused across segments.
+	std::vector<PixelHit> hits;
+
+	// Register every hot pixel in the cells its square overlaps, on the
+	// first level, then split crowded cells until the cells get small.
+	void buildLevels(double cellSize)
+	{
+		levels.resize(1);
+		levels[0].cellSize = cellSize;
+
+		const GridPoint none(INT_MIN, INT_MIN);
+		const GridPoint all(INT_MAX, INT_MAX);
+
+		for (size_t h = 0; h < hotPixels.size(); ++h)
+			registerPixel(levels[0], static_cast<int>(h), none, all);
+
+		std::sort(levels[0].entries.begin(), levels[0].entries.end(), CellEntryLess());
+
+		while (levels.back().cellSize >= kRefine * kMinCellPixels)
+		{
+			HotLevel fine;
+			fine.cellSize = levels.back().cellSize / kRefine;
+
+			const std::vector<CellEntry>& coarse = levels.back().entries;
+			size_t first = 0;
+
+			while (first < coarse.size())
+			{
+				size_t last = first + 1;
+				while (last < coarse.size() && coarse[last].cell == coarse[first].cell)
+					++last;
+
+				if (last - first > kCrowdedCell)
+				{
+					const GridPoint& cell = coarse[first].cell;
+					const GridPoint low(cell.ix * kRefine, cell.iy * kRefine);
+					const GridPoint high(low.ix + kRefine - 1, low.iy + kRefine - 1);
+
+					for (size_t k = first; k < last; ++k)
+						registerPixel(fine, coarse[k].item, low, high);
+				}
+
+				first = last;
+			}
+
+			if (fine.entries.empty())
+				break;
+
+			std::sort(fine.entries.begin(), fine.entries.end(), CellEntryLess());
+			levels.push_back(fine);
+		}
+	}
+
+	void registerPixel(HotLevel& level, int pixel, const GridPoint& low, const GridPoint& high)
+	{
+		const Vec2 center = pixelCenter(hotPixels[pixel], 1.0);
+		const double half = 0.5;
+
+		const int firstColumn = std::max(gridCoord(center.x - half, level.cellSize), low.ix);
+		const int lastColumn = std::min(gridCoord(center.x + half, level.cellSize), high.ix);
+		const int firstRow = std::max(gridCoord(center.y - half, level.cellSize), low.iy);
+		const int lastRow = std::min(gridCoord(center.y + half, level.cellSize), high.iy);
+
+		for (int cx = firstColumn; cx <= lastColumn; ++cx)
+		{
+			for (int cy = firstRow; cy <= lastRow; ++cy)
+			{
+				CellEntry entry;
+				entry.cell = GridPoint(cx, cy);
+				entry.item = pixel;
+				level.entries.push_back(entry);
+			}
+		}
+	}
+
+	// Hot pixels whose square a-b passes, except "skipA" and "skipB",
+	// ordered along a-b.
+	void findHits(const Vec2& a, const Vec2& b, int skipA, int skipB)
+	{
+		hits.clear();
+		collectHits(0, a, b, GridPoint(INT_MIN, INT_MIN), GridPoint(INT_MAX, INT_MAX), skipA, skipB);
+
+		// A pixel square can span several cells.
+		std::sort(hits.begin(), hits.end(), PixelHitByPixel());
+		size_t unique = 0;
+		for (size_t k = 0; k < hits.size(); ++k)
+		{
+			if (unique == 0 || hits[unique - 1].pixel != hits[k].pixel)
+				hits[unique++] = hits[k];
+		}
+		hits.resize(unique);
+
+		std::sort(hits.begin(), hits.end(), PixelHitByT());
+	}
+
+	// Test the pixels of the cells along a-b on one level, from "low" to
+	// "high", and look up crowded cells on the next level.
+	void collectHits(size_t depth, const Vec2& a, const Vec2& b,
+		const GridPoint& low, const GridPoint& high, int skipA, int skipB)
+	{
+		HotLevel& level = levels[depth];
+		cellsAlong(a, b, level.cellSize, low, high, level.cells);
+
+		for (size_t c = 0; c < level.cells.size(); ++c)
+		{
+			const GridPoint cell = level.cells[c];
+
+			size_t first, last;
+			cellRange(level.entries, cell, first, last);
+
+			if (last - first > kCrowdedCell && depth + 1 < levels.size())
+			{
+				const GridPoint fineLow(cell.ix * kRefine, cell.iy * kRefine);
+				const GridPoint fineHigh(fineLow.ix + kRefine - 1, fineLow.iy + kRefine - 1);
+				collectHits(depth + 1, a, b, fineLow, fineHigh, skipA, skipB);
+				continue;
+			}
+
+			for (size_t k = first; k < last; ++k)
+			{
+				const int pixel = level.entries[k].item;
+				if (pixel == skipA || pixel == skipB)
+					continue;
+
+				PixelHit hit;
+				hit.pixel = pixel;
+				if (hitsPixel(a, b, pixelCenter(hotPixels[pixel], 1.0), 0.5, hit.t))
+					hits.push_back(hit);
+			}
+		}
+	}
+
+	int pixelIndex(const GridPoint& p) const
+	{
+		return static_cast<int>(std::lower_bound(hotPixels.begin(), hotPixels.end(), p) - hotPixels.begin());
+	}
+};
+
+static bool samePoint(const Vec2& p, const Vec2& q)
+{
+	return p.x == q.x && p.y == q.y;
+}
+
+static bool pointBefore(const Vec2& p, const Vec2& q)
+{
+	if (p.x != q.x) return p.x < q.x;
+	return p.y < q.y;
+}
+
+// Crossing point of two segments that cross properly. Touching and
+// collinear cases need nothing: their endpoints are hot already.
+static bool crossingPoint(const Segment& s, const Segment& t, Vec2& point)
+{
+	// Segments sharing an endpoint only touch; skip the exact zero tests.
+	if (samePoint(s.a, t.a) || samePoint(s.a, t.b) || samePoint(s.b, t.a) || samePoint(s.b, t.b))
+		return false;
+
+	const int o1 = orient2d(s.a, s.b, t.a);
+	const int o2 = orient2d(s.a, s.b, t.b);
+	if (o1 == 0 || o2 == 0 || o1 == o2)
+		return false;
+
+	const int o3 = orient2d(t.a, t.b, s.a);
+	const int o4 = orient2d(t.a, t.b, s.b);
+	if (o3 == 0 || o4 == 0 || o3 == o4)
+		return false;
+
+	const double d1x = s.b.x - s.a.x;
+	const double d1y = s.b.y - s.a.y;
+	const double d2x = t.b.x - t.a.x;
+	const double d2y = t.b.y - t.a.y;
+
+	const double denom = d1x * d2y - d1y * d2x;
+	const double u = ((t.a.x - s.a.x) * d2y - (t.a.y - s.a.y) * d2x) / denom;
+
+	point = Vec2(s.a.x + u * d1x, s.a.y + u * d1y);
+	return true;
+}
+
+// Events of the crossing sweep. At one point, segments end before
+// crossings are swapped and new segments start last.
+enum SweepEventType
+{
+	EventEnd,
+	EventCross,
+	EventStart
+};
+
+struct SweepEvent
+{
+	Vec2 point;
+	int  type;
+	int  lower;  // the segment; for a crossing, the one below before it
+	int  upper;
+
+	SweepEvent(const Vec2& p, int type_, int lower_, int upper_)
+		: point(p),
+		type(type_),
+		lower(lower_),
+		upper(upper_)
+	{
+	}
+};
+
+// Orders the crossing queue so that the earliest event comes out first.
+struct SweepEventLater
+{
+	bool operator()(const SweepEvent& e1, const SweepEvent& e2) const
+	{
+		if (e1.point.x != e2.point.x) return e1.point.x > e2.point.x;
+		if (e1.point.y != e2.point.y) return e1.point.y > e2.point.y;
+		if (e1.type != e2.type) return e1.type > e2.type;
+		if (e1.lower != e2.lower) return e1.lower > e2.lower;
+		return e1.upper > e2.upper;
+	}
+};
+
+// Segment on the sweep line. A crossing swaps the segments of two
+// neighbouring entries in place, which keeps the set ordered.
+struct SweepEntry
+{
+	mutable int segment;
+};
+
+struct SweepLine;
+
+// Set order of the sweep line. The set only compares the segment being
+// inserted with those already on the line, at its left endpoint.
+struct SweepEntryLess
+{
+	const SweepLine* line;
+
+	SweepEntryLess(const SweepLine* line_) : line(line_) {}
+
+	bool operator()(const SweepEntry& e1, const SweepEntry& e2) const;
+};
+
+typedef std::set<SweepEntry, SweepEntryLess> SweepSet;
+
+// Bentley-Ottmann sweep over segments directed from their smaller
+// endpoint. Only neighbours on the sweep line are tested, so the work
+// grows with the number of segments and crossings even where many
+// segments meet, and the order along the line comes from exact
+// orientation tests.
+struct SweepLine
+{
+	std::vector<Segment> segments;
+	std::vector<SweepSet::iterator> position;
+	std::vector<bool> active;
+	int inserting;
+
+	std::priority_queue<SweepEvent, std::vector<SweepEvent>, SweepEventLater> crossings;
+	Vec2 now;
+
+	SweepLine() : inserting(-1) {}
+
+	// Whether segment s, starting at the sweep point, lies below segment t.
+	bool below(int s, int t) const
+	{
+		const Segment& other = segments[t];
+		int side = samePoint(other.a, segments[s].a) ? 0 : orient2d(other.a, other.b, segments[s].a);
+		if (side == 0)
+			side = orient2d(other.a, other.b, segments[s].b);
+		if (side == 0)
+			return s < t;
+		return side < 0;
+	}
+
+	// Queue the crossing of neighbours "lower" and "upper" unless they
+	// have passed it already. Every crossing found becomes a hot pixel.
+	void testPair(int lower, int upper, double pixelSize, std::vector<GridPoint>& hot)
+	{
+		Vec2 point;
+		if (!crossingPoint(segments[lower], segments[upper], point))
+			return;
+
+		// Before the crossing, the segment starting later lies on the side
+		// of the other that its left endpoint is on.
+		const bool lowerLater = pointBefore(segments[upper].a, segments[lower].a);
+		const Segment& early = segments[lowerLater ? upper : lower];
+		const Vec2& start = segments[lowerLater ? lower : upper].a;
+		const bool laterBelow = orient2d(early.a, early.b, start) < 0;
+
+		if (laterBelow != lowerLater)
+			return;
+
+		hot.push_back(pixelOf(point, pixelSize));
+		crossings.push(SweepEvent(pointBefore(point, now) ? now : point, EventCross, lower, upper));
+	}
+
+	void run(double pixelSize, std::vector<GridPoint>& hot)
+	{
+		const int count = static_cast<int>(segments.size());
+		position.resize(count);
+		active.assign(count, false);
+
+		// Endpoints sorted latest first, so the next one is at the back.
+		std::vector<SweepEvent> endpoints;
+		endpoints.reserve(segments.size() * 2);
+
+		for (int i = 0; i < count; ++i)
+		{
+			if (!pointBefore(segments[i].a, segments[i].b))
+				continue;
+
+			endpoints.push_back(SweepEvent(segments[i].a, EventStart, i, -1));
+			endpoints.push_back(SweepEvent(segments[i].b, EventEnd, i, -1));
+		}
+
+		std::sort(endpoints.begin(), endpoints.end(), SweepEventLater());
+
+		SweepSet line((SweepEntryLess(this)));
+
+		while (!endpoints.empty() || !crossings.empty())
+		{
+			const bool endpoint = crossings.empty()
+				|| (!endpoints.empty() && SweepEventLater()(crossings.top(), endpoints.back()));
+
+			const SweepEvent event = endpoint ? endpoints.back() : crossings.top();
+			if (endpoint)
+				endpoints.pop_back();
+			else
+				crossings.pop();
+
+			now = event.point;
+
+			if (event.type == EventStart)
+			{
+				SweepEntry entry;
+				entry.segment = event.lower;
+
+				inserting = event.lower;
+				const SweepSet::iterator at = line.insert(entry).first;
+				inserting = -1;
+
+				position[event.lower] = at;
+				active[event.lower] = true;
+
+				SweepSet::iterator next = at;
+				++next;
+
+				if (at != line.begin())
+				{
+					SweepSet::iterator previous = at;
+					--previous;
+					testPair(previous->segment, at->segment, pixelSize, hot);
+				}
+				if (next != line.end())
+					testPair(at->segment, next->segment, pixelSize, hot);
+			}
+			else if (event.type == EventEnd)
+			{
+				const SweepSet::iterator at = position[event.lower];
+				SweepSet::iterator next = at;
+				++next;
+
+				const bool inside = at != line.begin() && next != line.end();
+				SweepSet::iterator previous = at;
+				if (inside)
+					--previous;
+
+				line.erase(at);
+				active[event.lower] = false;
+
+				if (inside)
+					testPair(previous->segment, next->segment, pixelSize, hot);
+			}
+			else
+			{
+				// Stale when the pair stopped being neighbours; a later
+				// test queues it again if it still has to cross.
+				if (!active[event.lower] || !active[event.upper])
+					continue;
+
+				const SweepSet::iterator low = position[event.lower];
+				SweepSet::iterator high = low;
+				++high;
+
+				if (high == line.end() || high != position[event.upper])
+					continue;
+
+				std::swap(low->segment, high->segment);
+				position[low->segment] = low;
+				position[high->segment] = high;
+
+				if (low != line.begin())
+				{
+					SweepSet::iterator previous = low;
+					--previous;
+					testPair(previous->segment, low->segment, pixelSize, hot);
+				}
+
+				SweepSet::iterator next = high;
+				++next;
+				if (next != line.end())
+					testPair(high->segment, next->segment, pixelSize, hot);
+			}
+		}
+	}
+};
+
+bool SweepEntryLess::operator()(const SweepEntry& e1, const SweepEntry& e2) const
+{
+	if (e1.segment == e2.segment)
+		return false;
+	if (e1.segment == line->inserting)
+		return line->below(e1.segment, e2.segment);
+	return !line->below(e2.segment, e1.segment);
+}
+
+static void emitPiece(const GridPoint& p, const GridPoint& q, int source,
+	std::vector<SnappedSegment>& pieces)
+{
+	SnappedSegment piece;
+	const bool forward = p < q;
+
+	piece.ax = forward ? p.ix : q.ix;
+	piece.ay = forward ? p.iy : q.iy;
+	piece.bx = forward ? q.ix : p.ix;
+	piece.by = forward ? q.iy : p.iy;
+	piece.source = source;
+
+	pieces.push_back(piece);
+}
+
+size_t snapRoundPieces(const std::vector<Segment>& segments, double pixelSize,
+	std::vector<SnappedSegment>& pieces)
+{
+	pieces.clear();
+
+	const int segmentCount = static_cast<int>(segments.size());
+	if (segmentCount == 0 || pixelSize <= 0.0)
+		return 0;
+
+	SnapRounder rounder;
+
+	// 1) Hot pixels: all endpoints, plus the crossings found by a sweep.
+	std::vector<GridPoint>& hot = rounder.hotPixels;
+	hot.reserve(segments.size() * 2);
+
+	double totalLength = 0.0;
+	int i;
+
+	for (i = 0; i < segmentCount; ++i)
+	{
+		const Segment& s = segments[i];
+		hot.push_back(pixelOf(s.a, pixelSize));
+		hot.push_back(pixelOf(s.b, pixelSize));
+
+		totalLength += distance(s.a, s.b);
+	}
+
+	{
+		SweepLine sweep;
+		sweep.segments.reserve(segments.size());
+
+		for (i = 0; i < segmentCount; ++i)
+		{
+			const Segment& s = segments[i];
+			sweep.segments.push_back(pointBefore(s.b, s.a) ? Segment(s.b, s.a) : s);
+		}
+
+		sweep.run(pixelSize, hot);
+	}
+
+	std::sort(hot.begin(), hot.end());
+	hot.erase(std::unique(hot.begin(), hot.end()), hot.end());
+
+	// 2) Cells about as large as an average segment keep the number of
+	// cells per segment small; crowded cells are split further.
+	rounder.buildLevels(std::max(4.0, totalLength / segmentCount / pixelSize));
+
+	// 3) Route every segment through its hot pixels, then route each piece
+	// again until no piece passes a hot pixel other than its own ends.
+	std::vector<int> path;
+	size_t unresolved = 0;
+	std::vector<std::pair<int, int> > pending;
+
+	for (i = 0; i < segmentCount; ++i)
+	{
+		const int start = rounder.pixelIndex(pixelOf(segments[i].a, pixelSize));
+		const int end = rounder.pixelIndex(pixelOf(segments[i].b, pixelSize));
+
+		if (start == end)
+			continue;
+
+		const Segment& s = segments[i];
+		rounder.findHits(Vec2(s.a.x / pixelSize, s.a.y / pixelSize), Vec2(s.b.x / pixelSize, s.b.y / pixelSize),
+			start, end);
+
+		path.clear();
+		path.push_back(start);
+		for (size_t k = 0; k < rounder.hits.size(); ++k)
+			path.push_back(rounder.hits[k].pixel);
+		path.push_back(end);
+
+		pending.clear();
+		for (size_t k = path.size() - 1; k > 0; --k)
+			pending.push_back(std::make_pair(path[k - 1], path[k]));
+
+		int refinements = 0;
+
+		while (!pending.empty())
+		{
+			const std::pair<int, int> piece = pending.back();
+			pending.pop_back();
+
+			const GridPoint& p = hot[piece.first];
+			const GridPoint& q = hot[piece.second];
+
+			rounder.findHits(pixelCenter(p, 1.0), pixelCenter(q, 1.0), piece.first, piece.second);
+
+			if (!rounder.hits.empty())
+			{
+				if (refinements < kMaxRefinements)
+				{
+					++refinements;
+
+					path.clear();
+					path.push_back(piece.first);
+					for (size_t k = 0; k < rounder.hits.size(); ++k)
+						path.push_back(rounder.hits[k].pixel);
+					path.push_back(piece.second);
+
+					for (size_t k = path.size() - 1; k > 0; --k)
+						pending.push_back(std::make_pair(path[k - 1], path[k]));
+
+					continue;
+				}
+
+				// Out of steps: keep the piece, but report it.
+				++unresolved;
+			}
+
+			emitPiece(p, q, i, pieces);
+		}
+	}
+
+	std::sort(pieces.begin(), pieces.end(), SnappedSegmentLess());
+
+	size_t unique = 0;
+	for (size_t k = 0; k < pieces.size(); ++k)
+	{
+		if (unique == 0 || !sameSnappedSegment(pieces[unique - 1], pieces[k])
+			|| pieces[unique - 1].source != pieces[k].source)
+		{
+			pieces[unique++] = pieces[k];
+		}
+	}
+	pieces.resize(unique);
+
+	return unresolved;
+}
+
+size_t snapRoundSegments(const std::vector<Segment>& segments, double pixelSize,
+	std::vector<Segment>& noded)
+{
+	std::vector<SnappedSegment> pieces;
+	const size_t unresolved = snapRoundPieces(segments, pixelSize, pieces);
+
+	noded.clear();
+	noded.reserve(pieces.size());
+
+	for (size_t k = 0; k < pieces.size(); ++k)
+	{
+		const SnappedSegment& s = pieces[k];
+		if (k > 0 && sameSnappedSegment(pieces[k - 1], s))
+			continue;
+
+		noded.push_back(Segment(Vec2(s.ax * pixelSize, s.ay * pixelSize),
+			Vec2(s.bx * pixelSize, s.by * pixelSize)));
+	}
+
+	return unresolved;
+}
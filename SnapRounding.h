@@ -0,0 +1,43 @@
+#ifndef SNAPROUNDING_H
+#define SNAPROUNDING_H
+
+#include <vector>
+#include "Geometry.h"
+
+// Piece of a snap-rounded segment, in grid units (multiples of the
+// pixel size). Endpoints are ordered so that (ax, ay) < (bx, by).
+struct SnappedSegment
+{
+	int ax;
+	int ay;
+	int bx;
+	int by;
+	int source; // index of the input segment it came from
+
+	SnappedSegment() : ax(0), ay(0), bx(0), by(0), source(-1) {}
+};
+
+// Iterated snap rounding on a grid of pixelSize.
+//
+// Every endpoint and every intersection point makes its grid cell a "hot
+// pixel". Each segment is routed through the centers of the hot pixels it
+// passes, and each resulting piece is routed again until it touches no
+// other hot pixel. The result is fully noded: pieces only meet at shared
+// endpoints, and all coordinates lie on the grid. Crossings come from a
+// sweep line that only tests neighbouring segments, and hot pixels are
+// looked up through a grid index whose crowded cells are split further,
+// so the cost grows with the number of segments and crossings rather
+// than their square, even where many segments meet.
+//
+// Pieces are sorted by endpoints; a piece shared by several inputs is
+// listed once per source. Returns the number of pieces that still pass
+// another hot pixel when a segment runs out of routing steps; the output
+// is only fully noded when it is zero.
+size_t snapRoundPieces(const std::vector<Segment>& segments, double pixelSize,
+	std::vector<SnappedSegment>& pieces);
+
+// Same as above, as unique segments in world coordinates.
+size_t snapRoundSegments(const std::vector<Segment>& segments, double pixelSize,
+	std::vector<Segment>& noded);
+
+#endif // SNAPROUNDING_H
@@ -0,0 +1,460 @@
+#include "stdafx.h"
+#include "Threading.h"
+
+#ifdef _WIN32
+#include <windows.h>
+#include <process.h>
+#else
+#include <pthread.h>
+#include <unistd.h>
+#endif
+
+// Tasks shared by the threads of one runParallel() call.
+struct TaskQueue
+{
+	const std::vector<Runnable*>* tasks;
+	volatile long next;
+};
+
+static long takeTask(TaskQueue* queue)
+{
+	return atomicIncrement(&queue->next) - 1;
+}
+
+static void drainQueue(TaskQueue* queue)
+{
+	const long count = static_cast<long>(queue->tasks->size());
+
+	for (long i = takeTask(queue); i < count; i = takeTask(queue))
+		(*queue->tasks)[i]->run();
+}
+
+#ifdef _WIN32
+static unsigned __stdcall workerMain(void* arg)
+{
+	drainQueue(static_cast<TaskQueue*>(arg));
+	return 0;
+}
+#else
+static void* workerMain(void* arg)
+{
+	drainQueue(static_cast<TaskQueue*>(arg));
+	return NULL;
+}
+#endif
+
+int hardwareThreadCount()
+{
+#ifdef _WIN32
+	SYSTEM_INFO info;
+	GetSystemInfo(&info);
+	const int count = static_cast<int>(info.dwNumberOfProcessors);
+#else
+	const int count = static_cast<int>(sysconf(_SC_NPROCESSORS_ONLN));
+#endif
+	return count > 0 ? count : 1;
+}
+
+int currentProcessId()
+{
+#ifdef _WIN32
+	return static_cast<int>(GetCurrentProcessId());
+#else
+	return static_cast<int>(getpid());
+#endif
+}
+
+// A call registered by atThreadExit(); each thread keeps a list.
+struct ThreadExitCall
+{
+	void            (*function)(void*);
+	void*           argument;
+	ThreadExitCall* next;
+};
+
+static void runThreadExitCalls(void* first)
+{
+	ThreadExitCall* call = static_cast<ThreadExitCall*>(first);
+
+	while (call != NULL)
+	{
+		ThreadExitCall* next = call->next;
+		call->function(call->argument);
+		delete call;
+		call = next;
+	}
+}
+
+#ifdef _WIN32
+static void WINAPI threadExitCallback(void* first)
+{
+	runThreadExitCalls(first);
+}
+#endif
+
+// The per-thread slot holding the list, with the system calling back at
+// thread exit. Created while the module loads, before any thread can
+// register a call.
+class ThreadExitSlot
+{
+public:
+	ThreadExitSlot()
+	{
+#ifdef _WIN32
+		m_index = FlsAlloc(threadExitCallback);
+		m_valid = m_index != FLS_OUT_OF_INDEXES;
+#else
+		m_valid = pthread_key_create(&m_key, runThreadExitCalls) == 0;
+#endif
+	}
+
+	bool valid() const { return m_valid; }
+
+	ThreadExitCall* get() const
+	{
+#ifdef _WIN32
+		return static_cast<ThreadExitCall*>(FlsGetValue(m_index));
+#else
+		return static_cast<ThreadExitCall*>(pthread_getspecific(m_key));
+#endif
+	}
+
+	void set(ThreadExitCall* first)
+	{
+#ifdef _WIN32
+		FlsSetValue(m_index, first);
+#else
+		pthread_setspecific(m_key, first);
+#endif
+	}
+
+private:
+#ifdef _WIN32
+	DWORD         m_index;
+#else
+	pthread_key_t m_key;
+#endif
+	bool          m_valid;
+};
+
+static ThreadExitSlot s_threadExitSlot;
+
+bool atThreadExit(void (*function)(void*), void* argument)
+{
+	if (!s_threadExitSlot.valid())
+		return false;
+
+	ThreadExitCall* call = new ThreadExitCall;
+	call->function = function;
+	call->argument = argument;
+	call->next = s_threadExitSlot.get();
+	s_threadExitSlot.set(call);
+
+	return true;
+}
+
+void runParallel(const std::vector<Runnable*>& tasks, int threadCount)
+{
+	if (threadCount <= 0)
+		threadCount = hardwareThreadCount();
+
+	if (threadCount > static_cast<int>(tasks.size()))
+		threadCount = static_cast<int>(tasks.size());
+
+	TaskQueue queue;
+	queue.tasks = &tasks;
+	queue.next = 0;
+
+	// The calling thread is one of the workers.
+	const int extra = threadCount - 1;
+
+#ifdef _WIN32
+	std::vector<HANDLE> threads;
+	for (int i = 0; i < extra; ++i)
+	{
+		HANDLE h = reinterpret_cast<HANDLE>(_beginthreadex(NULL, 0, workerMain, &queue, 0, NULL));
+		if (h != 0)
+			threads.push_back(h);
+	}
+
+	drainQueue(&queue);
+
+	for (size_t i = 0; i < threads.size(); ++i)
+	{
+		WaitForSingleObject(threads[i], INFINITE);
+		CloseHandle(threads[i]);
+	}
+#else
+	std::vector<pthread_t> threads;
+	for (int i = 0; i < extra; ++i)
+	{
+		pthread_t t;
+		if (pthread_create(&t, NULL, workerMain, &queue) == 0)
+			threads.push_back(t);
+	}
+
+	drainQueue(&queue);
+
+	for (size_t i = 0; i < threads.size(); ++i)
+		pthread_join(threads[i], NULL);
+#endif
+}
+
+#ifdef _WIN32
+struct Thread::Impl
+{
+	HANDLE handle;
+};
+
+static unsigned __stdcall threadMain(void* arg)
+{
+	static_cast<Runnable*>(arg)->run();
+	return 0;
+}
+#else
+struct Thread::Impl
+{
+	pthread_t handle;
+};
+
+static void* threadMain(void* arg)
+{
+	static_cast<Runnable*>(arg)->run();
+	return NULL;
+}
+#endif
+
+Thread::Thread()
+: m_impl(NULL)
+{
+}
+
+Thread::~Thread()
+{
+	join();
+}
+
+bool Thread::start(Runnable* task)
+{
+	if (m_impl != NULL)
+		return false;
+
+	Impl* impl = new Impl;
+
+#ifdef _WIN32
+	impl->handle = reinterpret_cast<HANDLE>(_beginthreadex(NULL, 0, threadMain, task, 0, NULL));
+	const bool started = impl->handle != 0;
+#else
+	const bool started = pthread_create(&impl->handle, NULL, threadMain, task) == 0;
+#endif
+
+	if (!started)
+	{
+		delete impl;
+		return false;
+	}
+
+	m_impl = impl;
+	return true;
+}
+
+void Thread::join()
+{
+	if (m_impl == NULL)
+		return;
+
+#ifdef _WIN32
+	WaitForSingleObject(m_impl->handle, INFINITE);
+	CloseHandle(m_impl->handle);
+#else
+	pthread_join(m_impl->handle, NULL);
+#endif
+
+	delete m_impl;
+	m_impl = NULL;
+}
+
+#ifdef _WIN32
+struct Mutex::Impl
+{
+	CRITICAL_SECTION section;
+};
+
+Mutex::Mutex()
+: m_impl(new Impl)
+{
+	InitializeCriticalSection(&m_impl->section);
+}
+
+Mutex::~Mutex()
+{
+	DeleteCriticalSection(&m_impl->section);
+	delete m_impl;
+}
+
+void Mutex::lock()
+{
+	EnterCriticalSection(&m_impl->section);
+}
+
+void Mutex::unlock()
+{
+	LeaveCriticalSection(&m_impl->section);
+}
+
+struct Semaphore::Impl
+{
+	HANDLE handle;
+};
+
+Semaphore::Semaphore(long count)
+: m_impl(new Impl)
+{
+	m_impl->handle = CreateSemaphore(NULL, count, 0x7fffffff, NULL);
+}
+
+Semaphore::~Semaphore()
+{
+	CloseHandle(m_impl->handle);
+	delete m_impl;
+}
+
+void Semaphore::wait()
+{
+	WaitForSingleObject(m_impl->handle, INFINITE);
+}
+
+bool Semaphore::tryWait()
+{
+	return WaitForSingleObject(m_impl->handle, 0) == WAIT_OBJECT_0;
+}
+
+void Semaphore::post()
+{
+	ReleaseSemaphore(m_impl->handle, 1, NULL);
+}
+#else
+struct Mutex::Impl
+{
+	pthread_mutex_t mutex;
+};
+
+Mutex::Mutex()
+: m_impl(new Impl)
+{
+	pthread_mutex_init(&m_impl->mutex, NULL);
+}
+
+Mutex::~Mutex()
+{
+	pthread_mutex_destroy(&m_impl->mutex);
+	delete m_impl;
+}
+
+void Mutex::lock()
+{
+	pthread_mutex_lock(&m_impl->mutex);
+}
+
+void Mutex::unlock()
+{
+	pthread_mutex_unlock(&m_impl->mutex);
+}
+
+// Built on a condition variable; unnamed POSIX semaphores are missing on
+// some platforms.
+struct Semaphore::Impl
+{
+	pthread_mutex_t mutex;
+	pthread_cond_t  cond;
+	long            count;
+};
+
+Semaphore::Semaphore(long count)
+: m_impl(new Impl)
+{
+	pthread_mutex_init(&m_impl->mutex, NULL);
+	pthread_cond_init(&m_impl->cond, NULL);
+	m_impl->count = count;
+}
+
+Semaphore::~Semaphore()
+{
+	pthread_cond_destroy(&m_impl->cond);
+	pthread_mutex_destroy(&m_impl->mutex);
+	delete m_impl;
+}
+
+void Semaphore::wait()
+{
+	pthread_mutex_lock(&m_impl->mutex);
+	while (m_impl->count == 0)
+		pthread_cond_wait(&m_impl->cond, &m_impl->mutex);
+	--m_impl->count;
+	pthread_mutex_unlock(&m_impl->mutex);
+}
+
+bool Semaphore::tryWait()
+{
+	pthread_mutex_lock(&m_impl->mutex);
+	const bool taken = m_impl->count > 0;
+	if (taken)
+		--m_impl->count;
+	pthread_mutex_unlock(&m_impl->mutex);
+	return taken;
+}
+
+void Semaphore::post()
+{
+	pthread_mutex_lock(&m_impl->mutex);
+	++m_impl->count;
+	pthread_cond_signal(&m_impl->cond);
+	pthread_mutex_unlock(&m_impl->mutex);
+}
+#endif
+
+long atomicIncrement(volatile long* value)
+{
+#ifdef _WIN32
+	return InterlockedIncrement(const_cast<long*>(value));
+#else
+	return __sync_add_and_fetch(value, 1L);
+#endif
+}
+
+long atomicCompareExchange(volatile long* value, long exchange, long comparand)
+{
+#ifdef _WIN32
+	return InterlockedCompareExchange(const_cast<long*>(value), exchange, comparand);
+#else
+	return __sync_val_compare_and_swap(value, comparand, exchange);
+#endif
+}
+
+void* atomicExchangePointer(void* volatile* target, void* value)
+{
+#ifdef _WIN32
+	return InterlockedExchangePointer(const_cast<void**>(target), value);
+#else
+	// Compare-and-swap is a full barrier, unlike __sync_lock_test_and_set.
+	void* old = *target;
+	for (;;)
+	{
+		void* seen = __sync_val_compare_and_swap(target, old, value);
+		if (seen == old)
+			return old;
+		old = seen;
+	}
+#endif
+}
+
+void memoryFence()
+{
+#ifdef _WIN32
+	// Interlocked operations are full barriers on every Windows target.
+	volatile long fence = 0;
+	InterlockedExchange(const_cast<long*>(&fence), 1);
+#else
+	__sync_synchronize();
+#endif
+}
@@ -0,0 +1,113 @@
+#ifndef THREADING_H
+#define THREADING_H
+
+#include <vector>
+
+// Unit of work for runParallel().
+class Runnable
+{
+public:
+	virtual ~Runnable() {}
+	virtual void run() = 0;
+};
+
+// Number of processors available to this process (at least 1).
+int hardwareThreadCount();
+
+// Id of this process.
+int currentProcessId();
+
+// Call function(argument) when the calling thread exits, the latest
+// registration first. False when the system offers no such hook. Calls
+// of the main thread may not run at process exit.
+bool atThreadExit(void (*function)(void*), void* argument);
+
+// Run all tasks on up to threadCount threads, the calling thread included,
+// and return once every task has finished. Threads pick the next task as
+// they become free, so uneven tasks still balance. threadCount <= 0 means
+// one thread per processor.
+void runParallel(const std::vector<Runnable*>& tasks, int threadCount);
+
+// Thread running one Runnable. The destructor joins.
+class Thread
+{
+public:
+	Thread();
+	~Thread();
+
+	// False if the thread could not be created or is already running.
+	bool start(Runnable* task);
+	void join();
+
+private:
+	Thread(const Thread&);
+	Thread& operator=(const Thread&);
+
+	struct Impl;
+	Impl* m_impl;
+};
+
+class Mutex
+{
+public:
+	Mutex();
+	~Mutex();
+
+	void lock();
+	void unlock();
+
+private:
+	Mutex(const Mutex&);
+	Mutex& operator=(const Mutex&);
+
+	struct Impl;
+	Impl* m_impl;
+};
+
+// Locks a mutex for the lifetime of the guard.
+class ScopedLock
+{
+public:
+	explicit ScopedLock(Mutex& mutex) : m_mutex(mutex) { m_mutex.lock(); }
+	~ScopedLock() { m_mutex.unlock(); }
+
+private:
+	ScopedLock(const ScopedLock&);
+	ScopedLock& operator=(const ScopedLock&);
+
+	Mutex& m_mutex;
+};
+
+// Counting semaphore.
+class Semaphore
+{
+public:
+	explicit Semaphore(long count = 0);
+	~Semaphore();
+
+	void wait();
+	bool tryWait();
+	void post();
+
+private:
+	Semaphore(const Semaphore&);
+	Semaphore& operator=(const Semaphore&);
+
+	struct Impl;
+	Impl* m_impl;
+};
+
+// Atomic operations. All of them are full memory barriers.
+long atomicIncrement(volatile long* value); // returns the new value
+long atomicCompareExchange(volatile long* value, long exchange, long comparand); // returns the old value
+void* atomicExchangePointer(void* volatile* target, void* value); // returns the old pointer
+void memoryFence();
+
+// Storage class of per-thread variables of plain types.
+#ifdef _MSC_VER
+#define ROOMGRAPH_THREAD_LOCAL __declspec(thread)
+#else
+#define ROOMGRAPH_THREAD_LOCAL __thread
+#endif
+
+#endif // THREADING_H
@@ -0,0 +1,667 @@
+#include "stdafx.h"
+#include "TiledRoomBuilder.h"
+#include "Checkpoint.h"
+#include "SegmentMerge.h"
+#include "SnapRounding.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <map>
+#include <set>
+
+// Rooms closer than this many snap cells to their tile border are left
+// to the stitching pass, and segments this close to a tile belong to it.
+static const double kMarginCells = 2.0;
+
+// First value of every payload, so the files of other jobs or other
+// kinds are told apart.
+static const int kManifestTag = 0x464e414d; // "MANF"
+static const int kTileTag = 0x454c4954;     // "TILE"
+static const int kStitchTag = 0x48435453;   // "STCH"
+
+// The clean-up stages run once over the whole input, before tiling, so
+// every tile and the stitching pass see the same walls; the graphs
+// themselves build the cleaned segments as they are.
+static bool cleanSegments(const std::vector<Segment>& segments, const RoomGraph::Options& options,
+	double snapSize, std::vector<Segment>& cleaned, size_t& unnoded)
+{
+	unnoded = 0;
+
+	if (options.mergeCollinear && options.snapRounding)
+	{
+		std::vector<Segment> merged;
+		mergeCollinearSegments(segments, snapSize, merged);
+		unnoded = snapRoundSegments(merged, snapSize, cleaned);
+	}
+	else if (options.mergeCollinear)
+	{
+		mergeCollinearSegments(segments, snapSize, cleaned);
+	}
+	else if (options.snapRounding)
+	{
+		unnoded = snapRoundSegments(segments, snapSize, cleaned);
+	}
+	else
+	{
+		return false;
+	}
+
+	return true;
+}
+
+// Snap cell of segment endpoint 2 * segment + side.
+struct CellEndpoint
+{
+	int    ix;
+	int    iy;
+	size_t endpoint;
+
+	bool operator<(const CellEndpoint& other) const
+	{
+		if (ix != other.ix) return ix < other.ix;
+		if (iy != other.iy) return iy < other.iy;
+		return endpoint < other.endpoint;
+	}
+};
+
+// A single build puts each node at the first endpoint seen in its snap
+// cell, but a tile only sees some of the endpoints. Moving every endpoint
+// to the first one of its cell up front gives the tiles and the stitching
+// the node positions of a single build.
+static void moveToFirstPoints(std::vector<Segment>& segments, double snapSize)
+{
+	std::vector<CellEndpoint> endpoints(2 * segments.size());
+	size_t i;
+
+	for (i = 0; i < endpoints.size(); ++i)
+	{
+		const Vec2& p = (i & 1) ? segments[i / 2].b : segments[i / 2].a;
+		endpoints[i].ix = static_cast<int>(std::floor(p.x / snapSize + 0.5));
+		endpoints[i].iy = static_cast<int>(std::floor(p.y / snapSize + 0.5));
+		endpoints[i].endpoint = i;
+	}
+
+	std::sort(endpoints.begin(), endpoints.end());
+
+	Vec2 first;
+	for (i = 0; i < endpoints.size(); ++i)
+	{
+		const size_t e = endpoints[i].endpoint;
+		Vec2& p = (e & 1) ? segments[e / 2].b : segments[e / 2].a;
+
+		if (i == 0 || endpoints[i - 1].ix != endpoints[i].ix || endpoints[i - 1].iy != endpoints[i].iy)
+			first = p;
+		else
+			p = first;
+	}
+}
+
+static RoomGraph::Options graphOptions(const RoomGraph::Options& options)
+{
+	RoomGraph::Options result = options;
+	result.mergeCollinear = false;
+	result.snapRounding = false;
+	return result;
+}
+
+static void writeRoomList(PayloadWriter& writer, const std::vector<RoomGraph::Room>& rooms)
+{
+	writer.putInt(static_cast<int>(rooms.size()));
+
+	for (size_t r = 0; r < rooms.size(); ++r)
+	{
+		const RoomGraph::Room& room = rooms[r];
+
+		writer.putInt(static_cast<int>(room.polygon.size()));
+		writer.putDouble(room.area);
+		writer.putDouble(room.center.x);
+		writer.putDouble(room.center.y);
+
+		for (size_t k = 0; k < room.polygon.size(); ++k)
+		{
+			writer.putDouble(room.polygon[k].x);
+			writer.putDouble(room.polygon[k].y);
+		}
+	}
+}
+
+static bool readRoomList(PayloadReader& reader, std::vector<RoomGraph::Room>& rooms)
+{
+	int count = 0;
+	if (!reader.getInt(count) || count < 0)
+		return false;
+
+	rooms.resize(count);
+
+	for (int r = 0; r < count; ++r)
+	{
+		RoomGraph::Room& room = rooms[r];
+
+		int vertexCount = 0;
+		if (!reader.getInt(vertexCount) || vertexCount < 0)
+			return false;
+
+		reader.getDouble(room.area);
+		reader.getDouble(room.center.x);
+		reader.getDouble(room.center.y);
+
+		room.polygon.resize(vertexCount);
+		for (int k = 0; k < vertexCount; ++k)
+		{
+			reader.getDouble(room.polygon[k].x);
+			reader.getDouble(room.polygon[k].y);
+		}
+
+		if (!reader.ok())
+			return false;
+	}
+
+	return true;
+}
+
+TiledRoomBuilder::TiledRoomBuilder()
+: m_tileSize(100.0),
+m_snapSize(1e-3),
+m_options(),
+m_directory(),
+m_tileLimit(0),
+m_origin(),
+m_columns(0),
+m_rows(0),
+m_tiles(),
+m_stitched(),
+m_rooms(),
+m_progress()
+{
+}
+
+void TiledRoomBuilder::setTileSize(double tileSize)
+{
+	if (tileSize > 0.0)
+		m_tileSize = tileSize;
+}
+
+void TiledRoomBuilder::setSnapSize(double snapSize)
+{
+	if (snapSize > 0.0)
+		m_snapSize = snapSize;
+}
+
+void TiledRoomBuilder::setOptions(const RoomGraph::Options& options)
+{
+	m_options = options;
+}
+
+void TiledRoomBuilder::setCheckpointDirectory(const std::string& directory)
+{
+	m_directory = directory;
+}
+
+void TiledRoomBuilder::setTileLimit(int tileLimit)
+{
+	m_tileLimit = tileLimit > 0 ? tileLimit : 0;
+}
+
+const std::vector<RoomGraph::Room>& TiledRoomBuilder::getRooms() const
+{
+	return m_rooms;
+}
+
+const TiledRoomBuilder::Progress& TiledRoomBuilder::getProgress() const
+{
+	return m_progress;
+}
+
+bool TiledRoomBuilder::build(const std::vector<Segment>& segments)
+{
+	m_tiles.clear();
+	m_stitched.clear();
+	m_rooms.clear();
+	m_progress = Progress();
+
+	if (segments.empty())
+		return true;
+
+	std::vector<Segment> input;
+	if (!cleanSegments(segments, m_options, m_snapSize, input, m_progress.unnodedPieces))
+		input = segments;
+
+	moveToFirstPoints(input, m_snapSize);
+
+	if (input.empty())
+		return true;
+
+	layoutTiles(input);
+	m_progress.tileCount = static_cast<int>(m_tiles.size());
+
+	const bool checkpoints = !m_directory.empty();
+	if (checkpoints && !prepareCheckpoints(segments))
+		return false;
+
+	bool allDone = true;
+	size_t t;
+
+	for (t = 0; t < m_tiles.size(); ++t)
+	{
+		if (checkpoints && loadTile(static_cast<int>(t)))
+			++m_progress.tilesLoaded;
+		else
+			allDone = false;
+	}
+
+	// 1) Build the tiles that have no checkpoint yet.
+	if (!allDone)
+	{
+		std::vector<std::vector<int> > buckets;
+		bucketSegments(input, buckets);
+
+		for (t = 0; t < m_tiles.size(); ++t)
+		{
+			if (m_tiles[t].done)
+				continue;
+
+			if (m_tileLimit > 0 && m_progress.tilesBuilt == m_tileLimit)
+				return false;
+
+			buildTile(static_cast<int>(t), input, buckets[t]);
+			std::vector<int>().swap(buckets[t]);
+			++m_progress.tilesBuilt;
+
+			if (checkpoints && !saveTile(static_cast<int>(t)))
+				return false;
+		}
+	}
+
+	// 2) Rooms across tile borders, unless a finished job left them.
+	if (!(allDone && checkpoints && loadStitch()))
+	{
+		stitch();
+
+		if (checkpoints && !saveStitch())
+			return false;
+	}
+	else
+	{
+		m_progress.stitchLoaded = true;
+	}
+
+	for (t = 0; t < m_tiles.size(); ++t)
+	{
+		m_rooms.insert(m_rooms.end(), m_tiles[t].rooms.begin(), m_tiles[t].rooms.end());
+		std::vector<OpenWall>().swap(m_tiles[t].walls);
+	}
+	m_rooms.insert(m_rooms.end(), m_stitched.begin(), m_stitched.end());
+
+	return true;
+}
+
+void TiledRoomBuilder::layoutTiles(const std::vector<Segment>& segments)
+{
+	Vec2 lo = segments[0].a;
+	Vec2 hi = segments[0].a;
+
+	for (size_t i = 0; i < segments.size(); ++i)
+	{
+		const Vec2* ends[2] = { &segments[i].a, &segments[i].b };
+		for (int k = 0; k < 2; ++k)
+		{
+			lo.x = std::min(lo.x, ends[k]->x);
+			lo.y = std::min(lo.y, ends[k]->y);
+			hi.x = std::max(hi.x, ends[k]->x);
+			hi.y = std::max(hi.y, ends[k]->y);
+		}
+	}
+
+	m_origin = lo;
+	m_columns = std::max(1, static_cast<int>(std::ceil((hi.x - lo.x) / m_tileSize)));
+	m_rows = std::max(1, static_cast<int>(std::ceil((hi.y - lo.y) / m_tileSize)));
+
+	m_tiles.resize(static_cast<size_t>(m_columns) * m_rows);
+	for (size_t t = 0; t < m_tiles.size(); ++t)
+		m_tiles[t].done = false;
+}
+
+// Every segment goes to each tile its bounding box reaches, margin
+// included. Finished tiles get nothing.
+void TiledRoomBuilder::bucketSegments(const std::vector<Segment>& segments,
+	std::vector<std::vector<int> >& buckets) const
+{
+	const double margin = kMarginCells * m_snapSize;
+	buckets.assign(m_tiles.size(), std::vector<int>());
+
+	for (size_t i = 0; i < segments.size(); ++i)
+	{
+		const Segment& s = segments[i];
+
+		const double x0 = (std::min(s.a.x, s.b.x) - margin - m_origin.x) / m_tileSize;
+		const double x1 = (std::max(s.a.x, s.b.x) + margin - m_origin.x) / m_tileSize;
+		const double y0 = (std::min(s.a.y, s.b.y) - margin - m_origin.y) / m_tileSize;
+		const double y1 = (std::max(s.a.y, s.b.y) + margin - m_origin.y) / m_tileSize;
+
+		const int c0 = std::max(0, static_cast<int>(std::floor(x0)));
+		const int c1 = std::min(m_columns - 1, static_cast<int>(std::floor(x1)));
+		const int r0 = std::max(0, static_cast<int>(std::floor(y0)));
+		const int r1 = std::min(m_rows - 1, static_cast<int>(std::floor(y1)));
+
+		for (int r = r0; r <= r1; ++r)
+		{
+			for (int c = c0; c <= c1; ++c)
+			{
+				const size_t tile = static_cast<size_t>(r) * m_columns + c;
+				if (!m_tiles[tile].done)
+					buckets[tile].push_back(static_cast<int>(i));
+			}
+		}
+	}
+}
+
+void TiledRoomBuilder::buildTile(int tile, const std::vector<Segment>& segments, const std::vector<int>& bucket)
+{
+	Tile& result = m_tiles[tile];
+	result.rooms.clear();
+	result.walls.clear();
+
+	std::vector<Segment> input(bucket.size());
+	for (size_t i = 0; i < bucket.size(); ++i)
+		input[i] = segments[bucket[i]];
+
+	RoomGraph graph;
+	graph.setSnapSize(m_snapSize);
+	graph.setOptions(graphOptions(m_options));
+	graph.build(input);
+
+	const std::vector<RoomGraph::Room>& rooms = graph.getRooms();
+	std::vector<char> owned(rooms.size(), 0);
+
+	for (size_t r = 0; r < rooms.size(); ++r)
+	{
+		if (insideTile(tile, rooms[r].polygon))
+		{
+			owned[r] = 1;
+			result.rooms.push_back(rooms[r]);
+		}
+	}
+
+	std::vector<RoomGraph::Wall> walls;
+	graph.getWalls(walls);
+
+	for (size_t w = 0; w < walls.size(); ++w)
+	{
+		const bool left = walls[w].leftRoom >= 0 && owned[walls[w].leftRoom];
+		const bool right = walls[w].rightRoom >= 0 && owned[walls[w].rightRoom];
+
+		if (left && right)
+			continue;
+
+		OpenWall open;
+		open.segment = walls[w].segment;
+		open.ownedSides = (left ? 1 : 0) | (right ? 2 : 0);
+		result.walls.push_back(open);
+	}
+
+	result.done = true;
+}
+
+// Build the open walls of all tiles together. A wall reaching several
+// tiles is taken once. Rooms inside a tile were kept by that tile, and a
+// face bounded by a wall on its owned side is a union of kept rooms whose
+// shared walls were closed; both are dropped.
+void TiledRoomBuilder::stitch()
+{
+	std::set<CellEdge> uniqueWalls;
+	std::set<CellEdge> ownedLeft;
+	std::vector<Segment> input;
+
+	for (size_t t = 0; t < m_tiles.size(); ++t)
+	{
+		const std::vector<OpenWall>& walls = m_tiles[t].walls;
+
+		for (size_t w = 0; w < walls.size(); ++w)
+		{
+			const CellKey a = cellOf(walls[w].segment.a);
+			const CellKey b = cellOf(walls[w].segment.b);
+
+			if (a == b)
+				continue;
+
+			if (walls[w].ownedSides & 1)
+				ownedLeft.insert(CellEdge(a, b));
+			if (walls[w].ownedSides & 2)
+				ownedLeft.insert(CellEdge(b, a));
+
+			const CellEdge key = (a < b) ? CellEdge(a, b) : CellEdge(b, a);
+			if (uniqueWalls.insert(key).second)
+				input.push_back(walls[w].segment);
+		}
+	}
+
+	RoomGraph graph;
+	graph.setSnapSize(m_snapSize);
+	graph.setOptions(graphOptions(m_options));
+	graph.build(input);
+
+	const std::vector<RoomGraph::Room>& rooms = graph.getRooms();
+
+	for (size_t r = 0; r < rooms.size(); ++r)
+	{
+		const std::vector<Vec2>& poly = rooms[r].polygon;
+
+		if (insideAnyTile(poly))
+			continue;
+
+		bool merged = false;
+		for (size_t k = 0; k < poly.size() && !merged; ++k)
+		{
+			const CellEdge edge(cellOf(poly[k]), cellOf(poly[(k + 1) % poly.size()]));
+			merged = ownedLeft.count(edge) > 0;
+		}
+
+		if (!merged)
+			m_stitched.push_back(rooms[r]);
+	}
+}
+
+bool TiledRoomBuilder::insideTile(int tile, const std::vector<Vec2>& polygon) const
+{
+	const double margin = kMarginCells * m_snapSize;
+	const double x0 = m_origin.x + (tile % m_columns) * m_tileSize + margin;
+	const double y0 = m_origin.y + (tile / m_columns) * m_tileSize + margin;
+	const double x1 = x0 + m_tileSize - 2.0 * margin;
+	const double y1 = y0 + m_tileSize - 2.0 * margin;
+
+	for (size_t k = 0; k < polygon.size(); ++k)
+	{
+		const Vec2& p = polygon[k];
+		if (p.x <= x0 || p.x >= x1 || p.y <= y0 || p.y >= y1)
+			return false;
+	}
+
+	return !polygon.empty();
+}
+
+// Only the tile holding the first vertex can contain the whole polygon.
+bool TiledRoomBuilder::insideAnyTile(const std::vector<Vec2>& polygon) const
+{
+	if (polygon.empty())
+		return false;
+
+	const int c = static_cast<int>(std::floor((polygon[0].x - m_origin.x) / m_tileSize));
+	const int r = static_cast<int>(std::floor((polygon[0].y - m_origin.y) / m_tileSize));
+
+	if (c < 0 || c >= m_columns || r < 0 || r >= m_rows)
+		return false;
+
+	return insideTile(r * m_columns + c, polygon);
+}
+
+TiledRoomBuilder::CellKey TiledRoomBuilder::cellOf(const Vec2& p) const
+{
+	CellKey key;
+	key.ix = static_cast<int>(std::floor(p.x / m_snapSize + 0.5));
+	key.iy = static_cast<int>(std::floor(p.y / m_snapSize + 0.5));
+	return key;
+}
+
+std::string TiledRoomBuilder::checkpointPath(const char* name) const
+{
+	return m_directory + "/" + name;
+}
+
+std::string TiledRoomBuilder::tilePath(int tile) const
+{
+	char name[32];
+	std::sprintf(name, "tile-%d.rgc", tile);
+	return checkpointPath(name);
+}
+
+// Everything the tile results depend on, the input included (by CRC).
+void TiledRoomBuilder::encodeManifest(const std::vector<Segment>& segments, std::vector<char>& bytes) const
+{
+	PayloadWriter writer(bytes);
+
+	writer.putInt(kManifestTag);
+	writer.putInt(static_cast<int>(segments.size()));
+	writer.putInt(static_cast<int>(crc32(&segments[0], segments.size() * sizeof(Segment))));
+	writer.putDouble(m_tileSize);
+	writer.putDouble(m_snapSize);
+	writer.putInt((m_options.mergeCollinear ? 1 : 0) | (m_options.snapRounding ? 2 : 0));
+	writer.putDouble(m_origin.x);
+	writer.putDouble(m_origin.y);
+	writer.putInt(m_columns);
+	writer.putInt(m_rows);
+}
+
+// Keep the checkpoints of an interrupted run of the same job; start
+// over, removing the old files, for any other job.
+bool TiledRoomBuilder::prepareCheckpoints(const std::vector<Segment>& segments)
+{
+	std::vector<char> manifest;
+	encodeManifest(segments, manifest);
+
+	const std::string path = checkpointPath("manifest.rgc");
+
+	std::vector<char> existing;
+	const CheckpointStatus status = readCheckpoint(path, existing);
+
+	if (status == CheckpointOk && existing == manifest)
+		return true;
+
+	if (status == CheckpointCorrupt)
+		++m_progress.corruptCheckpoints;
+
+	for (size_t t = 0; t < m_tiles.size(); ++t)
+		std::remove(tilePath(static_cast<int>(t)).c_str());
+	std::remove(checkpointPath("stitch.rgc").c_str());
+
+	return writeCheckpoint(path, manifest);
+}
+
+bool TiledRoomBuilder::saveTile(int tile) const
+{
+	const Tile& result = m_tiles[tile];
+
+	std::vector<char> bytes;
+	PayloadWriter writer(bytes);
+
+	writer.putInt(kTileTag);
+	writer.putInt(tile);
+	writeRoomList(writer, result.rooms);
+
+	writer.putInt(static_cast<int>(result.walls.size()));
+	for (size_t w = 0; w < result.walls.size(); ++w)
+	{
+		const OpenWall& wall = result.walls[w];
+		writer.putDouble(wall.segment.a.x);
+		writer.putDouble(wall.segment.a.y);
+		writer.putDouble(wall.segment.b.x);
+		writer.putDouble(wall.segment.b.y);
+		writer.putInt(wall.ownedSides);
+	}
+
+	return writeCheckpoint(tilePath(tile), bytes);
+}
+
+bool TiledRoomBuilder::loadTile(int tile)
+{
+	std::vector<char> bytes;
+	const CheckpointStatus status = readCheckpoint(tilePath(tile), bytes);
+
+	if (status == CheckpointCorrupt)
+		++m_progress.corruptCheckpoints;
+	if (status != CheckpointOk)
+		return false;
+
+	Tile& result = m_tiles[tile];
+	PayloadReader reader(bytes);
+
+	int tag = 0;
+	int index = -1;
+	int wallCount = 0;
+
+	bool valid = reader.getInt(tag) && tag == kTileTag
+		&& reader.getInt(index) && index == tile
+		&& readRoomList(reader, result.rooms)
+		&& reader.getInt(wallCount) && wallCount >= 0;
+
+	if (valid)
+	{
+		result.walls.resize(wallCount);
+		for (int w = 0; w < wallCount; ++w)
+		{
+			OpenWall& wall = result.walls[w];
+			reader.getDouble(wall.segment.a.x);
+			reader.getDouble(wall.segment.a.y);
+			reader.getDouble(wall.segment.b.x);
+			reader.getDouble(wall.segment.b.y);
+			reader.getInt(wall.ownedSides);
+		}
+
+		valid = reader.ok() && reader.atEnd();
+	}
+
+	if (!valid)
+	{
+		++m_progress.corruptCheckpoints;
+		result.rooms.clear();
+		result.walls.clear();
+		return false;
+	}
+
+	result.done = true;
+	return true;
+}
+
+bool TiledRoomBuilder::saveStitch() const
+{
+	std::vector<char> bytes;
+	PayloadWriter writer(bytes);
+
+	writer.putInt(kStitchTag);
+	writeRoomList(writer, m_stitched);
+
+	return writeCheckpoint(checkpointPath("stitch.rgc"), bytes);
+}
+
+bool TiledRoomBuilder::loadStitch()
+{
+	std::vector<char> bytes;
+	const CheckpointStatus status = readCheckpoint(checkpointPath("stitch.rgc"), bytes);
+
+	if (status == CheckpointCorrupt)
+		++m_progress.corruptCheckpoints;
+	if (status != CheckpointOk)
+		return false;
+
+	PayloadReader reader(bytes);
+	int tag = 0;
+
+	if (!(reader.getInt(tag) && tag == kStitchTag && readRoomList(reader, m_stitched) && reader.atEnd()))
+	{
+		++m_progress.corruptCheckpoints;
+		m_stitched.clear();
+		return false;
+	}
+
+	return true;
+}
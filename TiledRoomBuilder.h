@@ -0,0 +1,149 @@
+#ifndef TILEDROOMBUILDER_H
+#define TILEDROOMBUILDER_H
+
+#include <vector>
+#include <string>
+#include "Geometry.h"
+#include "RoomGraph.h"
+
+// Builds very large inputs one square tile at a time, with checkpoints.
+//
+// Every tile is built from the segments that touch it and keeps the
+// rooms lying strictly inside it; those are exact, since every wall that
+// could cut them touches the tile. The walls that do not have such rooms
+// on both sides stay open, and a final stitching build over all open
+// walls finds the rooms that cross tile borders. Rooms come out tile by
+// tile followed by the stitched ones, so their order differs from a
+// single build of the whole input. Merging and snap rounding, when
+// enabled, run once over the whole input before it is tiled, and so does
+// the choice of node positions.
+//
+// With a checkpoint directory, a manifest identifying the job and one
+// file per finished tile (its rooms and open walls) are written as the
+// build goes, then the stitched rooms. A restarted build of the same
+// input reuses every valid file and only builds what is missing; files
+// failing their checksum are built again.
+class TiledRoomBuilder
+{
+public:
+	// What the last build() did.
+	struct Progress
+	{
+		int  tileCount;
+		int  tilesLoaded;
+		int  tilesBuilt;
+		int  corruptCheckpoints;
+		bool stitchLoaded;
+
+		// Pieces snap rounding could not resolve; see
+		// RoomGraph::BuildStats::unnodedPieces.
+		size_t unnodedPieces;
+
+		Progress()
+			: tileCount(0),
+			tilesLoaded(0),
+			tilesBuilt(0),
+			corruptCheckpoints(0),
+			stitchLoaded(false),
+			unnodedPieces(0)
+		{
+		}
+	};
+
+	TiledRoomBuilder();
+
+	// Edge length of a tile in world units, default 100.
+	void setTileSize(double tileSize);
+
+	// Applied to every tile graph and to the stitching graph.
+	void setSnapSize(double snapSize);
+	void setOptions(const RoomGraph::Options& options);
+
+	// Directory for checkpoints; empty (the default) writes none.
+	void setCheckpointDirectory(const std::string& directory);
+
+	// Build at most this many tiles per call, then return false; a later
+	// call continues. 0 (the default) means no limit.
+	void setTileLimit(int tileLimit);
+
+	// True once all rooms are found. False when the tile limit stopped
+	// the build or a checkpoint could not be written.
+	bool build(const std::vector<Segment>& segments);
+
+	const std::vector<RoomGraph::Room>& getRooms() const;
+	const Progress& getProgress() const;
+
+private:
+	// A wall left for stitching. Bit 0 of ownedSides: a room kept by its
+	// tile lies left of segment.a -> segment.b; bit 1: on the right.
+	struct OpenWall
+	{
+		Segment segment;
+		int     ownedSides;
+	};
+
+	struct Tile
+	{
+		bool                         done;
+		std::vector<RoomGraph::Room> rooms;
+		std::vector<OpenWall>        walls;
+	};
+
+	// Snap grid cell of a point.
+	struct CellKey
+	{
+		int ix;
+		int iy;
+
+		bool operator<(const CellKey& other) const
+		{
+			if (ix != other.ix) return ix < other.ix;
+			return iy < other.iy;
+		}
+
+		bool operator==(const CellKey& other) const
+		{
+			return ix == other.ix && iy == other.iy;
+		}
+	};
+
+	typedef std::pair<CellKey, CellKey> CellEdge;
+
+	void layoutTiles(const std::vector<Segment>& segments);
+	void bucketSegments(const std::vector<Segment>& segments, std::vector<std::vector<int> >& buckets) const;
+	void buildTile(int tile, const std::vector<Segment>& segments, const std::vector<int>& bucket);
+	void stitch();
+
+	bool insideTile(int tile, const std::vector<Vec2>& polygon) const;
+	bool insideAnyTile(const std::vector<Vec2>& polygon) const;
+	CellKey cellOf(const Vec2& p) const;
+
+	// Checkpoint files.
+	std::string checkpointPath(const char* name) const;
+	std::string tilePath(int tile) const;
+	void encodeManifest(const std::vector<Segment>& segments, std::vector<char>& bytes) const;
+	bool prepareCheckpoints(const std::vector<Segment>& segments);
+	bool saveTile(int tile) const;
+	bool loadTile(int tile);
+	bool saveStitch() const;
+	bool loadStitch();
+
+private:
+	double             m_tileSize;
+	double             m_snapSize;
+	RoomGraph::Options m_options;
+	std::string        m_directory;
+	int                m_tileLimit;
+
+	// Tile grid: m_columns x m_rows tiles from m_origin.
+	Vec2              m_origin;
+	int               m_columns;
+	int               m_rows;
+	std::vector<Tile> m_tiles;
+
+	std::vector<RoomGraph::Room> m_stitched;
+	std::vector<RoomGraph::Room> m_rooms;
+	Progress                     m_progress;
+};
+
+#endif // TILEDROOMBUILDER_H